@@ -2,6 +2,9 @@ attribute vec3 a_vertex;
 attribute vec3 a_normal;
 attribute vec2 a_uv;
 attribute vec4 a_color;
+#ifdef USE_TANGENTS
+attribute vec4 a_tangent; //packed in 0..1
+#endif
 
 uniform vec3 u_camera_pos;
 
@@ -14,11 +17,18 @@ varying vec3 v_world_position;
 varying vec3 v_normal;
 varying vec2 v_uv;
 varying vec4 v_color;
+#ifdef USE_TANGENTS
+varying vec4 v_tangent; //w is the sign of the bitangent
+#endif
 
 void main()
 {	
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+#ifdef USE_TANGENTS
+	vec4 tangent = a_tangent * 2.0 - 1.0;
+	v_tangent = vec4( (u_model * vec4( tangent.xyz, 0.0) ).xyz, tangent.w );
+#endif
 	
 	//calcule the vertex in object space
 	v_position = a_vertex;
@@ -9,6 +9,9 @@ varying vec3 v_position;
 varying vec3 v_world_position;
 varying vec3 v_normal;
 varying vec2 v_uv;
+#ifdef USE_TANGENTS
+varying vec4 v_tangent;
+#endif
 
 uniform vec3 u_camera_position;
 uniform vec4 u_color;
@@ -117,7 +120,13 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv){
 vec3 perturbNormal( vec3 N, vec3 V, vec2 texcoord, vec3 normal_pixel )
 {
 	normal_pixel = normal_pixel * 255./127. - 128./127.;
+#ifdef USE_TANGENTS
+	//tangent frame from the vertex tangents (MikkTSpace), the bitangent is not normalized as the baker expects
+	vec3 B = v_tangent.w * cross(N, v_tangent.xyz);
+	mat3 TBN = mat3(v_tangent.xyz, B, N);
+#else
 	mat3 TBN = cotangent_frame(N, V, texcoord);
+#endif
 	return normalize(TBN * normal_pixel);
 }
 
@@ -0,0 +1,79 @@
+attribute vec3 a_vertex;
+attribute vec3 a_normal;
+attribute vec2 a_uv;
+attribute vec4 a_color;
+attribute vec4 a_bones; //indices of the palette (0..255)
+attribute vec4 a_weights;
+
+//per instance
+attribute mat4 u_model;
+attribute vec4 a_animation; //clip, time offset, speed, unused
+
+uniform mat4 u_viewprojection;
+
+//see AnimationTexture
+uniform sampler2D u_animation_texture; //a row per frame, three texels per bone
+uniform vec2 u_animation_texture_size;
+uniform vec4 u_clips[16]; //first frame, num frames, loop, unused
+uniform float u_animation_fps;
+uniform float u_time;
+
+varying vec3 v_position;
+varying vec3 v_world_position;
+varying vec3 v_normal;
+varying vec2 v_uv;
+varying vec4 v_color;
+
+vec4 fetchColumn(float bone, float column, float frame)
+{
+	vec2 uv = vec2(bone * 3.0 + column + 0.5, frame + 0.5) / u_animation_texture_size;
+	return texture2DLod(u_animation_texture, uv, 0.0);
+}
+
+void main()
+{
+	vec4 clip = u_clips[int(a_animation.x)];
+	float f = (u_time * a_animation.z + a_animation.y) * u_animation_fps;
+	float frame0;
+	float frame1;
+	if (clip.z > 0.5) //loop
+	{
+		f = mod(f, clip.y);
+		frame0 = floor(f);
+		frame1 = frame0 + 1.0 >= clip.y ? 0.0 : frame0 + 1.0;
+	}
+	else
+	{
+		f = clamp(f, 0.0, clip.y - 1.0);
+		frame0 = floor(f);
+		frame1 = min(frame0 + 1.0, clip.y - 1.0);
+	}
+	float t = f - frame0;
+	frame0 += clip.x;
+	frame1 += clip.x;
+
+	//v * M is the dot of v with every column of the palette matrix
+	vec4 position = vec4(a_vertex, 1.0);
+	vec4 normal = vec4(a_normal, 0.0);
+	vec3 skinned_position = vec3(0.0);
+	vec3 skinned_normal = vec3(0.0);
+	for (int i = 0; i < 4; ++i)
+	{
+		float weight = a_weights[i];
+		if (weight == 0.0)
+			continue;
+		float bone = a_bones[i];
+		vec4 c0 = mix(fetchColumn(bone, 0.0, frame0), fetchColumn(bone, 0.0, frame1), t);
+		vec4 c1 = mix(fetchColumn(bone, 1.0, frame0), fetchColumn(bone, 1.0, frame1), t);
+		vec4 c2 = mix(fetchColumn(bone, 2.0, frame0), fetchColumn(bone, 2.0, frame1), t);
+		skinned_position += weight * vec3(dot(position, c0), dot(position, c1), dot(position, c2));
+		skinned_normal += weight * vec3(dot(normal, c0), dot(normal, c1), dot(normal, c2));
+	}
+
+	v_normal = (u_model * vec4(skinned_normal, 0.0)).xyz;
+	v_position = skinned_position;
+	v_world_position = (u_model * vec4(v_position, 1.0)).xyz;
+	v_color = a_color;
+	v_uv = a_uv;
+	gl_Position = u_viewprojection * vec4(v_world_position, 1.0);
+}
@@ -0,0 +1,20 @@
+varying vec3 v_position;
+varying vec3 v_world_position;
+varying vec2 v_uv;
+
+uniform mat4 u_model;
+uniform vec4 u_color;
+uniform sampler2D u_texture;
+uniform sampler2D u_normalmap;
+uniform vec3 u_light_direction;
+
+void main()
+{
+	//normals packed from -1..1 to 0..1
+	vec3 N = texture2D(u_normalmap, v_uv).xyz * 2.0 - 1.0;
+	N = normalize((u_model * vec4(N, 0.0)).xyz);
+	float NdotL = max(0.0, dot(N, normalize(u_light_direction)));
+
+	vec4 color = u_color * texture2D(u_texture, v_uv);
+	gl_FragColor = vec4(color.xyz * (0.2 + 0.8 * NdotL), color.a);
+}
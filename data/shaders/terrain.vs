@@ -0,0 +1,45 @@
+attribute vec3 a_vertex; //patch from 0 to 1 in xz
+
+//per chunk (instanced)
+attribute vec4 a_chunk; //x, z, size, lod
+attribute vec2 a_morph; //distance to the camera where it starts and ends morphing to the next lod
+
+uniform mat4 u_model;
+uniform mat4 u_viewprojection;
+uniform vec3 u_local_camera_position;
+
+uniform sampler2D u_heightmap;
+uniform vec2 u_heightmap_size;
+uniform float u_size;
+uniform float u_patch_resolution;
+
+varying vec3 v_position;
+varying vec3 v_world_position;
+varying vec2 v_uv;
+
+//the samples are in the center of the texels, the terrain goes from the first to the last one
+vec2 getHeightmapUV(vec2 pos)
+{
+	return (pos / u_size * (u_heightmap_size - 1.0) + 0.5) / u_heightmap_size;
+}
+
+float getHeight(vec2 pos)
+{
+	return texture2DLod(u_heightmap, getHeightmapUV(pos), 0.0).x;
+}
+
+void main()
+{
+	vec2 pos = a_chunk.xy + a_vertex.xz * a_chunk.z;
+	float dist = distance(u_local_camera_position, vec3(pos.x, getHeight(pos), pos.y));
+	float morph = clamp((dist - a_morph.x) / (a_morph.y - a_morph.x), 0.0, 1.0);
+
+	//odd vertices slide onto their even neighbour, so the chunk matches the next lod when morph is 1
+	vec2 odd = fract(a_vertex.xz * u_patch_resolution * 0.5) * 2.0 / u_patch_resolution;
+	pos -= odd * a_chunk.z * morph;
+
+	v_position = vec3(pos.x, getHeight(pos), pos.y);
+	v_world_position = (u_model * vec4(v_position, 1.0)).xyz;
+	v_uv = getHeightmapUV(pos);
+	gl_Position = u_viewprojection * vec4(v_world_position, 1.0);
+}
@@ -2,6 +2,7 @@
 #include "framework.h"
 #include "utils.h"
 #include <cassert>
+#include <mutex>
 
 #include "camera.h"
 #include "shader.h"
@@ -10,6 +11,31 @@
 Skeleton::Skeleton()
 {
 	num_bones = 0;
+	signature = 0;
+	num_sorted_bones = 0;
+}
+
+Skeleton::Skeleton(const Skeleton& other)
+{
+	*this = other;
+}
+
+Skeleton& Skeleton::operator = (const Skeleton& other)
+{
+	if (this == &other)
+		return *this;
+	memcpy(bones, other.bones, sizeof(Bone) * other.num_bones);
+	num_bones = other.num_bones;
+	memcpy(global_bone_matrices, other.global_bone_matrices, sizeof(Matrix44) * other.num_bones);
+	signature = other.signature;
+	memcpy(parents, other.parents, sizeof(parents));
+	memcpy(update_order, other.update_order, sizeof(update_order));
+	num_sorted_bones = other.num_sorted_bones;
+
+	bones_by_name.clear();
+	for (int i = 0; i < num_bones; ++i)
+		bones_by_name[bones[i].name] = i;
+	return *this;
 }
 
 Skeleton::Bone* Skeleton::getBone(const char* name)
@@ -31,19 +57,103 @@ Matrix44& Skeleton::getBoneMatrix(const char* name, bool local )
 	return global_bone_matrices[ it->second ];
 }
 
+void Skeleton::computeSignature()
+{
+	//FNV-1a of the names in order
+	signature = 2166136261u;
+	for (int i = 0; i < num_bones; ++i)
+		for (const char* c = bones[i].name; *c; ++c)
+			signature = (signature ^ (uint8)*c) * 16777619u;
+	signature = (signature ^ (uint32)num_bones) * 16777619u;
+	if (signature == 0)
+		signature = 1;
+}
+
+bool Skeleton::hasSameBones(const Skeleton& other) const
+{
+	if (num_bones != other.num_bones || !signature || signature != other.signature)
+		return false;
+	for (int i = 0; i < num_bones; ++i)
+		if (strcmp(bones[i].name, other.bones[i].name) != 0)
+			return false;
+	return true;
+}
+
+//the signature is only a hash, the names are compared too before using a binding
+static const sSkinBinding* findSkinBinding(const sSkinBinding* binding, const Skeleton& skeleton)
+{
+	for (; binding; binding = binding->next)
+	{
+		if (binding->skeleton_signature != skeleton.signature || (int)binding->bone_names.size() != skeleton.num_bones)
+			continue;
+		int i = 0;
+		while (i < skeleton.num_bones && binding->bone_names[i] == skeleton.bones[i].name)
+			++i;
+		if (i == skeleton.num_bones)
+			return binding;
+	}
+	return NULL;
+}
+
+//the bindings of a mesh could be created by several threads skinning characters at once, only creating them locks
+static std::mutex s_skin_bindings_mutex;
+
+const sSkinBinding* Skeleton::getSkinBinding(Mesh* mesh)
+{
+	assert(mesh);
+	if (!signature)
+		computeSignature();
+
+	//bindings are never removed while the mesh is in use, so the list can be walked while another thread prepends
+	const sSkinBinding* found = findSkinBinding(mesh->skin_bindings.load(std::memory_order_acquire), *this);
+	if (found)
+		return found;
+
+	std::lock_guard<std::mutex> lock(s_skin_bindings_mutex);
+	sSkinBinding* head = mesh->skin_bindings.load(std::memory_order_acquire);
+	found = findSkinBinding(head, *this); //created by other thread while this one waited
+	if (found)
+		return found;
+
+	sSkinBinding* binding = new sSkinBinding();
+	binding->skeleton_signature = signature;
+	binding->bone_names.resize(num_bones);
+	for (int i = 0; i < num_bones; ++i)
+		binding->bone_names[i] = bones[i].name;
+	binding->bone_indices.resize(mesh->bones_info.size());
+	binding->bind_matrices.resize(mesh->bones_info.size());
+	for (size_t i = 0; i < mesh->bones_info.size(); ++i)
+	{
+		BoneInfo& bone_info = mesh->bones_info[i];
+		auto it = bones_by_name.find(bone_info.name);
+		binding->bone_indices[i] = it == bones_by_name.end() ? -1 : it->second;
+		binding->bind_matrices[i] = mesh->bind_matrix * bone_info.bind_pose;
+	}
+	binding->next = head;
+	mesh->skin_bindings.store(binding, std::memory_order_release);
+	return binding;
+}
+
 void Skeleton::computeFinalBoneMatrices( std::vector<Matrix44>& bone_matrices, Mesh* mesh )
 {
 	assert(mesh);
 
 	updateGlobalMatrices();
 
+	const sSkinBinding* binding = getSkinBinding(mesh);
 	bone_matrices.resize(mesh->bones_info.size());
-	#pragma omp for  
-	for (int i = 0; i < mesh->bones_info.size(); ++i)
-	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix( bone_info.name, false ); //use globals
-	}
+	if (bone_matrices.size())
+		multiplyMatricesIndexed(&binding->bind_matrices[0], global_bone_matrices, &binding->bone_indices[0], (int)bone_matrices.size(), &bone_matrices[0]); //use globals
+}
+
+bool isValidBonesMap(const int8* bones_map, int num_animated_bones, int num_bones)
+{
+	if (num_animated_bones < 0 || num_animated_bones > 128 || num_bones <= 0 || num_bones > 128)
+		return false;
+	for (int i = 0; i < num_animated_bones; ++i)
+		if (bones_map[i] < 0 || bones_map[i] >= num_bones)
+			return false;
+	return true;
 }
 
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer)
@@ -53,27 +163,17 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 
 	w = clamp(w, 0.0f, 1.0f);//safety
 
-	if (layer == 0xFF)
-	{
-		if (w == 0.0f)
-		{
-			if(result == a) //nothing to do
-				return;
-			*result = *a; //copy A in Result
-			return;
-		}
-		if (w == 1.0f) //copy B in result
-		{
-			*result = *b;
-			return;
-		}
-	}
+	//copy the structure only if result has a different one (the map of names is slow to copy)
+	if (result != a && !result->hasSameBones(*a))
+		*result = *a; //copy skeleton structure
 
-	if (result != a) //copy bone names
+	if (layer == 0xFF && (w == 0.0f || w == 1.0f)) //copy the pose of A or B
 	{
-		memcpy(result->bones, a->bones, sizeof(result->bones)); //copy skeleton structure
-		result->bones_by_name = a->bones_by_name;
-		result->num_bones = a->num_bones;
+		Skeleton* source = w == 0.0f ? a : b;
+		if (source != result)
+			for (int i = 0; i < result->num_bones; ++i)
+				result->bones[i].model = source->bones[i].model;
+		return;
 	}
 
 	//blend bones locally
@@ -83,8 +183,12 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 		Skeleton::Bone& bone = result->bones[i];
 		Skeleton::Bone& boneA = a->bones[i];
 		Skeleton::Bone& boneB = b->bones[i];
-		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer
+		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer, keeps A
+		{
+			if (result != a)
+				bone.model = boneA.model;
 			continue;
+		}
 		#pragma omp for  
 		for (int j = 0; j < 16; ++j)
 			bone.model.m[j] = lerp( boneA.model.m[j], boneB.model.m[j], w);
@@ -132,16 +236,44 @@ void Skeleton::applyTransformToBones(const char* root, Matrix44 transform)
 	bone->model = bone->model * transform;
 }
 
-void Skeleton::updateGlobalMatrices()
+bool Skeleton::sortHierarchy()
 {
-	//compute global matrices
-	global_bone_matrices[0] = bones[0].model;
-	//order dependant
-	for (int i = 1; i < num_bones; ++i)
+	for (int i = 0; i < num_bones; ++i)
+		parents[i] = bones[i].parent;
+	num_sorted_bones = num_bones;
+	return sortBoneHierarchy(parents, num_bones, update_order);
+}
+
+bool Skeleton::isValidHierarchy() const
+{
+	if (num_bones <= 0 || num_bones > 128)
+		return false;
+	int8 bone_parents[128];
+	uint8 order[128];
+	for (int i = 0; i < num_bones; ++i)
+		bone_parents[i] = bones[i].parent;
+	if (!sortBoneHierarchy(bone_parents, num_bones, order))
+		return false;
+
+	//assignLayer walks the children, they must be the bones that have it as parent
+	for (int i = 0; i < num_bones; ++i)
 	{
-		Skeleton::Bone& bone = bones[i];
-		global_bone_matrices[i] = bone.model * global_bone_matrices[ bone.parent ];
+		const Bone& bone = bones[i];
+		if (bone.num_children > 16)
+			return false;
+		for (int j = 0; j < bone.num_children; ++j)
+			if (bone.children[j] < 0 || bone.children[j] >= num_bones || bones[bone.children[j]].parent != i)
+				return false;
 	}
+	return true;
+}
+
+void Skeleton::updateGlobalMatrices()
+{
+	if (num_sorted_bones != num_bones)
+		sortHierarchy();
+	//the local matrices are read from the bones
+	computeGlobalMatrices(&bones[0].model, sizeof(Bone), parents, update_order, num_bones, global_bone_matrices);
 }
 
 void Skeleton::assignLayer( Bone* bone, uint8 layer )
@@ -152,31 +284,62 @@ void Skeleton::assignLayer( Bone* bone, uint8 layer )
 		bone->layer |= layer;
 	else
 		bone->layer = 0;
-	for (int i = 0; i < bone->num_children; ++i)
+	int index = int(bone - bones);
+	for (int i = 0; i < bone->num_children && i < 16; ++i)
 	{
-		Bone* child = &bones[bone->children[i]];
-		assignLayer(child, layer);
+		//only children that point back to it, so it ends if the parents have no cycles
+		int child = bone->children[i];
+		if (child < 0 || child >= num_bones || bones[child].parent != index)
+			continue;
+		assignLayer(&bones[child], layer);
 	}
 }
 
+bool Animation::use_compression = false;
+float Animation::compression_tolerance = 0.01f;
+float Animation::compression_distance = 3.0f;
+
 Animation::Animation()
 {
 	duration = 0.0f;
 	keyframes = NULL;
+	compressed = NULL;
+	tracks = NULL;
 	num_keyframes = 0;
 	num_animated_bones = 0;
+	rest_pose_signature = 0;
 }
 
 Animation::~Animation()
 {
 	if (keyframes)
 		delete[] keyframes;
+	if (compressed)
+		delete compressed;
+	if (tracks)
+		delete tracks;
 }
 
 void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 {
-	assert(keyframes && skeleton.num_bones);
+	assert((keyframes || compressed || tracks) && skeleton.num_bones);
+	touch();
+
+	Matrix44 locals[128];
+	sampleLocal(t, locals, loop);
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		Skeleton::Bone& bone = skeleton.bones[bones_map[i]];
+		if (layers != 0xFF && !(bone.layer & layers))
+			continue;
+		bone.model = locals[i];
+	}
+
+	skeleton.updateGlobalMatrices();
+}
 
+void Animation::getSamplePosition(float t, bool loop, int& index, int& index2, float& f) const
+{
 	if (loop)
 	{
 		t = fmod(t, duration);
@@ -186,35 +349,192 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 	else
 		t = clamp( t, 0.0f, duration - (1.0/samples_per_second) );
 	float v = samples_per_second * t;
-	int index = clamp(floor(v), 0, num_keyframes - 1);
-	int index2 = index + 1;
+	index = clamp(floor(v), 0, num_keyframes - 1);
+	index2 = index + 1;
 	if (index2 >= num_keyframes)
 		index2 = 0;
-	float f = v - floor(v);
+	f = v - floor(v);
+}
+
+void Animation::sampleLocal(float t, Matrix44* locals, bool loop) const
+{
+	assert(keyframes || compressed || tracks);
+
+	int index, index2;
+	float f;
+	getSamplePosition(t, loop, index, index2, f);
+
+	if (compressed)
+	{
+		for (int i = 0; i < num_animated_bones; ++i)
+			compressed->sample(i, index + f, locals[i]);
+		return;
+	}
+
+	if (tracks)
+	{
+		//all the bones at once
+		tracks->sample(index, index2, f, locals);
+		return;
+	}
 
+	//keyframes still being loaded, matrices interpolated per element
 	Matrix44* k = keyframes + index * num_animated_bones;
 	Matrix44* k2 = keyframes + index2 * num_animated_bones;
+	for (int i = 0; i < num_animated_bones; ++i)
+		for (int j = 0; j < 16; ++j)
+			locals[i].m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+}
 
-	//compute local bones
-	#pragma omp for  
+void Animation::sampleLocalTRS(float t, sBoneTRS* out, bool loop) const
+{
+	assert(keyframes || compressed || tracks);
+
+	int index, index2;
+	float f;
+	getSamplePosition(t, loop, index, index2, f);
+
+	if (compressed)
+	{
+		for (int i = 0; i < num_animated_bones; ++i)
+			compressed->sample(i, index + f, out[i].translation, out[i].rotation, out[i].scale);
+		return;
+	}
+
+	if (tracks)
+	{
+		tracks->sampleTRS(index, index2, f, out);
+		return;
+	}
+
+	//keyframes still being loaded
+	Matrix44* k = keyframes + index * num_animated_bones;
+	Matrix44* k2 = keyframes + index2 * num_animated_bones;
 	for (int i = 0; i < num_animated_bones; ++i)
 	{
-		int bone_index = bones_map[i];
-		Skeleton::Bone& bone = skeleton.bones[bone_index];
-		if (layers != 0xFF && !(bone.layer & layers))
-			continue;
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+		sBoneTRS b;
+		out[i].fromMatrix(k[i]);
+		b.fromMatrix(k2[i]);
+		blendTRS(out[i], b, f, out[i]);
 	}
+}
 
-	skeleton.updateGlobalMatrices();
+void Animation::sampleBonesTRS(float t, sBoneTRS* out, bool loop) const
+{
+	sBoneTRS sampled[128];
+	sampleLocalTRS(t, sampled, loop);
+
+	int8 animated[128];
+	memset(animated, -1, sizeof(animated));
+	for (int i = 0; i < num_animated_bones; ++i)
+		animated[bones_map[i]] = i;
+	for (int i = 0; i < skeleton.num_bones; ++i)
+	{
+		if (animated[i] >= 0)
+			out[i] = sampled[animated[i]];
+		else
+			getRestBone(i, out[i]);
+	}
+}
+
+void Animation::getRestBone(int bone, sBoneTRS& out) const
+{
+	assert(bone >= 0 && bone < skeleton.num_bones);
+	if ((int)rest_pose.size() == skeleton.num_bones && rest_pose_signature == skeleton.signature)
+		out = rest_pose[bone];
+	else
+		out.fromMatrix(skeleton.bones[bone].model); //the skeleton changed after computeRestPose
+}
+
+void Animation::computeRestPose()
+{
+	//assignTime only changes the animated bones, so the rest of them keep their pose
+	rest_pose.resize(skeleton.num_bones);
+	for (int i = 0; i < skeleton.num_bones; ++i)
+		rest_pose[i].fromMatrix(skeleton.bones[i].model);
+	rest_pose_signature = skeleton.signature;
+}
+
+void Animation::sampleBone(float t, int index_bone, Matrix44& local, bool loop) const
+{
+	assert((keyframes || compressed || tracks) && index_bone >= 0 && index_bone < num_animated_bones);
+
+	int index, index2;
+	float f;
+	getSamplePosition(t, loop, index, index2, f);
+
+	if (compressed)
+		compressed->sample(index_bone, index + f, local);
+	else if (tracks)
+		tracks->sampleBone(index, index2, f, index_bone, local);
+	else
+	{
+		const Matrix44& k = keyframes[index * num_animated_bones + index_bone];
+		const Matrix44& k2 = keyframes[index2 * num_animated_bones + index_bone];
+		for (int j = 0; j < 16; ++j)
+			local.m[j] = lerp(k.m[j], k2.m[j], f);
+	}
 }
 
 
 void Animation::operator = (Animation* anim)
 {
-	memcpy(this, anim, sizeof(Animation));
-	this->keyframes = NULL;
+	//only the pose and the info, the keyframes belong to anim (copying the whole object would also copy its registration in the pool)
+	skeleton = anim->skeleton;
+	duration = anim->duration;
+	samples_per_second = anim->samples_per_second;
+	num_animated_bones = anim->num_animated_bones;
+	num_keyframes = anim->num_keyframes;
+	memcpy(bones_map, anim->bones_map, sizeof(bones_map));
+	keyframes = NULL;
+	compressed = NULL;
+	tracks = NULL;
+	rest_pose = anim->rest_pose;
+	rest_pose_signature = anim->rest_pose_signature;
+}
+
+bool Animation::compress(float tolerance, float virtual_distance)
+{
+	if (!keyframes)
+		restoreKeyframes();
+	assert(keyframes && "nothing to compress");
+	CompressedAnimation* result = new CompressedAnimation();
+	if (!result->compress(keyframes, num_keyframes, num_animated_bones, tolerance, virtual_distance))
+	{
+		std::cout << " [WARN] too many keyframes to compress: " << num_keyframes << std::endl;
+		delete result;
+		return false;
+	}
+	if (compressed)
+		delete compressed;
+	compressed = result;
+	delete[] keyframes;
+	keyframes = NULL;
+	if (tracks)
+		delete tracks;
+	tracks = NULL;
+	return true;
+}
+
+void Animation::buildTracks()
+{
+	assert(keyframes && "nothing to store");
+	AnimationTracks* result = new AnimationTracks();
+	result->build(keyframes, num_keyframes, num_animated_bones);
+	if (tracks)
+		delete tracks;
+	tracks = result;
+	delete[] keyframes;
+	keyframes = NULL;
+}
+
+void Animation::restoreKeyframes()
+{
+	if (keyframes || !tracks)
+		return;
+	keyframes = new Matrix44[num_keyframes * num_animated_bones];
+	for (int i = 0; i < num_keyframes; ++i)
+		tracks->getKeyframe(i, keyframes + i * num_animated_bones);
 }
 
 bool Animation::load(const char* filename)
@@ -244,11 +564,18 @@ bool Animation::load(const char* filename)
 				return false;
 			}
 
+			if (use_compression)
+				compress(compression_tolerance, compression_distance);
+
 			std::cout << "[Writing .ABIN] ... ";
 			writeABIN( filename );
 		}
 	}
 
+	//clips too long to compress are stored as tracks
+	if (keyframes && !(use_compression && compress(compression_tolerance, compression_distance)))
+		buildTracks();
+
 	std::cout << "[OK] Num. Bones: " << skeleton.num_bones << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	return true;
 }
@@ -262,9 +589,12 @@ struct sAnimHeader {
 	int num_keyframes;
 	int num_bones;
 	int8 bones_map[128];
-	char extra[16];
+	int flags; //since version 4
+	char extra[12];
 };
 
+#define ANIM_BIN_COMPRESSED 1 //a CompressedAnimation instead of the keyframes
+
 bool Animation::writeABIN(const char* filename)
 {
 	std::string s_filename = filename;
@@ -289,6 +619,8 @@ bool Animation::writeABIN(const char* filename)
 	header.num_keyframes = num_keyframes;
 	header.num_bones = skeleton.num_bones;
 	memcpy( header.bones_map, bones_map, sizeof(bones_map)  );
+	header.flags = compressed ? ANIM_BIN_COMPRESSED : 0;
+	memset(header.extra, 0, sizeof(header.extra));
 
 	//write header
 	fwrite((void*)&header, sizeof(sAnimHeader), 1, f);
@@ -297,7 +629,19 @@ bool Animation::writeABIN(const char* filename)
 	fwrite((void*)skeleton.bones, sizeof(skeleton.bones), 1, f);
 
 	//write keyframes
-	fwrite((void*)keyframes, sizeof(Matrix44) * num_keyframes * num_animated_bones, 1, f);
+	if (compressed)
+		compressed->write(f);
+	else if (keyframes)
+		fwrite((void*)keyframes, sizeof(Matrix44) * num_keyframes * num_animated_bones, 1, f);
+	else if (tracks)
+	{
+		std::vector<Matrix44> sample(num_animated_bones);
+		for (int i = 0; i < num_keyframes; ++i)
+		{
+			tracks->getKeyframe(i, &sample[0]);
+			fwrite((void*)&sample[0], sizeof(Matrix44) * num_animated_bones, 1, f);
+		}
+	}
 
 	fclose(f);
 	return true;
@@ -321,9 +665,10 @@ bool Animation::loadABIN(const char* filename)
 	fclose(f);
 
 	//watermark
-	if (memcmp(data, "ABIN", 4) != 0)
+	if (size < 4 + sizeof(sAnimHeader) || memcmp(data, "ABIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete[] data;
 		return false;
 	}
 
@@ -332,9 +677,10 @@ bool Animation::loadABIN(const char* filename)
 	memcpy(&header, pos, sizeof(sAnimHeader));
 	pos += sizeof(sAnimHeader);
 
-	if (header.version != ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader))
+	if (header.version < 3 || header.version > ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader))
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete[] data;
 		return false;
 	}
 
@@ -345,20 +691,67 @@ bool Animation::loadABIN(const char* filename)
 	num_keyframes = header.num_keyframes;
 	skeleton.num_bones = header.num_bones;
 	memcpy(bones_map, header.bones_map, sizeof(bones_map));
+	if (num_keyframes <= 0 || !isValidBonesMap(bones_map, num_animated_bones, skeleton.num_bones))
+	{
+		std::cout << "[ERROR] loading BIN: animated bones out of the skeleton: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
 
 	//extract skeleton
+	if (pos + sizeof(skeleton.bones) > data + size)
+	{
+		std::cout << "[ERROR] loading BIN: truncated skeleton: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
 	memcpy( skeleton.bones, pos, sizeof(skeleton.bones) );
 	pos += sizeof(skeleton.bones);
+	if (!skeleton.isValidHierarchy())
+	{
+		std::cout << "[ERROR] loading BIN: invalid bone hierarchy: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
 
 	//extract keyframes
-	assert(keyframes == NULL);
-	keyframes = new Matrix44[num_keyframes * num_animated_bones];
-	memcpy( keyframes, pos, sizeof(Matrix44)*num_keyframes * num_animated_bones );
-	pos += sizeof(Matrix44) * num_keyframes * num_animated_bones;
+	assert(keyframes == NULL && compressed == NULL && tracks == NULL);
+	int flags = header.version >= 4 ? header.flags : 0;
+	if (flags & ANIM_BIN_COMPRESSED)
+	{
+		compressed = new CompressedAnimation();
+		const char* compressed_pos = pos;
+		//the tracks must belong to this clip, sampleLocal walks num_animated_bones of them
+		if (!compressed->read(compressed_pos, data + size) ||
+			compressed->num_animated_bones != num_animated_bones || compressed->num_keyframes != num_keyframes)
+		{
+			std::cout << "[ERROR] loading BIN: invalid compressed keyframes: " << filename << std::endl;
+			delete compressed;
+			compressed = NULL;
+			delete[] data;
+			return false;
+		}
+		pos = (char*)compressed_pos;
+	}
+	else
+	{
+		if (pos + sizeof(Matrix44) * num_keyframes * num_animated_bones > data + size)
+		{
+			std::cout << "[ERROR] loading BIN: truncated keyframes: " << filename << std::endl;
+			delete[] data;
+			return false;
+		}
+		keyframes = new Matrix44[num_keyframes * num_animated_bones];
+		memcpy( keyframes, pos, sizeof(Matrix44)*num_keyframes * num_animated_bones );
+		pos += sizeof(Matrix44) * num_keyframes * num_animated_bones;
+	}
 
 	//compute bone names map
 	for (int i = 0; i < skeleton.num_bones; ++i)
 		skeleton.bones_by_name[ skeleton.bones[i].name ] = i;
+	skeleton.computeSignature();
+	skeleton.sortHierarchy();
+	computeRestPose();
 
 	delete[] data;
 	return true;
@@ -390,12 +783,12 @@ bool Animation::loadSKANIM(const char* filename)
 	samples_per_second = header[1];
 	num_keyframes = header[2];
 	skeleton.num_bones = header[3];
-	assert(skeleton.num_bones < 128); //MAX_BONES
 	num_animated_bones = 0;
+	bool valid = skeleton.num_bones > 0 && skeleton.num_bones <= 128; //MAX_BONES
 
 	int current_keyframe = 0;
 
-	while (*pos)
+	while (*pos && valid)
 	{
 		char type = *pos;
 
@@ -408,16 +801,25 @@ bool Animation::loadSKANIM(const char* filename)
 		{
 			pos = fetchWord(pos, word);
 			int index = atof(word);
+			if (index < 0 || index >= skeleton.num_bones)
+			{
+				valid = false;
+				break;
+			}
 			Skeleton::Bone& bone = skeleton.bones[index];
 			pos = fetchWord(pos, bone.name);
 			//std::cout << bone.name << std::endl;
 			pos = fetchWord(pos, word);
 			int parent_index = atof(word);
+			if (parent_index != -1 && (parent_index < 0 || parent_index >= skeleton.num_bones || skeleton.bones[parent_index].num_children >= 16))
+			{
+				valid = false;
+				break;
+			}
 			bone.parent = parent_index;
 			if (bone.parent != -1)
 			{
 				Skeleton::Bone& parent_bone = skeleton.bones[bone.parent];
-				assert(parent_bone.num_children < 16);
 				parent_bone.children[parent_bone.num_children++] = index;
 			}
 
@@ -446,12 +848,21 @@ bool Animation::loadSKANIM(const char* filename)
 			break; //end of file probably
 	}
 
+	if (!valid || !skeleton.isValidHierarchy())
+	{
+		std::cout << "[ERROR] loading SKANIM: invalid bone hierarchy: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
+
 	for (int i = 0; i < skeleton.num_bones; ++i)
 	{
 		Skeleton::Bone& bone = skeleton.bones[i];
 		bone.layer = BODY;
 		skeleton.bones_by_name[bone.name] = i;
 	}
+	skeleton.computeSignature();
+	skeleton.sortHierarchy();
 
 	//assign layers
 	Skeleton::Bone* hips = skeleton.getBone("mixamorig_Hips");
@@ -465,6 +876,7 @@ bool Animation::loadSKANIM(const char* filename)
 		skeleton.assignLayer(skeleton.getBone("mixamorig_RightShoulder"), RIGHT_ARM);
 		skeleton.assignLayer(skeleton.getBone("mixamorig_LeftShoulder"), LEFT_ARM);
 	}
+	computeRestPose();
 
 	assignTime(0); //reset pose
 
@@ -473,24 +885,41 @@ bool Animation::loadSKANIM(const char* filename)
 }
 
 
-std::map<std::string, Animation*> Animation::sAnimationsLoaded;
-Animation* Animation::Get(const char* filename)
+ResourcePool<Animation> Animation::sAnimationsLoaded("Animations");
+Animation* Animation::Get(const char* filename, bool evictable)
 {
 	assert(filename);
 
 	//check if loaded
-	auto it = sAnimationsLoaded.find(filename);
-	if (it != sAnimationsLoaded.end())
-		return it->second;
+	Animation* anim = sAnimationsLoaded.find(filename);
+	if (anim)
+	{
+		if (!evictable)
+			anim->evictable = false; //someone keeps a raw pointer
+		return anim;
+	}
 
 	//load it
-	Animation* anim = new Animation();
+	anim = new Animation();
 	if (!anim->load(filename))
 	{
 		delete anim;
 		return NULL;
 	}
 
-	sAnimationsLoaded[filename] = anim;
+	sAnimationsLoaded.add(filename, anim, evictable);
 	return anim;
+}
+
+void Animation::getMemoryUsage(size_t& cpu, size_t& gpu) const
+{
+	cpu = sizeof(Animation) + skeleton.bones_by_name.size() * 48; //map nodes
+	if (keyframes)
+		cpu += size_t(num_animated_bones) * num_keyframes * sizeof(Matrix44);
+	if (compressed)
+		cpu += compressed->getMemoryUsage();
+	if (tracks)
+		cpu += tracks->getMemoryUsage();
+	cpu += rest_pose.capacity() * sizeof(sBoneTRS);
+	gpu = 0;
 }
\ No newline at end of file
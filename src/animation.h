@@ -1,10 +1,13 @@
 #pragma once
 
 #include "mesh.h"
+#include "compressedanimation.h"
+#include "animationtracks.h"
+#include "skeletonpose.h"
 
 class Camera;
 
-#define ANIM_BIN_VERSION 3
+#define ANIM_BIN_VERSION 4 //3 is still readable
 
 //defined layers for every body
 enum BODY_LAYERS {
@@ -39,8 +42,15 @@ public:
 
 	Matrix44 global_bone_matrices[128]; //transform of every bone in global coordinates (according to the 0,0,0 and not the parent)
 	std::map<const char*, int, cmp_str> bones_by_name;	//map to get the bone index from its name, required to extract the final bones array
+	uint32 signature; //hash of the bone names, skeletons with the same one share the skinning tables of the meshes (0 if not computed yet)
+	int8 parents[128]; //parent of every bone in a dense array
+	uint8 update_order[128]; //bones sorted so every parent comes before its children
+	int num_sorted_bones; //bones in update_order, if it doesnt match num_bones it is sorted again
 
 	Skeleton();
+	//bones_by_name is not copied, its keys point to the names of the bones of the other skeleton so it is built again
+	Skeleton(const Skeleton& other);
+	Skeleton& operator = (const Skeleton& other);
 
 	Bone* getBone(const char* name); //returns the bone pointer
 	Matrix44& getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
@@ -49,14 +59,23 @@ public:
 
 	void renderSkeleton(Camera* camera, Matrix44 model, Vector4 color = Vector4(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
 	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader
+	void computeSignature(); //call it when the bone names change
+	bool hasSameBones(const Skeleton& other) const; //same signature and the same names (the signature alone can collide)
+	bool sortHierarchy(); //call it when the parents change, false if the parents are not a valid hierarchy (see sortBoneHierarchy)
+	bool isValidHierarchy() const; //parents without cycles and children that match them, check it before using bones from a file
+	const sSkinBinding* getSkinBinding(Mesh* mesh); //remap from the bones of the mesh to these bones, created the first time
 	void assignLayer(Bone* bone, uint8 layer); //assigns a layer to a node and all its children
 };
 
 //this function takes skeleton A and blends it with skeleton B and stores the result in result
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer = 0xFF);
 
+//every animated bone is a bone of the skeleton, check it before sampling data that comes from a file
+bool isValidBonesMap(const int8* bones_map, int num_animated_bones, int num_bones);
+
 //This class contains one animation loaded from a file (it also uses a skeleton to store the current snapshot)
-class Animation {
+//it can be shared by many characters using an AnimationPlayer each, assignTime changes the shared skeleton
+class Animation : public Resource {
 public:
 
 	Skeleton skeleton;
@@ -67,24 +86,51 @@ public:
 	int num_keyframes;
 	int8 bones_map[128]; //maps from keyframe data index to bone
 
-	Matrix44* keyframes;
+	Matrix44* keyframes; //only while loading, they end up compressed or stored as tracks
+	CompressedAnimation* compressed; //used instead of the keyframes when they are compressed
+	AnimationTracks* tracks; //used instead of the keyframes when they are not compressed
+
+	std::vector<sBoneTRS> rest_pose; //bones of the skeleton as TRS, for the bones that are not animated when poses are blended
+	uint32 rest_pose_signature; //skeleton.signature when rest_pose was computed
+
+	static bool use_compression; //opt-in, loaded animations are compressed (lossy, also the .abin written) and their keyframes released
+	static float compression_tolerance; //max error of a compressed bone (skeleton units, the default is for skeletons in centimeters)
+	static float compression_distance; //distance from the bone where the error is measured
 
 	Animation();
 	~Animation();	//we need the dtor to remove the keyframes memory
 
 	//change the skeleton to the given pose according to time
 	void assignTime(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	//local matrices of the animated bones at a time (indexed like bones_map), locals needs room for 128 matrices
+	//it doesnt change the animation so several threads can sample it at once
+	void sampleLocal(float time, Matrix44* locals, bool loop = true) const;
+	//local matrix of one animated bone (index in bones_map), much cheaper than sampling the whole pose
+	void sampleBone(float time, int index, Matrix44& local, bool loop = true) const;
+	//like sampleLocal but as rotation, translation and scale, to blend it with other poses (out needs room for 128)
+	void sampleLocalTRS(float time, sBoneTRS* out, bool loop = true) const;
+	//every bone of the skeleton (not only the animated ones, those keep the pose of skeleton) as TRS, indexed by bone
+	void sampleBonesTRS(float time, sBoneTRS* out, bool loop = true) const;
+	//rest TRS of a bone of the skeleton, from rest_pose if it still matches the skeleton
+	void getRestBone(int bone, sBoneTRS& out) const;
+	void computeRestPose(); //call it when the bones of the skeleton change (the loaders already do), not while other threads sample it
+	//keyframes around a time and the interpolation factor between them
+	void getSamplePosition(float time, bool loop, int& index, int& index2, float& f) const;
 
 	//storage
 	bool load(const char* filename);
 	bool loadSKANIM(const char* filename);
 	bool loadABIN(const char* filename);
 	bool writeABIN(const char* filename);
+	bool compress(float tolerance, float virtual_distance); //replaces the keyframes by a CompressedAnimation, false if the clip is too long
+	void buildTracks(); //replaces the keyframes by AnimationTracks
+	void restoreKeyframes(); //rebuilds the keyframes from the tracks
 
-	static std::map<std::string, Animation*> sAnimationsLoaded;
-	static Animation* Get(const char* filename);
+	static ResourcePool<Animation> sAnimationsLoaded;
+	static Animation* Get(const char* filename, bool evictable = false); //evictable only if the caller keeps it in a ResourceHandle, see Mesh::Get
+	void getMemoryUsage(size_t& cpu, size_t& gpu) const;
 
-	//copy operator to copy the keyframes
+	//copies the pose and the info, the keyframes stay in anim
 	void operator = (Animation* anim);
 };
 
@@ -0,0 +1,334 @@
+#include "animationpack.h"
+#include "animation.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+AnimationPack::AnimationPack()
+{
+	data = NULL;
+	size = 0;
+	file_handle = NULL;
+	mapping_handle = NULL;
+}
+
+AnimationPack::~AnimationPack()
+{
+	unload();
+}
+
+bool AnimationPack::map(const char* filename)
+{
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping = file_size.QuadPart ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat stbuffer;
+	void* view = fstat(fd, &stbuffer) == 0 && stbuffer.st_size ? mmap(NULL, stbuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd); //the mapping keeps the file
+	if (view == MAP_FAILED)
+		return false;
+	size = stbuffer.st_size;
+#endif
+	data = (const char*)view;
+	return true;
+}
+
+void AnimationPack::unmap()
+{
+	if (!data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+#else
+	munmap((void*)data, size);
+#endif
+	data = NULL;
+	size = 0;
+	file_handle = mapping_handle = NULL;
+}
+
+bool AnimationPack::load(const char* filename)
+{
+	assert(filename);
+	unload();
+	std::cout << " + Animation pack loading: " << filename << " ... ";
+	long time = getTime();
+
+	if (!map(filename))
+	{
+		std::cout << "[ERROR] File not found" << std::endl;
+		return false;
+	}
+
+	sPackHeader header;
+	if (size < sizeof(header))
+	{
+		std::cout << "[ERROR] invalid content" << std::endl;
+		unmap();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.watermark, "APAK", 4) != 0 || header.file_size != size)
+	{
+		std::cout << "[ERROR] invalid content" << std::endl;
+		unmap();
+		return false;
+	}
+	if (header.version != APAK_VERSION || header.header_bytes != sizeof(sPackHeader))
+	{
+		std::cout << "[WARN] old version, build it again" << std::endl;
+		unmap();
+		return false;
+	}
+
+	//the index follows the header, the structs are made of 4 byte fields so they are aligned in place
+	size_t index_bytes = sizeof(sPackHeader) + header.num_skeletons * sizeof(sPackSkeleton) + header.num_clips * sizeof(sPackClip);
+	if (header.num_skeletons < 0 || header.num_clips < 0 || index_bytes > size)
+	{
+		std::cout << "[ERROR] truncated index" << std::endl;
+		unmap();
+		return false;
+	}
+	const sPackSkeleton* skeletons = (const sPackSkeleton*)(data + sizeof(sPackHeader));
+	const sPackClip* pack_clips = (const sPackClip*)(skeletons + header.num_skeletons);
+
+	for (int i = 0; i < header.num_clips; ++i)
+	{
+		const sPackClip& info = pack_clips[i];
+		const sPackSkeleton* skeleton = info.skeleton >= 0 && info.skeleton < header.num_skeletons ? &skeletons[info.skeleton] : NULL;
+		int num_lanes = (info.num_animated_bones + 3) & ~3;
+		if (!skeleton || skeleton->num_bones <= 0 || skeleton->num_bones > 128 || skeleton->bones_offset + skeleton->num_bones * sizeof(Skeleton::Bone) > size ||
+			info.num_animated_bones <= 0 || !isValidBonesMap(info.bones_map, info.num_animated_bones, skeleton->num_bones) || info.num_keyframes <= 0 || info.tracks_offset % APAK_ALIGNMENT ||
+			info.tracks_bytes != size_t(info.num_keyframes) * AnimationTracks::NUM_STREAMS * num_lanes * sizeof(float) || size_t(info.tracks_offset) + info.tracks_bytes > size)
+		{
+			std::cout << "[ERROR] corrupted clip " << i << std::endl;
+			unload();
+			return false;
+		}
+
+		Animation* anim = new Animation();
+		anim->duration = info.duration;
+		anim->samples_per_second = info.samples_per_second;
+		anim->num_animated_bones = info.num_animated_bones;
+		anim->num_keyframes = info.num_keyframes;
+		memcpy(anim->bones_map, info.bones_map, sizeof(anim->bones_map));
+
+		//the skeleton is copied, it is where assignTime leaves its pose
+		anim->skeleton.num_bones = skeleton->num_bones;
+		memcpy(anim->skeleton.bones, data + skeleton->bones_offset, skeleton->num_bones * sizeof(Skeleton::Bone));
+		if (!anim->skeleton.isValidHierarchy())
+		{
+			std::cout << "[ERROR] invalid bone hierarchy in clip " << i << std::endl;
+			delete anim;
+			unload();
+			return false;
+		}
+		for (int j = 0; j < anim->skeleton.num_bones; ++j)
+			anim->skeleton.bones_by_name[anim->skeleton.bones[j].name] = j;
+		anim->skeleton.computeSignature();
+		anim->skeleton.sortHierarchy();
+		anim->computeRestPose();
+
+		//the keyframes are used where they are
+		anim->tracks = new AnimationTracks();
+		anim->tracks->setStreams((const float*)(data + info.tracks_offset), info.num_keyframes, info.num_animated_bones);
+
+		//a clip with the name of an animation already loaded stays only in the pack, replacing it would
+		//leave whoever holds the other one with a pointer the pool no longer tracks
+		std::string name(info.name, strnlen(info.name, sizeof(info.name)));
+		if (Animation::sAnimationsLoaded.find(name))
+			std::cout << "[WARN] clip " << name << " is already loaded, the pack keeps its own" << std::endl;
+		else
+			Animation::sAnimationsLoaded.add(name, anim); //not evictable, it belongs to the pack
+		clips.push_back(anim);
+	}
+
+	this->filename = filename;
+	std::cout << "[OK] Clips: " << clips.size() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+void AnimationPack::unload()
+{
+	for (size_t i = 0; i < clips.size(); ++i)
+		delete clips[i]; //removes it from the pool
+	clips.clear();
+	filename.clear();
+	unmap();
+}
+
+bool AnimationPack::build(const char* folder, const char* filename)
+{
+	std::vector<std::string> animations = listFiles(folder, "skanim");
+	if (animations.empty())
+	{
+		std::cout << "[ERROR] no .skanim in " << folder << std::endl;
+		return false;
+	}
+	return build(animations, filename);
+}
+
+static void writePadding(FILE* f, size_t& offset)
+{
+	static const char zeros[APAK_ALIGNMENT] = { 0 };
+	size_t padding = (APAK_ALIGNMENT - offset % APAK_ALIGNMENT) % APAK_ALIGNMENT;
+	fwrite(zeros, 1, padding, f);
+	offset += padding;
+}
+
+bool AnimationPack::build(const std::vector<std::string>& animations, const char* filename)
+{
+	//load them all first, they are stored as tracks whatever Animation::use_compression says
+	std::vector<Animation*> loaded;
+	std::vector<std::string> names;
+	for (size_t i = 0; i < animations.size(); ++i)
+	{
+		const std::string& name = animations[i];
+		if (name.size() >= sizeof(sPackClip::name))
+		{
+			std::cout << "[WARN] name too long, skipped: " << name << std::endl;
+			continue;
+		}
+		Animation* anim = new Animation();
+		std::string binfilename = name + ".abin";
+		if (!anim->loadABIN(binfilename.c_str()) || anim->compressed)
+		{
+			delete anim;
+			anim = new Animation();
+			if (!anim->loadSKANIM(name.c_str()))
+			{
+				std::cout << "[WARN] cannot load, skipped: " << name << std::endl;
+				delete anim;
+				continue;
+			}
+		}
+		if (anim->keyframes)
+			anim->buildTracks();
+		loaded.push_back(anim);
+		names.push_back(name);
+	}
+
+	//skeletons with the same bones are stored once
+	std::vector<int> skeleton_of_clip(loaded.size());
+	std::vector<Animation*> skeleton_owners;
+	for (size_t i = 0; i < loaded.size(); ++i)
+	{
+		const Skeleton& skeleton = loaded[i]->skeleton;
+		size_t j = 0;
+		for (; j < skeleton_owners.size(); ++j)
+		{
+			const Skeleton& other = skeleton_owners[j]->skeleton;
+			if (other.num_bones == skeleton.num_bones && memcmp(other.bones, skeleton.bones, skeleton.num_bones * sizeof(Skeleton::Bone)) == 0)
+				break;
+		}
+		if (j == skeleton_owners.size())
+			skeleton_owners.push_back(loaded[i]);
+		skeleton_of_clip[i] = (int)j;
+	}
+
+	//offsets of every section
+	std::vector<sPackSkeleton> skeletons(skeleton_owners.size());
+	std::vector<sPackClip> pack_clips(loaded.size());
+	size_t offset = sizeof(sPackHeader) + skeletons.size() * sizeof(sPackSkeleton) + pack_clips.size() * sizeof(sPackClip);
+	for (size_t i = 0; i < skeletons.size(); ++i)
+	{
+		offset = (offset + APAK_ALIGNMENT - 1) & ~size_t(APAK_ALIGNMENT - 1);
+		skeletons[i].bones_offset = (uint32)offset;
+		skeletons[i].num_bones = skeleton_owners[i]->skeleton.num_bones;
+		offset += skeletons[i].num_bones * sizeof(Skeleton::Bone);
+	}
+	for (size_t i = 0; i < pack_clips.size(); ++i)
+	{
+		Animation* anim = loaded[i];
+		sPackClip& info = pack_clips[i];
+		memset(&info, 0, sizeof(info));
+		strcpy(info.name, names[i].c_str());
+		info.skeleton = skeleton_of_clip[i];
+		info.duration = anim->duration;
+		info.samples_per_second = anim->samples_per_second;
+		info.num_animated_bones = anim->num_animated_bones;
+		info.num_keyframes = anim->num_keyframes;
+		memcpy(info.bones_map, anim->bones_map, sizeof(info.bones_map));
+		offset = (offset + APAK_ALIGNMENT - 1) & ~size_t(APAK_ALIGNMENT - 1);
+		info.tracks_offset = (uint32)offset;
+		info.tracks_bytes = (uint32)anim->tracks->getStreamsSize();
+		offset += info.tracks_bytes;
+	}
+
+	sPackHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.watermark, "APAK", 4);
+	header.version = APAK_VERSION;
+	header.header_bytes = sizeof(sPackHeader);
+	header.num_skeletons = (int)skeletons.size();
+	header.num_clips = (int)pack_clips.size();
+	header.file_size = (uint32)offset;
+
+	bool ok = offset < 0xFFFFFFFFu;
+	FILE* f = ok ? fopen(filename, "wb") : NULL;
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write pack: " << filename << std::endl;
+		ok = false;
+	}
+	else
+	{
+		fwrite(&header, sizeof(header), 1, f);
+		if (skeletons.size())
+			fwrite(&skeletons[0], sizeof(sPackSkeleton), skeletons.size(), f);
+		if (pack_clips.size())
+			fwrite(&pack_clips[0], sizeof(sPackClip), pack_clips.size(), f);
+		size_t pos = sizeof(sPackHeader) + skeletons.size() * sizeof(sPackSkeleton) + pack_clips.size() * sizeof(sPackClip);
+		for (size_t i = 0; i < skeletons.size(); ++i)
+		{
+			writePadding(f, pos);
+			fwrite(skeleton_owners[i]->skeleton.bones, sizeof(Skeleton::Bone), skeletons[i].num_bones, f);
+			pos += skeletons[i].num_bones * sizeof(Skeleton::Bone);
+		}
+		for (size_t i = 0; i < pack_clips.size(); ++i)
+		{
+			writePadding(f, pos);
+			fwrite(loaded[i]->tracks->streams, 1, pack_clips[i].tracks_bytes, f);
+			pos += pack_clips[i].tracks_bytes;
+		}
+		assert(pos == offset);
+		fclose(f);
+		std::cout << "[OK] Animation pack: " << filename << " Clips: " << pack_clips.size() << " Skeletons: " << skeletons.size() << " Size: " << offset / 1024 << "KB" << std::endl;
+	}
+
+	for (size_t i = 0; i < loaded.size(); ++i)
+		delete loaded[i];
+	return ok;
+}
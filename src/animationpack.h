@@ -0,0 +1,76 @@
+/*  Many animations and their skeletons in one file, made to be mapped in memory.
+	The file starts with an index (name, skeleton and sections of every clip), skeletons shared by several clips
+	are stored once, and the tracks of every clip (the SoA streams of AnimationTracks) are aligned to a cache line
+	so the clips sample them right from the mapped file, nothing is copied but the skeletons.
+	Build it offline from the .skanim of a folder, loading it registers its clips in Animation::sAnimationsLoaded
+	with the names they were built from, so Animation::Get finds them without touching their files (names that are
+	already loaded keep their animation, the clip of the pack is only in clips).
+*/
+
+#ifndef ANIMATIONPACK_H
+#define ANIMATIONPACK_H
+
+#include <vector>
+#include <string>
+#include "framework.h"
+
+class Animation;
+
+#define APAK_VERSION 1
+#define APAK_ALIGNMENT 64 //of the sections, in bytes
+
+struct sPackHeader {
+	char watermark[4]; //APAK
+	int version;
+	int header_bytes;
+	int num_skeletons;
+	int num_clips;
+	uint32 file_size;
+	char extra[8];
+};
+
+struct sPackSkeleton {
+	uint32 bones_offset; //num_bones Skeleton::Bone from the start of the file
+	int num_bones;
+};
+
+struct sPackClip {
+	char name[128]; //as used in Animation::Get
+	int skeleton;
+	float duration;
+	float samples_per_second;
+	int num_animated_bones;
+	int num_keyframes;
+	int8 bones_map[128];
+	uint32 tracks_offset; //AnimationTracks streams from the start of the file
+	uint32 tracks_bytes;
+};
+
+class AnimationPack
+{
+public:
+	std::string filename;
+	std::vector<Animation*> clips; //owned by the pack, registered in the pool while it is loaded
+
+	AnimationPack();
+	~AnimationPack();
+
+	bool load(const char* filename); //maps the file and registers its clips
+	void unload(); //the clips must not be referenced anymore
+	size_t getMappedBytes() const { return size; }
+
+	//packs the animations of every .skanim in folder (named folder/file.skanim)
+	static bool build(const char* folder, const char* filename);
+	static bool build(const std::vector<std::string>& animations, const char* filename);
+
+private:
+	const char* data; //mapped file
+	size_t size;
+	void* file_handle;
+	void* mapping_handle;
+
+	bool map(const char* filename);
+	void unmap();
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "animationplayer.h"
+#include "animation.h"
+
+#include <cassert>
+#include <cmath>
+
+AnimationPlayer::AnimationPlayer()
+{
+	time = 0.0f;
+	speed = 1.0f;
+	loop = true;
+	layers = 0xFF;
+}
+
+AnimationPlayer::AnimationPlayer(Animation* clip, bool loop)
+{
+	time = 0.0f;
+	speed = 1.0f;
+	this->loop = loop;
+	layers = 0xFF;
+	setClip(clip);
+}
+
+void AnimationPlayer::setClip(Animation* clip, bool reset_pose)
+{
+	this->clip = clip;
+	time = 0.0f;
+	if (clip && (reset_pose || pose.num_bones != clip->skeleton.num_bones))
+		pose.setup(clip->skeleton);
+}
+
+bool AnimationPlayer::setClip(const char* filename, bool reset_pose)
+{
+	Animation* anim = Animation::Get(filename, true); //only held by handles
+	if (!anim)
+		return false;
+	setClip(anim, reset_pose);
+	return true;
+}
+
+void AnimationPlayer::advance(float dt)
+{
+	if (!clip)
+		return;
+	time += dt * speed;
+	if (loop)
+	{
+		//keeps the time small so it doesnt lose precision
+		time = fmod(time, clip->duration);
+		if (time < 0.0f)
+			time += clip->duration;
+	}
+	else
+		time = clamp(time, 0.0f, clip->duration);
+}
+
+bool AnimationPlayer::isFinished() const
+{
+	return clip && !loop && (speed >= 0.0f ? time >= clip->duration : time <= 0.0f);
+}
+
+void AnimationPlayer::evaluate()
+{
+	assert(clip && pose.num_bones == clip->skeleton.num_bones && "the pose must come from the skeleton of the clip");
+	const Animation* anim = clip;
+
+	Matrix44 locals[128];
+	anim->sampleLocal(time, locals, loop);
+	for (int i = 0; i < anim->num_animated_bones; ++i)
+	{
+		int bone = anim->bones_map[i];
+		if (layers != 0xFF && !(anim->skeleton.bones[bone].layer & layers))
+			continue;
+		pose.locals[bone] = locals[i];
+	}
+	pose.updateGlobalMatrices();
+}
+
+void AnimationPlayer::computeFinalBoneMatrices(std::vector<Matrix44>& bone_matrices, Mesh* mesh)
+{
+	assert(clip && mesh);
+	const sSkinBinding* binding = clip->skeleton.getSkinBinding(mesh);
+	bone_matrices.resize(mesh->bones_info.size());
+	if (bone_matrices.size())
+		multiplyMatricesIndexed(&binding->bind_matrices[0], pose.globals, &binding->bone_indices[0], (int)bone_matrices.size(), &bone_matrices[0]);
+}
@@ -0,0 +1,46 @@
+/*  Playback state of one character for an Animation.
+	The Animation is the clip, shared by everybody and never changed while playing, and every character keeps
+	its own AnimationPlayer with the time, the layers to play and its own pose. Evaluating a player only reads
+	the clip and writes the pose of the player, so many players can sample the same clip at once from different
+	threads, and nothing is allocated per frame.
+*/
+
+#ifndef ANIMATIONPLAYER_H
+#define ANIMATIONPLAYER_H
+
+#include <vector>
+#include "framework.h"
+#include "resource.h"
+#include "skeletonpose.h"
+
+class Animation;
+class Skeleton;
+class Mesh;
+
+class AnimationPlayer
+{
+public:
+	ResourceHandle<Animation> clip; //keeps the clip loaded while it is being played
+	float time; //seconds
+	float speed; //playback rate
+	bool loop;
+	uint8 layers; //bones affected, the rest keep their pose
+	SkeletonPose pose; //result of the last evaluate
+
+	AnimationPlayer();
+	AnimationPlayer(Animation* clip, bool loop = true);
+
+	void setClip(Animation* clip, bool reset_pose = true); //from the main thread, reset_pose takes the rest pose of its skeleton
+	bool setClip(const char* filename, bool reset_pose = true); //loads it as evictable, the pool frees it once no player uses it
+	void advance(float dt); //moves the time, wrapping or clamping it to the clip
+	bool isFinished() const; //not looping and at the end of the clip
+
+	//samples the clip at the current time into the pose and updates its global matrices
+	void evaluate();
+
+	//palette for the shader from the current pose
+	void computeFinalBoneMatrices(std::vector<Matrix44>& bone_matrices, Mesh* mesh);
+	void copyTo(Skeleton& skeleton) const { pose.copyTo(skeleton); } //for code using Skeleton
+};
+
+#endif
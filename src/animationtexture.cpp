@@ -0,0 +1,257 @@
+#include "animationtexture.h"
+#include "animation.h"
+#include "texture.h"
+#include "shader.h"
+#include "threadpool.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+InstanceLayout AnimationTexture::instance_layout = InstanceLayout().add("u_model", 16).add("a_animation", 4);
+
+//the texture of the frames must fit in the textures of this GPU
+static bool fitsInTexture(int width, int height)
+{
+	int max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	return width <= max_size && height <= max_size;
+}
+
+AnimationTexture::AnimationTexture(float frames_per_second)
+{
+	this->frames_per_second = frames_per_second;
+	num_bones = 0;
+	num_frames = 0;
+	texture = NULL;
+}
+
+AnimationTexture::~AnimationTexture()
+{
+	clear();
+}
+
+void AnimationTexture::clear()
+{
+	if (texture)
+		delete texture;
+	texture = NULL;
+	clips.clear();
+	data.clear();
+	num_frames = 0;
+	num_bones = 0;
+}
+
+int AnimationTexture::addClip(Mesh* mesh, Animation* anim, bool loop, const char* name)
+{
+	assert(mesh && anim && mesh->bones_info.size());
+	if (clips.size() && num_bones != (int)mesh->bones_info.size())
+	{
+		std::cout << "[ERROR] AnimationTexture: all the clips must skin the same mesh" << std::endl;
+		return -1;
+	}
+
+	int frames = std::max(1, (int)(anim->duration * frames_per_second + 0.5f));
+	if (clips.size() >= ANIMATION_TEXTURE_MAX_CLIPS || !fitsInTexture((int)mesh->bones_info.size() * 3, num_frames + frames))
+	{
+		std::cout << "[ERROR] AnimationTexture: too many clips or frames" << std::endl;
+		return -1;
+	}
+
+	sClip clip;
+	memset(&clip, 0, sizeof(clip));
+	strncpy(clip.name, name ? name : anim->resource_name.c_str(), sizeof(clip.name) - 1);
+	clip.first_frame = num_frames;
+	clip.num_frames = frames;
+	clip.duration = anim->duration;
+	clip.loop = loop ? 1 : 0;
+
+	num_bones = (int)mesh->bones_info.size();
+	int row_floats = num_bones * 12;
+	data.resize((size_t)(num_frames + frames) * row_floats);
+
+	//frames are independent, every task poses its own copy of the skeleton
+	anim->touch();
+	float* rows = &data[(size_t)num_frames * row_floats];
+	ThreadPool::Get()->parallelFor(frames, 16, [&](int start, int end) {
+		Skeleton skeleton = anim->skeleton;
+		std::vector<Matrix44> palette;
+		Matrix44 locals[128];
+		for (int k = start; k < end; ++k)
+		{
+			anim->sampleLocal(k / frames_per_second, locals, loop);
+			for (int i = 0; i < anim->num_animated_bones; ++i)
+				skeleton.bones[anim->bones_map[i]].model = locals[i];
+			skeleton.computeFinalBoneMatrices(palette, mesh);
+
+			//v * M is the dot of v with every column of M
+			float* row = rows + (size_t)k * row_floats;
+			for (int i = 0; i < num_bones; ++i)
+				for (int c = 0; c < 3; ++c)
+					for (int r = 0; r < 4; ++r)
+						*row++ = palette[i].M[r][c];
+		}
+	});
+
+	num_frames += frames;
+	clips.push_back(clip);
+	return (int)clips.size() - 1;
+}
+
+int AnimationTexture::getClip(const char* name) const
+{
+	for (size_t i = 0; i < clips.size(); ++i)
+		if (strcmp(clips[i].name, name) == 0)
+			return (int)i;
+	return -1;
+}
+
+bool AnimationTexture::upload()
+{
+	assert(num_frames && "no clips to upload");
+	//loaded files may come from a GPU with bigger textures
+	if (!fitsInTexture(num_bones * 3, num_frames))
+	{
+		std::cout << "[ERROR] AnimationTexture: " << num_frames << " frames do not fit in a texture of this GPU" << std::endl;
+		return false;
+	}
+	if (!texture)
+		texture = new Texture();
+	texture->create(num_bones * 3, num_frames, GL_RGBA, GL_FLOAT, false, (Uint8*)&data[0], GL_RGBA32F);
+
+	//every fetch is in the center of a texel, nothing to filter
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	texture->unbind();
+	return true;
+}
+
+void AnimationTexture::setUniforms(Shader* shader, float time, int texture_slot)
+{
+	assert(texture && "call upload before rendering");
+	float values[ANIMATION_TEXTURE_MAX_CLIPS * 4];
+	memset(values, 0, sizeof(values));
+	for (size_t i = 0; i < clips.size(); ++i)
+	{
+		values[i * 4 + 0] = (float)clips[i].first_frame;
+		values[i * 4 + 1] = (float)clips[i].num_frames;
+		values[i * 4 + 2] = (float)clips[i].loop;
+	}
+	shader->setUniform("u_animation_texture", texture, texture_slot);
+	shader->setUniform("u_animation_texture_size", Vector2(texture->width, texture->height));
+	shader->setUniform4Array("u_clips", values, ANIMATION_TEXTURE_MAX_CLIPS);
+	shader->setUniform("u_animation_fps", frames_per_second);
+	shader->setUniform("u_time", time);
+}
+
+void AnimationTexture::renderInstances(Mesh* mesh, const sInstance* instances, int num_instances, float time)
+{
+	assert(mesh && Shader::current);
+	if (!num_instances)
+		return;
+	setUniforms(Shader::current, time);
+	mesh->renderInstanced(GL_TRIANGLES, instances, num_instances, instance_layout);
+}
+
+typedef struct
+{
+	int version;
+	int header_bytes;
+	int num_bones;
+	int num_frames;
+	int num_clips;
+	float frames_per_second;
+	char extra[16]; //unused
+} sAnimationTextureInfo;
+
+bool AnimationTexture::write(const char* filename)
+{
+	assert(num_frames);
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write ATEX: " << filename << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("ATEX", sizeof(char), 4, f);
+
+	sAnimationTextureInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = ANIMATION_TEXTURE_VERSION;
+	info.header_bytes = sizeof(sAnimationTextureInfo);
+	info.num_bones = num_bones;
+	info.num_frames = num_frames;
+	info.num_clips = (int)clips.size();
+	info.frames_per_second = frames_per_second;
+	fwrite((void*)&info, sizeof(info), 1, f);
+
+	fwrite((void*)&clips[0], sizeof(sClip) * clips.size(), 1, f);
+	fwrite((void*)&data[0], sizeof(float) * data.size(), 1, f);
+
+	fclose(f);
+	return true;
+}
+
+bool AnimationTexture::load(const char* filename)
+{
+	assert(filename);
+	struct stat stbuffer;
+	if (stat(filename, &stbuffer) != 0)
+		return false;
+
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+
+	unsigned int size = stbuffer.st_size;
+	if (size < 4 + sizeof(sAnimationTextureInfo))
+	{
+		fclose(f);
+		return false;
+	}
+
+	char* file_data = new char[size];
+	fread(file_data, size, 1, f);
+	fclose(f);
+
+	sAnimationTextureInfo info;
+	memcpy(&info, file_data + 4, sizeof(info));
+	if (memcmp(file_data, "ATEX", 4) != 0 || info.version != ANIMATION_TEXTURE_VERSION || info.header_bytes != sizeof(sAnimationTextureInfo) ||
+		info.num_clips <= 0 || info.num_clips > ANIMATION_TEXTURE_MAX_CLIPS || info.num_frames <= 0 || info.num_bones <= 0 || info.num_bones > 128 ||
+		size != 4 + sizeof(info) + info.num_clips * sizeof(sClip) + (size_t)info.num_frames * info.num_bones * 12 * sizeof(float))
+	{
+		std::cout << "[WARN] loading ATEX: old version or invalid content: " << filename << std::endl;
+		delete[] file_data;
+		return false;
+	}
+
+	clear();
+	char* pos = file_data + 4 + sizeof(info);
+	num_bones = info.num_bones;
+	num_frames = info.num_frames;
+	frames_per_second = info.frames_per_second;
+	clips.resize(info.num_clips);
+	memcpy((void*)&clips[0], pos, sizeof(sClip) * info.num_clips);
+	pos += sizeof(sClip) * info.num_clips;
+	for (size_t i = 0; i < clips.size(); ++i)
+	{
+		const sClip& clip = clips[i];
+		if (clip.first_frame < 0 || clip.num_frames <= 0 || clip.num_frames > num_frames - clip.first_frame)
+		{
+			std::cout << "[WARN] loading ATEX: clip out of the frames: " << filename << std::endl;
+			clear();
+			delete[] file_data;
+			return false;
+		}
+		clips[i].name[sizeof(clip.name) - 1] = 0;
+	}
+	data.resize((size_t)num_frames * num_bones * 12);
+	memcpy((void*)&data[0], pos, sizeof(float) * data.size());
+
+	delete[] file_data;
+	return true;
+}
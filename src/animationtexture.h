@@ -0,0 +1,75 @@
+/*  Skinning palettes of a mesh baked into a float texture, to draw crowds with instancing.
+	Every clip is sampled at a fixed rate and every frame is stored as a row of the texture with three texels
+	per bone (the first three columns of the palette matrix). Every instance carries its model, the clip it plays
+	and a time offset, the vertex shader (data/shaders/skinned_instanced.vs) finds the two frames to interpolate
+	and skins the vertex, so any number of characters sharing the mesh are rendered in one draw call.
+	The baked frames can be stored in a file (.atex) to skip the baking when loading.
+*/
+
+#ifndef ANIMATIONTEXTURE_H
+#define ANIMATIONTEXTURE_H
+
+#include <vector>
+#include "framework.h"
+
+class Mesh;
+class Animation;
+class Texture;
+class Shader;
+class InstanceLayout;
+
+#define ANIMATION_TEXTURE_VERSION 1
+#define ANIMATION_TEXTURE_MAX_CLIPS 16 //size of the uniform array in the shader
+
+class AnimationTexture
+{
+public:
+	//fixed size to help serializing
+	struct sClip {
+		char name[64];
+		int first_frame; //row of the texture
+		int num_frames;
+		float duration;
+		int loop;
+	};
+
+	//what the shader reads from every instance
+	struct sInstance {
+		Matrix44 model;
+		float clip; //index in clips
+		float time_offset; //seconds added to the time of the frame
+		float speed; //playback rate
+		float unused;
+	};
+	static InstanceLayout instance_layout;
+
+	int num_bones; //bones of the palette (bones_info of the mesh)
+	float frames_per_second;
+	int num_frames; //all the clips
+	std::vector<sClip> clips;
+	std::vector<float> data; //num_frames rows of num_bones * 3 RGBA texels
+	Texture* texture;
+
+	AnimationTexture(float frames_per_second = 30.0f);
+	~AnimationTexture();
+
+	//samples the whole animation skinning the mesh, returns the clip index or -1 if it doesnt fit.
+	//Every frame is a row and the GPU limits the rows (GL_MAX_TEXTURE_SIZE, GL 3 only guarantees 1024), so it needs the GL context
+	int addClip(Mesh* mesh, Animation* anim, bool loop = true, const char* name = NULL);
+	int getClip(const char* name) const;
+	void clear();
+
+	bool upload(); //creates the texture with all the clips (call it after adding them), false if the GPU cannot hold it
+
+	//the shader must be enabled, it sets the texture and the clips and draws all the instances at once
+	void setUniforms(Shader* shader, float time, int texture_slot = 7);
+	void renderInstances(Mesh* mesh, const sInstance* instances, int num_instances, float time);
+
+	//storage
+	bool write(const char* filename);
+	bool load(const char* filename);
+
+	size_t getMemoryUsage() const { return data.capacity() * sizeof(float) + clips.capacity() * sizeof(sClip); }
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "animationtracks.h"
+#include "compressedanimation.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#ifdef FRAMEWORK_USE_SSE
+	#define TRACKS_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+AnimationTracks::AnimationTracks()
+{
+	num_keyframes = 0;
+	num_animated_bones = 0;
+	num_lanes = 0;
+	streams = NULL;
+}
+
+void AnimationTracks::build(const Matrix44* keyframes, int num_keyframes, int num_animated_bones)
+{
+	assert(keyframes && num_keyframes > 0 && num_animated_bones > 0);
+	this->num_keyframes = num_keyframes;
+	this->num_animated_bones = num_animated_bones;
+	num_lanes = (num_animated_bones + 3) & ~3;
+
+	//padding lanes are identity
+	data.assign(num_keyframes * NUM_STREAMS * num_lanes, 0.0f);
+	for (int k = 0; k < num_keyframes; ++k)
+		for (int i = num_animated_bones; i < num_lanes; ++i)
+		{
+			float* sample = &data[k * NUM_STREAMS * num_lanes];
+			sample[QW * num_lanes + i] = sample[SX * num_lanes + i] = sample[SY * num_lanes + i] = sample[SZ * num_lanes + i] = 1.0f;
+		}
+
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		Quaternion previous(0.0f, 0.0f, 0.0f, 1.0f);
+		for (int k = 0; k < num_keyframes; ++k)
+		{
+			Vector3 t, s;
+			Quaternion q;
+			decomposeMatrix(keyframes[k * num_animated_bones + i], t, q, s);
+			//keep consecutive keys in the same hemisphere (sample still checks it for the loop back to the first)
+			if (DotProduct(q, previous) < 0.0f)
+				q *= -1.0f;
+			previous = q;
+
+			float* sample = &data[k * NUM_STREAMS * num_lanes];
+			float values[NUM_STREAMS] = { q.x, q.y, q.z, q.w, t.x, t.y, t.z, s.x, s.y, s.z };
+			for (int j = 0; j < NUM_STREAMS; ++j)
+				sample[j * num_lanes + i] = values[j];
+		}
+	}
+	streams = &data[0];
+}
+
+void AnimationTracks::setStreams(const float* streams, int num_keyframes, int num_animated_bones)
+{
+	assert(streams && num_keyframes > 0 && num_animated_bones > 0);
+	this->num_keyframes = num_keyframes;
+	this->num_animated_bones = num_animated_bones;
+	num_lanes = (num_animated_bones + 3) & ~3;
+	std::vector<float>().swap(data);
+	this->streams = streams;
+}
+
+void AnimationTracks::sample(int index, int index2, float f, Matrix44* out) const
+{
+	assert(num_lanes && index >= 0 && index < num_keyframes && index2 >= 0 && index2 < num_keyframes);
+	const float* a = streams + index * NUM_STREAMS * num_lanes;
+	const float* b = streams + index2 * NUM_STREAMS * num_lanes;
+
+#ifdef TRACKS_USE_SSE
+	__m128 vf = _mm_set1_ps(f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 three_halfs = _mm_set1_ps(1.5f);
+	__m128 sign_bit = _mm_set1_ps(-0.0f);
+	for (int i = 0; i < num_lanes; i += 4)
+	{
+		__m128 ax = _mm_loadu_ps(a + QX * num_lanes + i), bx = _mm_loadu_ps(b + QX * num_lanes + i);
+		__m128 ay = _mm_loadu_ps(a + QY * num_lanes + i), by = _mm_loadu_ps(b + QY * num_lanes + i);
+		__m128 az = _mm_loadu_ps(a + QZ * num_lanes + i), bz = _mm_loadu_ps(b + QZ * num_lanes + i);
+		__m128 aw = _mm_loadu_ps(a + QW * num_lanes + i), bw = _mm_loadu_ps(b + QW * num_lanes + i);
+
+		//nlerp through the shortest path: flip b where the dot is negative
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		__m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), sign_bit);
+		bx = _mm_xor_ps(bx, flip);
+		by = _mm_xor_ps(by, flip);
+		bz = _mm_xor_ps(bz, flip);
+		bw = _mm_xor_ps(bw, flip);
+		__m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), vf));
+		__m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), vf));
+		__m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), vf));
+		__m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), vf));
+
+		//1/length with one newton step, the length never gets close to zero as both keys are unit and in the same hemisphere
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		__m128 inv = _mm_rsqrt_ps(len2);
+		inv = _mm_mul_ps(inv, _mm_sub_ps(three_halfs, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(inv, inv))));
+		//the 2 of the rotation matrix goes with the normalization
+		__m128 inv2 = _mm_mul_ps(_mm_mul_ps(inv, inv), two);
+
+		__m128 xx = _mm_mul_ps(_mm_mul_ps(x, x), inv2), yy = _mm_mul_ps(_mm_mul_ps(y, y), inv2), zz = _mm_mul_ps(_mm_mul_ps(z, z), inv2);
+		__m128 xy = _mm_mul_ps(_mm_mul_ps(x, y), inv2), xz = _mm_mul_ps(_mm_mul_ps(x, z), inv2), yz = _mm_mul_ps(_mm_mul_ps(y, z), inv2);
+		__m128 wx = _mm_mul_ps(_mm_mul_ps(w, x), inv2), wy = _mm_mul_ps(_mm_mul_ps(w, y), inv2), wz = _mm_mul_ps(_mm_mul_ps(w, z), inv2);
+
+		__m128 t[3], s[3];
+		for (int j = 0; j < 3; ++j)
+		{
+			__m128 ta = _mm_loadu_ps(a + (TX + j) * num_lanes + i), tb = _mm_loadu_ps(b + (TX + j) * num_lanes + i);
+			__m128 sa = _mm_loadu_ps(a + (SX + j) * num_lanes + i), sb = _mm_loadu_ps(b + (SX + j) * num_lanes + i);
+			t[j] = _mm_add_ps(ta, _mm_mul_ps(_mm_sub_ps(tb, ta), vf));
+			s[j] = _mm_add_ps(sa, _mm_mul_ps(_mm_sub_ps(sb, sa), vf));
+		}
+
+		//same layout as composeMatrix, rows of the rotation scaled
+		__m128 rows[4][4] = {
+			{ _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), s[0]), _mm_mul_ps(_mm_sub_ps(xy, wz), s[0]), _mm_mul_ps(_mm_add_ps(xz, wy), s[0]), zero },
+			{ _mm_mul_ps(_mm_add_ps(xy, wz), s[1]), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), s[1]), _mm_mul_ps(_mm_sub_ps(yz, wx), s[1]), zero },
+			{ _mm_mul_ps(_mm_sub_ps(xz, wy), s[2]), _mm_mul_ps(_mm_add_ps(yz, wx), s[2]), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), s[2]), zero },
+			{ t[0], t[1], t[2], one } };
+
+		//every row holds one element of four matrices, transpose them to write the matrices
+		for (int r = 0; r < 4; ++r)
+		{
+			__m128 c0 = rows[r][0], c1 = rows[r][1], c2 = rows[r][2], c3 = rows[r][3];
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			_mm_storeu_ps(out[i].m + r * 4, c0);
+			_mm_storeu_ps(out[i + 1].m + r * 4, c1);
+			_mm_storeu_ps(out[i + 2].m + r * 4, c2);
+			_mm_storeu_ps(out[i + 3].m + r * 4, c3);
+		}
+	}
+#else
+	for (int i = 0; i < num_lanes; ++i)
+	{
+		Quaternion qa(a[QX * num_lanes + i], a[QY * num_lanes + i], a[QZ * num_lanes + i], a[QW * num_lanes + i]);
+		Quaternion qb(b[QX * num_lanes + i], b[QY * num_lanes + i], b[QZ * num_lanes + i], b[QW * num_lanes + i]);
+		if (DotProduct(qa, qb) < 0.0f)
+			qb *= -1.0f;
+		Quaternion q(qa.x + (qb.x - qa.x) * f, qa.y + (qb.y - qa.y) * f, qa.z + (qb.z - qa.z) * f, qa.w + (qb.w - qa.w) * f);
+		q.normalize();
+		Vector3 t, s;
+		for (int j = 0; j < 3; ++j)
+		{
+			t.v[j] = lerp(a[(TX + j) * num_lanes + i], b[(TX + j) * num_lanes + i], f);
+			s.v[j] = lerp(a[(SX + j) * num_lanes + i], b[(SX + j) * num_lanes + i], f);
+		}
+		composeMatrix(t, q, s, out[i]);
+	}
+#endif
+}
+
+void AnimationTracks::sampleBone(int index, int index2, float f, int bone, Matrix44& out) const
+{
+	assert(bone >= 0 && bone < num_animated_bones && index >= 0 && index < num_keyframes && index2 >= 0 && index2 < num_keyframes);
+	const float* a = streams + index * NUM_STREAMS * num_lanes + bone;
+	const float* b = streams + index2 * NUM_STREAMS * num_lanes + bone;
+
+	Quaternion qa(a[QX * num_lanes], a[QY * num_lanes], a[QZ * num_lanes], a[QW * num_lanes]);
+	Quaternion qb(b[QX * num_lanes], b[QY * num_lanes], b[QZ * num_lanes], b[QW * num_lanes]);
+	if (DotProduct(qa, qb) < 0.0f)
+		qb *= -1.0f;
+	Quaternion q(qa.x + (qb.x - qa.x) * f, qa.y + (qb.y - qa.y) * f, qa.z + (qb.z - qa.z) * f, qa.w + (qb.w - qa.w) * f);
+	q.normalize();
+	Vector3 t, s;
+	for (int j = 0; j < 3; ++j)
+	{
+		t.v[j] = lerp(a[(TX + j) * num_lanes], b[(TX + j) * num_lanes], f);
+		s.v[j] = lerp(a[(SX + j) * num_lanes], b[(SX + j) * num_lanes], f);
+	}
+	composeMatrix(t, q, s, out);
+}
+
+void AnimationTracks::sampleTRS(int index, int index2, float f, sBoneTRS* out) const
+{
+	assert(num_lanes && index >= 0 && index < num_keyframes && index2 >= 0 && index2 < num_keyframes);
+	const float* a = streams + index * NUM_STREAMS * num_lanes;
+	const float* b = streams + index2 * NUM_STREAMS * num_lanes;
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		Quaternion qa(a[QX * num_lanes + i], a[QY * num_lanes + i], a[QZ * num_lanes + i], a[QW * num_lanes + i]);
+		Quaternion qb(b[QX * num_lanes + i], b[QY * num_lanes + i], b[QZ * num_lanes + i], b[QW * num_lanes + i]);
+		if (DotProduct(qa, qb) < 0.0f)
+			qb *= -1.0f;
+		Quaternion& q = out[i].rotation;
+		q.set(qa.x + (qb.x - qa.x) * f, qa.y + (qb.y - qa.y) * f, qa.z + (qb.z - qa.z) * f, qa.w + (qb.w - qa.w) * f);
+		q.normalize();
+		for (int j = 0; j < 3; ++j)
+		{
+			out[i].translation.v[j] = lerp(a[(TX + j) * num_lanes + i], b[(TX + j) * num_lanes + i], f);
+			out[i].scale.v[j] = lerp(a[(SX + j) * num_lanes + i], b[(SX + j) * num_lanes + i], f);
+		}
+	}
+}
+
+void AnimationTracks::accumulateTRS(int index, int index2, float f, const float* weights, float* acc) const
+{
+	assert(num_lanes && index >= 0 && index < num_keyframes && index2 >= 0 && index2 < num_keyframes);
+	const float* a = streams + index * NUM_STREAMS * num_lanes;
+	const float* b = streams + index2 * NUM_STREAMS * num_lanes;
+	float* total = acc + NUM_STREAMS * num_lanes;
+
+#ifdef TRACKS_USE_SSE
+	__m128 vf = _mm_set1_ps(f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 three_halfs = _mm_set1_ps(1.5f);
+	__m128 sign_bit = _mm_set1_ps(-0.0f);
+	for (int i = 0; i < num_lanes; i += 4)
+	{
+		__m128 weight = _mm_loadu_ps(weights + i);
+		__m128 ax = _mm_loadu_ps(a + QX * num_lanes + i), bx = _mm_loadu_ps(b + QX * num_lanes + i);
+		__m128 ay = _mm_loadu_ps(a + QY * num_lanes + i), by = _mm_loadu_ps(b + QY * num_lanes + i);
+		__m128 az = _mm_loadu_ps(a + QZ * num_lanes + i), bz = _mm_loadu_ps(b + QZ * num_lanes + i);
+		__m128 aw = _mm_loadu_ps(a + QW * num_lanes + i), bw = _mm_loadu_ps(b + QW * num_lanes + i);
+
+		//nlerp of the keys like sample
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		__m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), sign_bit);
+		bx = _mm_xor_ps(bx, flip);
+		by = _mm_xor_ps(by, flip);
+		bz = _mm_xor_ps(bz, flip);
+		bw = _mm_xor_ps(bw, flip);
+		__m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), vf));
+		__m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), vf));
+		__m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), vf));
+		__m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), vf));
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		__m128 inv = _mm_rsqrt_ps(len2);
+		inv = _mm_mul_ps(inv, _mm_sub_ps(three_halfs, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(inv, inv))));
+
+		//the weight of the rotation goes negative where it is in the other hemisphere of the sum (q and -q are the same rotation)
+		__m128 sx = _mm_loadu_ps(acc + QX * num_lanes + i), sy = _mm_loadu_ps(acc + QY * num_lanes + i);
+		__m128 sz = _mm_loadu_ps(acc + QZ * num_lanes + i), sw = _mm_loadu_ps(acc + QW * num_lanes + i);
+		__m128 side = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, x), _mm_mul_ps(sy, y)), _mm_add_ps(_mm_mul_ps(sz, z), _mm_mul_ps(sw, w)));
+		__m128 rotation_weight = _mm_mul_ps(_mm_xor_ps(weight, _mm_and_ps(_mm_cmplt_ps(side, zero), sign_bit)), inv);
+		_mm_storeu_ps(acc + QX * num_lanes + i, _mm_add_ps(sx, _mm_mul_ps(x, rotation_weight)));
+		_mm_storeu_ps(acc + QY * num_lanes + i, _mm_add_ps(sy, _mm_mul_ps(y, rotation_weight)));
+		_mm_storeu_ps(acc + QZ * num_lanes + i, _mm_add_ps(sz, _mm_mul_ps(z, rotation_weight)));
+		_mm_storeu_ps(acc + QW * num_lanes + i, _mm_add_ps(sw, _mm_mul_ps(w, rotation_weight)));
+
+		for (int j = TX; j < NUM_STREAMS; ++j)
+		{
+			__m128 va = _mm_loadu_ps(a + j * num_lanes + i), vb = _mm_loadu_ps(b + j * num_lanes + i);
+			__m128 v = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vf));
+			_mm_storeu_ps(acc + j * num_lanes + i, _mm_add_ps(_mm_loadu_ps(acc + j * num_lanes + i), _mm_mul_ps(v, weight)));
+		}
+		_mm_storeu_ps(total + i, _mm_add_ps(_mm_loadu_ps(total + i), weight));
+	}
+#else
+	for (int i = 0; i < num_lanes; ++i)
+	{
+		float weight = weights[i];
+		Quaternion qa(a[QX * num_lanes + i], a[QY * num_lanes + i], a[QZ * num_lanes + i], a[QW * num_lanes + i]);
+		Quaternion qb(b[QX * num_lanes + i], b[QY * num_lanes + i], b[QZ * num_lanes + i], b[QW * num_lanes + i]);
+		if (DotProduct(qa, qb) < 0.0f)
+			qb *= -1.0f;
+		Quaternion q(qa.x + (qb.x - qa.x) * f, qa.y + (qb.y - qa.y) * f, qa.z + (qb.z - qa.z) * f, qa.w + (qb.w - qa.w) * f);
+		q.normalize();
+		Quaternion sum(acc[QX * num_lanes + i], acc[QY * num_lanes + i], acc[QZ * num_lanes + i], acc[QW * num_lanes + i]);
+		float rotation_weight = DotProduct(sum, q) < 0.0f ? -weight : weight;
+		for (int j = QX; j <= QW; ++j)
+			acc[j * num_lanes + i] += q.q[j - QX] * rotation_weight;
+		for (int j = TX; j < NUM_STREAMS; ++j)
+			acc[j * num_lanes + i] += lerp(a[j * num_lanes + i], b[j * num_lanes + i], f) * weight;
+		total[i] += weight;
+	}
+#endif
+}
+
+void AnimationTracks::getKeyframe(int index, Matrix44* out) const
+{
+	assert(index >= 0 && index < num_keyframes);
+	const float* sample = streams + index * NUM_STREAMS * num_lanes;
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		Quaternion q(sample[QX * num_lanes + i], sample[QY * num_lanes + i], sample[QZ * num_lanes + i], sample[QW * num_lanes + i]);
+		Vector3 t(sample[TX * num_lanes + i], sample[TY * num_lanes + i], sample[TZ * num_lanes + i]);
+		Vector3 s(sample[SX * num_lanes + i], sample[SY * num_lanes + i], sample[SZ * num_lanes + i]);
+		composeMatrix(t, q, s, out[i]);
+	}
+}
@@ -0,0 +1,58 @@
+/*  Keyframes of an Animation stored as rotation, translation and scale tracks in SoA.
+	Every sample keeps ten streams (qx, qy, qz, qw, tx, ty, tz, sx, sy, sz) with one float per bone, padded
+	to groups of four bones, so a pose is interpolated four bones at a time using SIMD (nlerp for the rotations,
+	lerp for the rest) and the local matrices of all the bones are written in one pass.
+	It takes 40 bytes per bone and sample instead of the 64 of a Matrix44.
+	The streams can also live outside (the mapped memory of an AnimationPack), then data stays empty.
+*/
+
+#ifndef ANIMATIONTRACKS_H
+#define ANIMATIONTRACKS_H
+
+#include <vector>
+#include "framework.h"
+
+struct sBoneTRS;
+
+class AnimationTracks
+{
+public:
+	enum { QX, QY, QZ, QW, TX, TY, TZ, SX, SY, SZ, NUM_STREAMS };
+
+	int num_keyframes;
+	int num_animated_bones;
+	int num_lanes; //num_animated_bones rounded up to a multiple of 4
+	std::vector<float> data; //num_keyframes * NUM_STREAMS * num_lanes
+	const float* streams; //&data[0] or external memory, not copied with the object
+
+	AnimationTracks();
+
+	//keyframes has num_keyframes * num_animated_bones matrices (all the bones of the first sample, then the second, ...)
+	void build(const Matrix44* keyframes, int num_keyframes, int num_animated_bones);
+	//uses streams laid out like data without copying them, they must stay alive while the tracks are used
+	void setStreams(const float* streams, int num_keyframes, int num_animated_bones);
+
+	//local matrices of all the animated bones between sample index and index2, out must have room for num_lanes matrices
+	void sample(int index, int index2, float f, Matrix44* out) const;
+	//local matrix of a single bone, for when only a few bones are needed
+	void sampleBone(int index, int index2, float f, int bone, Matrix44& out) const;
+	//the same interpolation as sample without building the matrices, for poses that are blended after (num_animated_bones)
+	void sampleTRS(int index, int index2, float f, sBoneTRS* out) const;
+	//adds the pose weighted per lane to acc, NUM_STREAMS + 1 streams of num_lanes floats (the last one sums the weights).
+	//The rotations are flipped to the hemisphere of what acc already has, they are normalized when the sums are used
+	void accumulateTRS(int index, int index2, float f, const float* weights, float* acc) const;
+
+	//matrices of one sample, used to store or compress the animation
+	void getKeyframe(int index, Matrix44* out) const;
+
+	size_t getMemoryUsage() const { return data.capacity() * sizeof(float); }
+
+	const float* getStream(int keyframe, int stream) const { return streams + (keyframe * NUM_STREAMS + stream) * num_lanes; }
+	size_t getStreamsSize() const { return size_t(num_keyframes) * NUM_STREAMS * num_lanes * sizeof(float); }
+
+private:
+	AnimationTracks(const AnimationTracks&);
+	AnimationTracks& operator = (const AnimationTracks&);
+};
+
+#endif
@@ -0,0 +1,786 @@
+#include "benchmark.h"
+#include "framework.h"
+#include "random.h"
+#include "threadpool.h"
+#include "mesh.h"
+#include "utils.h"
+#include "animationtracks.h"
+#include "animation.h"
+#include "crowd.h"
+#include "skeletonpose.h"
+#include "skinning.h"
+
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+typedef bool(*BenchmarkFunc)();
+
+static volatile float s_sink; //results written here are not optimized away
+
+static double getSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+static void printResult(const char* what, double amount, const char* unit, double seconds)
+{
+	printf("  %-40s %12.2f %s/s (%.3f s)\n", what, seconds > 0.0 ? amount / seconds : 0.0, unit, seconds);
+}
+
+// RAYS ****************************************
+
+//rays from above against a subdivided plane, the batch against one ray at a time
+static bool benchmarkRays()
+{
+	Mesh mesh;
+	mesh.createSubdividedPlane(100.0f, 256, true); //131072 triangles
+	mesh.createCollisionModel();
+
+	const int num_rays = 1 << 18;
+	Random random(28);
+	RayBatch rays;
+	rays.resize(num_rays);
+	for (int i = 0; i < num_rays; ++i)
+	{
+		Vector3 origin = random.nextVector3(Vector3(60.0f, 0.0f, 60.0f)) + Vector3(0.0f, 10.0f, 0.0f);
+		Vector3 target = random.nextVector3(Vector3(60.0f, 0.0f, 60.0f));
+		rays.set(i, origin, target - origin);
+	}
+
+	Matrix44 model;
+	model.setTranslation(1.0f, -2.0f, 3.0f);
+	std::vector<RayHit> hits;
+	double start = getSeconds();
+	mesh.testRaysCollision(model, rays, hits);
+	printResult("rays batch", num_rays, "rays", getSeconds() - start);
+
+	//the single ray path is slower, a part of the rays is enough
+	const int num_single = num_rays / 16;
+	int mismatches = 0;
+	start = getSeconds();
+	for (int i = 0; i < num_single; ++i)
+	{
+		Vector3 origin(rays.origin[0][i], rays.origin[1][i], rays.origin[2][i]);
+		Vector3 direction(rays.direction[0][i], rays.direction[1][i], rays.direction[2][i]);
+		Vector3 collision, normal;
+		bool hit = mesh.testRayCollision(model, origin, direction, collision, normal, rays.max_t[i]);
+		if (hit != (hits[i].triangle != -1))
+			++mismatches;
+	}
+	printResult("rays one by one", num_single, "rays", getSeconds() - start);
+
+	//rays that graze an edge can be found by one and not by the other
+	if (mismatches > num_single / 1000)
+	{
+		printf("  rays batch and single disagree in %d of %d rays\n", mismatches, num_single);
+		return false;
+	}
+	return true;
+}
+
+// PARSE ****************************************
+
+//a MESH line: the amount of numbers followed by all of them separated by commas
+static std::string buildNumbersLine(std::vector<float>& values, int num, bool integers)
+{
+	Random random(35);
+	std::string line = std::to_string(num);
+	char number[32];
+	values.resize(num);
+	for (int i = 0; i < num; ++i)
+	{
+		if (integers)
+			sprintf(number, ",%u", random.next() % 200000);
+		else if (i % 3 == 2)
+			sprintf(number, ",%.9g", random.nextFloat(-1000.0f, 1000.0f)); //every digit of a float
+		else
+			sprintf(number, ",%.6f", random.nextFloat(-100.0f, 100.0f)); //like the exporters write them
+		line += number;
+		values[i] = integers ? (float)atoi(number + 1) : strtof(number + 1, NULL);
+	}
+	line += "\n";
+	return line;
+}
+
+//MB/s of the number parsers, the floats must be the same ones strtof gives
+static bool benchmarkParse()
+{
+	const int num = 3 << 20;
+	std::vector<float> expected;
+	bool ok = true;
+
+	std::string line = buildNumbersLine(expected, num, false);
+	double megabytes = line.size() / (1024.0 * 1024.0);
+	std::vector<Vector3> vertices;
+	double start = getSeconds();
+	fetchBufferVec3(&line[0], vertices);
+	printResult("fetchBufferVec3", megabytes, "MB", getSeconds() - start);
+	if (vertices.size() * 3 != num || memcmp(&vertices[0], &expected[0], num * sizeof(float)) != 0)
+	{
+		printf("  fetchBufferVec3 does not match strtof\n");
+		ok = false;
+	}
+
+	//one number at a time in the calling thread against strtof
+	float value, sum = 0.0f;
+	const char* pos = line.c_str() + line.find(',') + 1;
+	start = getSeconds();
+	for (int i = 0; i < num; ++i)
+	{
+		pos = parseFloat(pos, value) + 1;
+		sum += value;
+	}
+	printResult("parseFloat", megabytes, "MB", getSeconds() - start);
+	char* end = &line[0] + line.find(',') + 1;
+	start = getSeconds();
+	for (int i = 0; i < num; ++i)
+	{
+		value = strtof(end, &end);
+		end++;
+		sum -= value;
+	}
+	printResult("strtof", megabytes, "MB", getSeconds() - start);
+
+	line = buildNumbersLine(expected, num, true);
+	megabytes = line.size() / (1024.0 * 1024.0);
+	std::vector<Vector3u> triangles;
+	start = getSeconds();
+	fetchBufferVec3u(&line[0], triangles);
+	printResult("fetchBufferVec3u", megabytes, "MB", getSeconds() - start);
+	for (int i = 0; i < num && ok; ++i)
+		if (triangles.size() * 3 != num || (float)triangles[i / 3].v[i % 3] != expected[i])
+		{
+			printf("  fetchBufferVec3u does not match atoi\n");
+			ok = false;
+		}
+
+	s_sink = sum;
+	return ok;
+}
+
+// MATH ****************************************
+
+//random rotation, scale and translation, plus a small perspective column when projective is set (w stays over 0.4)
+static void buildMatrices(std::vector<Matrix44>& matrices, int num, bool projective)
+{
+	Random random(48);
+	matrices.resize(num);
+	for (int i = 0; i < num; ++i)
+	{
+		Vector3 axis = random.nextVector3(Vector3(1.0f, 1.0f, 1.0f));
+		if (axis.length() < 0.01f)
+			axis.set(0.0f, 1.0f, 0.0f);
+		Matrix44& m = matrices[i];
+		m.setRotation(random.nextFloat(0.0f, 6.28f), axis.normalize());
+		m.scale(random.nextFloat(0.5f, 2.0f), random.nextFloat(0.5f, 2.0f), random.nextFloat(0.5f, 2.0f));
+		Vector3 t = random.nextVector3(Vector3(100.0f, 100.0f, 100.0f));
+		m.M[3][0] = t.x;
+		m.M[3][1] = t.y;
+		m.M[3][2] = t.z;
+		if (projective)
+		{
+			m.M[0][3] = random.nextFloat(-0.002f, 0.002f);
+			m.M[1][3] = random.nextFloat(-0.002f, 0.002f);
+			m.M[2][3] = random.nextFloat(-0.002f, 0.002f);
+		}
+	}
+}
+
+//biggest difference between a and b relative to the biggest value of b (1 at least), small elements of a matrix
+//are sums of big products that cancel out so they can only be as precise as the big ones
+static float relativeError(const float* a, const float* b, int num)
+{
+	float error = 0.0f;
+	float magnitude = 1.0f;
+	for (int i = 0; i < num; ++i)
+	{
+		error = std::max(error, fabsf(a[i] - b[i]));
+		magnitude = std::max(magnitude, fabsf(b[i]));
+	}
+	return error / magnitude;
+}
+
+//the SSE kernels of Matrix44 against the scalar code they replaced, timed and checked with a tolerance
+static bool benchmarkMatrix()
+{
+	const int num = 4096;
+	const int repeat = 1000;
+	std::vector<Matrix44> affine, projective, result(num);
+	buildMatrices(affine, num, false);
+	buildMatrices(projective, num, true);
+	bool ok = true;
+	float sum = 0.0f;
+
+	//product
+	double start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+			result[i] = projective[i] * affine[(i + r) % num];
+	printResult("operator *", (double)num * repeat, "products", getSeconds() - start);
+	std::vector<Matrix44> reference(num);
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+		{
+			const Matrix44& a = projective[i];
+			const Matrix44& b = affine[(i + r) % num];
+			Matrix44& out = reference[i];
+			for (int row = 0; row < 4; ++row)
+				for (int c = 0; c < 4; ++c)
+				{
+					out.M[row][c] = 0.0f;
+					for (int k = 0; k < 4; ++k)
+						out.M[row][c] += a.M[row][k] * b.M[k][c];
+				}
+		}
+	printResult("scalar product", (double)num * repeat, "products", getSeconds() - start);
+	float error = 0.0f;
+	for (int i = 0; i < num; ++i)
+		error = std::max(error, relativeError(result[i].m, reference[i].m, 16));
+	if (error > 1e-6f)
+	{
+		printf("  operator * differs by %g\n", error);
+		ok = false;
+	}
+
+	//inverses, checked against Gauss-Jordan
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+		{
+			result[i] = projective[i];
+			result[i].inverse();
+		}
+	printResult("inverse", (double)num * repeat, "matrices", getSeconds() - start);
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+		{
+			reference[i] = projective[i];
+			reference[i].inverseGaussJordan();
+		}
+	printResult("inverseGaussJordan", (double)num * repeat, "matrices", getSeconds() - start);
+	error = 0.0f;
+	for (int i = 0; i < num; ++i)
+		error = std::max(error, relativeError(result[i].m, reference[i].m, 16));
+	if (error > 1e-5f)
+	{
+		printf("  inverse differs by %g\n", error);
+		ok = false;
+	}
+
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+		{
+			result[i] = affine[i];
+			result[i].inverseAffine();
+		}
+	printResult("inverseAffine", (double)num * repeat, "matrices", getSeconds() - start);
+	error = 0.0f;
+	for (int i = 0; i < num; ++i)
+	{
+		reference[i] = affine[i];
+		reference[i].inverseGaussJordan();
+		error = std::max(error, relativeError(result[i].m, reference[i].m, 16));
+	}
+	if (error > 1e-5f)
+	{
+		printf("  inverseAffine differs by %g\n", error);
+		ok = false;
+	}
+
+	//points, strided like the vertices of a mesh
+	const int num_points = 1 << 16;
+	std::vector<Vector3> points(num_points), transformed(num_points);
+	Random random(481);
+	random.fillVector3(&points[0], num_points, Vector3(10.0f, 10.0f, 10.0f));
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+	{
+		transformPoints(affine[r], &points[0], sizeof(Vector3), &transformed[0], sizeof(Vector3), num_points);
+		sum += transformed[r].x;
+	}
+	printResult("transformPoints", (double)num_points * repeat, "points", getSeconds() - start);
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+	{
+		for (int i = 0; i < num_points; ++i)
+			transformed[i] = affine[r] * points[i];
+		sum += transformed[r].x;
+	}
+	printResult("matrix * point", (double)num_points * repeat, "points", getSeconds() - start);
+	error = 0.0f;
+	const Matrix44& last = affine[repeat - 1];
+	std::vector<Vector3> batch(points);
+	transformPoints(last, &batch[0], sizeof(Vector3), num_points); //in place
+	for (int i = 0; i < num_points; ++i)
+		error = std::max(error, relativeError(&batch[i].x, &transformed[i].x, 3));
+	if (error > 1e-6f)
+	{
+		printf("  transformPoints differs by %g\n", error);
+		ok = false;
+	}
+
+	//boxes, against the box of the 8 transformed corners
+	std::vector<BoundingBox> boxes(num), transformed_boxes(num);
+	for (int i = 0; i < num; ++i)
+		boxes[i] = BoundingBox(points[i], Vector3(1.0f, 2.0f, 3.0f) + points[i + num] * 0.1f);
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		for (int i = 0; i < num; ++i)
+			transformed_boxes[i] = transformBoundingBox(affine[(i + r) % num], boxes[i]);
+	printResult("transformBoundingBox", (double)num * repeat, "boxes", getSeconds() - start);
+	error = 0.0f;
+	for (int i = 0; i < num; ++i)
+	{
+		const BoundingBox& box = boxes[i];
+		const Matrix44& m = affine[(i + repeat - 1) % num];
+		Vector3 min(1e30f, 1e30f, 1e30f), max(-1e30f, -1e30f, -1e30f);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			Vector3 offset(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f);
+			Vector3 p = m * (box.center + Vector3(offset.x * box.halfsize.x, offset.y * box.halfsize.y, offset.z * box.halfsize.z));
+			for (int j = 0; j < 3; ++j)
+			{
+				min.v[j] = std::min(min.v[j], p.v[j]);
+				max.v[j] = std::max(max.v[j], p.v[j]);
+			}
+		}
+		Vector3 center = (min + max) * 0.5f;
+		Vector3 halfsize = (max - min) * 0.5f;
+		error = std::max(error, relativeError(&transformed_boxes[i].center.x, &center.x, 3));
+		error = std::max(error, relativeError(&transformed_boxes[i].halfsize.x, &halfsize.x, 3));
+	}
+	if (error > 1e-5f)
+	{
+		printf("  transformBoundingBox differs by %g\n", error);
+		ok = false;
+	}
+
+	//the batched versions under one matrix, against the single ones
+	start = getSeconds();
+	for (int r = 0; r < repeat; ++r)
+		transformBoundingBoxes(affine[r], &boxes[0], &transformed_boxes[0], num);
+	printResult("transformBoundingBoxes", (double)num * repeat, "boxes", getSeconds() - start);
+	std::vector<Vector4> vectors(num), transformed_vectors(num);
+	for (int i = 0; i < num; ++i)
+		vectors[i] = Vector4(points[i].x, points[i].y, points[i].z, i & 1 ? 0.0f : 1.0f);
+	transformVectors4(last, &vectors[0], &transformed_vectors[0], num);
+	error = 0.0f;
+	for (int i = 0; i < num; ++i)
+	{
+		BoundingBox box = transformBoundingBox(last, boxes[i]);
+		Vector4 v = last * vectors[i];
+		error = std::max(error, relativeError(&transformed_boxes[i].center.x, &box.center.x, 3));
+		error = std::max(error, relativeError(&transformed_boxes[i].halfsize.x, &box.halfsize.x, 3));
+		error = std::max(error, relativeError(&transformed_vectors[i].x, &v.x, 4));
+	}
+	if (error > 1e-6f)
+	{
+		printf("  transformBoundingBoxes or transformVectors4 differ by %g\n", error);
+		ok = false;
+	}
+
+	for (int i = 0; i < num; ++i)
+		sum += result[i].m[i % 16] + transformed_boxes[i].halfsize.x;
+	s_sink = sum;
+	return ok;
+}
+
+// ANIMATION ****************************************
+
+//keyframes of bones that rotate and move smoothly, all the bones of the first sample then the second, ...
+static void buildKeyframes(std::vector<Matrix44>& keyframes, int num_keyframes, int num_bones)
+{
+	Random random(38);
+	std::vector<Vector3> axis(num_bones);
+	std::vector<Vector3> offset(num_bones);
+	random.fillVector3(&axis[0], num_bones, Vector3(1.0f, 1.0f, 1.0f));
+	random.fillVector3(&offset[0], num_bones, Vector3(10.0f, 10.0f, 10.0f));
+	keyframes.resize(num_keyframes * num_bones);
+	for (int k = 0; k < num_keyframes; ++k)
+		for (int i = 0; i < num_bones; ++i)
+		{
+			Vector3 bone_axis = axis[i];
+			bone_axis.normalize();
+			Quaternion q(bone_axis, k * 0.05f + i);
+			Matrix44& m = keyframes[k * num_bones + i];
+			q.toMatrix(m);
+			m.m[12] = offset[i].x + k * 0.1f;
+			m.m[13] = offset[i].y;
+			m.m[14] = offset[i].z;
+		}
+}
+
+//a pose of 128 bones sampled from the TRS tracks against the per element lerp of the matrices it replaced
+static bool benchmarkTracks()
+{
+	const int num_bones = 128;
+	const int num_keyframes = 120;
+	const int num_poses = 100000;
+	std::vector<Matrix44> keyframes;
+	buildKeyframes(keyframes, num_keyframes, num_bones);
+	AnimationTracks tracks;
+	tracks.build(&keyframes[0], num_keyframes, num_bones);
+
+	Matrix44 pose[num_bones];
+	float sum = 0.0f;
+	double start = getSeconds();
+	for (int p = 0; p < num_poses; ++p)
+	{
+		int index = p % (num_keyframes - 1);
+		tracks.sample(index, index + 1, 0.37f, pose);
+		sum += pose[p % num_bones].m[12];
+	}
+	printResult("tracks", (double)num_poses * num_bones, "bone samples", getSeconds() - start);
+
+	start = getSeconds();
+	for (int p = 0; p < num_poses; ++p)
+	{
+		int index = p % (num_keyframes - 1);
+		const Matrix44* k = &keyframes[index * num_bones];
+		const Matrix44* k2 = &keyframes[(index + 1) * num_bones];
+		for (int i = 0; i < num_bones; ++i)
+			for (int j = 0; j < 16; ++j)
+				pose[i].m[j] = lerp(k[i].m[j], k2[i].m[j], 0.37f);
+		sum += pose[p % num_bones].m[12];
+	}
+	printResult("matrix lerp", (double)num_poses * num_bones, "bone samples", getSeconds() - start);
+	s_sink = sum;
+
+	//on the keyframes the tracks must give back the same matrices
+	float max_error = 0.0f;
+	for (int k = 0; k < num_keyframes; ++k)
+	{
+		tracks.sample(k, k, 0.0f, pose);
+		for (int i = 0; i < num_bones; ++i)
+			for (int j = 0; j < 16; ++j)
+				max_error = std::max(max_error, fabsf(pose[i].m[j] - keyframes[k * num_bones + i].m[j]));
+	}
+	if (max_error > 1e-4f)
+	{
+		printf("  tracks differ from the keyframes by %f\n", max_error);
+		return false;
+	}
+	return true;
+}
+
+//a binary tree of bones, the odd ones in the upper body
+static void buildSkeleton(Skeleton& skeleton, int num_bones)
+{
+	skeleton.num_bones = num_bones;
+	for (int i = 0; i < num_bones; ++i)
+	{
+		Skeleton::Bone& bone = skeleton.bones[i];
+		memset(&bone, 0, sizeof(bone));
+		sprintf(bone.name, "bone%d", i);
+		bone.parent = i ? (int8)((i - 1) / 2) : -1;
+		bone.model.setTranslation(0.0f, 10.0f, 0.0f);
+		bone.layer = i % 2 ? UPPER_BODY : LOWER_BODY;
+		if (i)
+			skeleton.bones[bone.parent].children[skeleton.bones[bone.parent].num_children++] = i;
+	}
+	for (int i = 0; i < skeleton.num_bones; ++i)
+		skeleton.bones_by_name[skeleton.bones[i].name] = i;
+	skeleton.computeSignature();
+	skeleton.sortHierarchy();
+}
+
+//an animation of a binary tree of bones, every bone rotates around its own axis
+static void buildAnimation(Animation& anim, int num_bones, int num_keyframes)
+{
+	buildSkeleton(anim.skeleton, num_bones);
+
+	//the last bones keep the pose of the skeleton
+	anim.num_animated_bones = num_bones - num_bones / 8;
+	for (int i = 0; i < anim.num_animated_bones; ++i)
+		anim.bones_map[i] = i;
+	anim.num_keyframes = num_keyframes;
+	anim.samples_per_second = 30.0f;
+	anim.duration = num_keyframes / anim.samples_per_second;
+	std::vector<Matrix44> keyframes;
+	buildKeyframes(keyframes, num_keyframes, anim.num_animated_bones);
+	anim.keyframes = new Matrix44[keyframes.size()];
+	memcpy(anim.keyframes, &keyframes[0], sizeof(Matrix44) * keyframes.size());
+	anim.buildTracks();
+}
+
+//global matrices of a skeleton of 128 bones: the SoA pose, the Skeleton facade (same pass reading the bones)
+//and the scalar product in bone order that it replaced
+static bool benchmarkPose()
+{
+	const int num_bones = 128;
+	const int num_poses = 200000;
+	Skeleton skeleton;
+	buildSkeleton(skeleton, num_bones);
+	std::vector<Matrix44> keyframes;
+	buildKeyframes(keyframes, 1, num_bones);
+	for (int i = 0; i < num_bones; ++i)
+		skeleton.bones[i].model = keyframes[i];
+	SkeletonPose pose;
+	pose.setup(skeleton);
+
+	float sum = 0.0f;
+	double start = getSeconds();
+	for (int p = 0; p < num_poses; ++p)
+	{
+		pose.locals[p % num_bones].m[12] += 0.001f; //so every pass has new input
+		pose.updateGlobalMatrices();
+		sum += pose.globals[num_bones - 1].m[12];
+	}
+	printResult("SkeletonPose", (double)num_poses * num_bones, "bones", getSeconds() - start);
+
+	start = getSeconds();
+	for (int p = 0; p < num_poses; ++p)
+	{
+		skeleton.bones[p % num_bones].model.m[12] += 0.001f;
+		skeleton.updateGlobalMatrices();
+		sum += skeleton.global_bone_matrices[num_bones - 1].m[12];
+	}
+	printResult("Skeleton", (double)num_poses * num_bones, "bones", getSeconds() - start);
+
+	Matrix44 globals[num_bones];
+	start = getSeconds();
+	for (int p = 0; p < num_poses; ++p)
+	{
+		skeleton.bones[p % num_bones].model.m[12] -= 0.001f;
+		for (int i = 0; i < num_bones; ++i) //in this tree the parents come before their children
+		{
+			const Skeleton::Bone& bone = skeleton.bones[i];
+			if (bone.parent < 0)
+			{
+				globals[i] = bone.model;
+				continue;
+			}
+			const float* a = bone.model.m;
+			const float* b = globals[bone.parent].m;
+			for (int r = 0; r < 4; ++r)
+				for (int c = 0; c < 4; ++c)
+					globals[i].m[r * 4 + c] = a[r * 4] * b[c] + a[r * 4 + 1] * b[4 + c] + a[r * 4 + 2] * b[8 + c] + a[r * 4 + 3] * b[12 + c];
+		}
+		sum += globals[num_bones - 1].m[12];
+	}
+	printResult("scalar in bone order", (double)num_poses * num_bones, "bones", getSeconds() - start);
+	s_sink = sum;
+
+	//the three of them from the same locals
+	for (int i = 0; i < num_bones; ++i)
+		pose.locals[i] = skeleton.bones[i].model;
+	pose.updateGlobalMatrices();
+	skeleton.updateGlobalMatrices();
+	float max_error = 0.0f;
+	for (int i = 0; i < num_bones; ++i)
+		for (int j = 0; j < 16; ++j)
+		{
+			float scale = std::max(fabsf(globals[i].m[j]), 1.0f);
+			max_error = std::max(max_error, fabsf(pose.globals[i].m[j] - globals[i].m[j]) / scale);
+			max_error = std::max(max_error, fabsf(skeleton.global_bone_matrices[i].m[j] - globals[i].m[j]) / scale);
+		}
+	if (max_error > 1e-4f)
+	{
+		printf("  global matrices differ by %f\n", max_error);
+		return false;
+	}
+	return true;
+}
+
+//pose, blend and global matrices of crowds of characters of 64 bones, with more threads every time.
+//Half of the agents blend a second animation over the upper body
+static bool benchmarkCrowd()
+{
+	Animation anim, anim_b;
+	buildAnimation(anim, 64, 90);
+	buildAnimation(anim_b, 64, 60);
+
+	bool ok = true;
+	int max_workers = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+	int sizes[] = { 100, 1000, 10000 };
+	for (int s = 0; s < 3; ++s)
+	{
+		int num_agents = sizes[s];
+		std::vector<Skeleton> skeletons(num_agents);
+		for (int workers = 1; ; workers = std::min(workers * 2, max_workers))
+		{
+			ThreadPool threads(workers, 1);
+			CrowdAnimator crowd;
+			crowd.pool = &threads;
+			crowd.lods.clear(); //every agent sampled every frame
+			for (int i = 0; i < num_agents; ++i)
+			{
+				sCrowdAgent& agent = crowd.add();
+				agent.skeleton = &skeletons[i];
+				agent.anim = &anim;
+				agent.time = i * 0.01f;
+				if (i % 2)
+				{
+					agent.anim_b = &anim_b;
+					agent.time_b = i * 0.02f;
+					agent.weight = 0.5f;
+					agent.layers = UPPER_BODY;
+				}
+			}
+
+			int num_frames = std::max(200000 / num_agents, 4);
+			double start = getSeconds();
+			for (int f = 0; f < num_frames; ++f)
+			{
+				for (int i = 0; i < num_agents; ++i)
+				{
+					crowd.agents[i].time += 1.0f / 60.0f;
+					crowd.agents[i].time_b += 1.0f / 60.0f;
+				}
+				crowd.update();
+			}
+			double seconds = getSeconds() - start;
+			char what[64];
+			sprintf(what, "crowd %d agents, %d threads", num_agents, workers + 1);
+			printResult(what, (double)num_frames * num_agents, "agents", seconds);
+
+			//an agent without blend must match the pose of the animation
+			sCrowdAgent& agent = crowd.agents[0];
+			Skeleton pose = anim.skeleton;
+			Matrix44 locals[128];
+			anim.sampleLocal(agent.time, locals, agent.loop);
+			for (int i = 0; i < anim.num_animated_bones; ++i)
+				pose.bones[anim.bones_map[i]].model = locals[i];
+			pose.updateGlobalMatrices();
+			float max_error = 0.0f;
+			for (int i = 0; i < pose.num_bones; ++i)
+				for (int j = 0; j < 16; ++j)
+					max_error = std::max(max_error, fabsf(pose.global_bone_matrices[i].m[j] - agent.skeleton->global_bone_matrices[i].m[j]));
+
+			//the blended bones only rotate, so their axes must keep the length (a lerp of the matrices shrinks them)
+			Skeleton& blended = *crowd.agents[1].skeleton;
+			for (int i = 0; i < blended.num_bones; ++i)
+				for (int j = 0; j < 3; ++j)
+				{
+					const float* axis = blended.bones[i].model.m + j * 4;
+					max_error = std::max(max_error, fabsf(sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]) - 1.0f));
+				}
+			if (max_error > 1e-3f)
+			{
+				printf("  crowd poses differ by %f\n", max_error);
+				ok = false;
+			}
+
+			if (workers == max_workers)
+				break;
+		}
+	}
+	return ok;
+}
+
+//a plane of 263169 vertices with 4 random bones each, in parallel and in one thread, checked against the scalar blend
+static bool benchmarkSkinning()
+{
+	const int num_bones = 64;
+	const int num_frames = 20;
+	Mesh mesh;
+	mesh.createSubdividedPlane(100.0f, 512, true);
+	int num_vertices = mesh.getNumVertices();
+
+	Random random(43);
+	mesh.bones.resize(num_vertices);
+	mesh.weights.resize(num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		float w[4];
+		random.fillFloats(w, 4, 0.1f, 1.0f);
+		float total = w[0] + w[1] + w[2] + w[3];
+		mesh.bones[i].set(random.nextInt(num_bones), random.nextInt(num_bones), random.nextInt(num_bones), random.nextInt(num_bones));
+		mesh.weights[i].set(w[0] / total, w[1] / total, w[2] / total, w[3] / total);
+	}
+
+	std::vector<Matrix44> keyframes;
+	buildKeyframes(keyframes, num_frames, num_bones);
+	std::vector<sSkinnedVertex> skinned(num_vertices);
+
+	float sum = 0.0f;
+	double start = getSeconds();
+	for (int f = 0; f < num_frames; ++f)
+	{
+		skinVertices(&mesh, &keyframes[f * num_bones], num_bones, &skinned[0]);
+		sum += skinned[f].position.x;
+	}
+	printResult("skinning, all the threads", (double)num_frames * num_vertices, "vertices", getSeconds() - start);
+
+	start = getSeconds();
+	for (int f = 0; f < num_frames; ++f)
+	{
+		skinVertices(&mesh, &keyframes[f * num_bones], num_bones, &skinned[0], 0, num_vertices);
+		sum += skinned[f].position.x;
+	}
+	printResult("skinning, one thread", (double)num_frames * num_vertices, "vertices", getSeconds() - start);
+	s_sink = sum;
+
+	//the last frame against the weighted sum of the matrices
+	const Matrix44* palette = &keyframes[(num_frames - 1) * num_bones];
+	float max_error = 0.0f;
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		Matrix44 m;
+		memset(m.m, 0, sizeof(m.m));
+		for (int k = 0; k < 4; ++k)
+			for (int j = 0; j < 16; ++j)
+				m.m[j] += palette[mesh.bones[i].v[k]].m[j] * mesh.weights[i].v[k];
+		Vector3 position = mesh.interleaved.size() ? mesh.interleaved[i].vertex : mesh.vertices[i];
+		Vector3 normal = mesh.interleaved.size() ? mesh.interleaved[i].normal : mesh.normals[i];
+		position = m * position;
+		normal = m.rotateVector(normal);
+		max_error = std::max(max_error, (float)((position - skinned[i].position).length() / std::max((float)position.length(), 1.0f)));
+		max_error = std::max(max_error, (float)(normal - skinned[i].normal).length());
+	}
+	if (max_error > 1e-4f)
+	{
+		printf("  skinned vertices differ by %f\n", max_error);
+		return false;
+	}
+	return true;
+}
+
+// ****************************************
+
+struct sBenchmark {
+	const char* name;
+	BenchmarkFunc func;
+};
+
+static sBenchmark benchmarks[] = {
+	{ "rays", benchmarkRays },
+	{ "parse", benchmarkParse },
+	{ "matrix", benchmarkMatrix },
+	{ "tracks", benchmarkTracks },
+	{ "pose", benchmarkPose },
+	{ "crowd", benchmarkCrowd },
+	{ "skinning", benchmarkSkinning },
+};
+
+int runBenchmarks(const char* name)
+{
+	int failed = 0;
+	int num_run = 0;
+	printf("Benchmarks (%d worker threads)\n", ThreadPool::Get()->getNumThreads());
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(sBenchmark); ++i)
+	{
+		if (name && strcmp(name, benchmarks[i].name) != 0)
+			continue;
+		printf("%s\n", benchmarks[i].name);
+		if (!benchmarks[i].func())
+		{
+			printf("  FAILED\n");
+			++failed;
+		}
+		++num_run;
+	}
+	if (!num_run)
+	{
+		printf("Unknown benchmark: %s\n", name);
+		return 1;
+	}
+	return failed;
+}
@@ -0,0 +1,12 @@
+/*  Micro-benchmarks and tolerance checks that run without a window or a GL context.
+	Launch the application with --benchmark [name] to run all of them or only one, every benchmark
+	prints its throughput and the checks compare the fast paths against the plain code.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+//runs the benchmark with that name (NULL runs all), returns the number of them that failed their checks
+int runBenchmarks(const char* name = NULL);
+
+#endif
@@ -0,0 +1,191 @@
+#include "blendtree.h"
+#include "animation.h"
+
+#include <cassert>
+#include <cstring>
+
+//weighted sums of one bone
+struct sBlendAccum {
+	float rotation[4];
+	float translation[3];
+	float scale[3];
+	float total; //of the weights, 0 if no input affects the bone
+};
+
+//adds weight * bone to acc, the first one sets the hemisphere of the rotations
+static inline void accumulateTRS(sBlendAccum& acc, const sBoneTRS& bone, float weight)
+{
+	const float* q = bone.rotation.q;
+	float rotation_weight = weight;
+	if (acc.total > 0.0f && acc.rotation[0] * q[0] + acc.rotation[1] * q[1] + acc.rotation[2] * q[2] + acc.rotation[3] * q[3] < 0.0f)
+		rotation_weight = -weight; //q and -q are the same rotation
+	for (int j = 0; j < 4; ++j)
+		acc.rotation[j] += q[j] * rotation_weight;
+	for (int j = 0; j < 3; ++j)
+	{
+		acc.translation[j] += bone.translation.v[j] * weight;
+		acc.scale[j] += bone.scale.v[j] * weight;
+	}
+	acc.total += weight;
+}
+
+//weighted average of the sums of a bone
+static inline void writeBone(const sBlendAccum& bone, Matrix44& local)
+{
+	float inv = 1.0f / bone.total;
+	sBoneTRS result;
+	result.rotation.set(bone.rotation[0], bone.rotation[1], bone.rotation[2], bone.rotation[3]);
+	float length = result.rotation.length();
+	if (length > 0.0f)
+		result.rotation *= 1.0f / length;
+	else
+		result.rotation.set(0.0f, 0.0f, 0.0f, 1.0f); //only if the inputs cancel out exactly
+	result.translation.set(bone.translation[0] * inv, bone.translation[1] * inv, bone.translation[2] * inv);
+	result.scale.set(bone.scale[0] * inv, bone.scale[1] * inv, bone.scale[2] * inv);
+	result.toMatrix(local);
+}
+
+static inline bool affectsBone(const sBlendInput& input, const Skeleton& skeleton, int bone)
+{
+	return input.layers == 0xFF || (skeleton.bones[bone].layer & input.layers);
+}
+
+//the usual case: every input is stored as tracks with the same animated bones, so the animated bones are summed
+//in the lanes of the tracks four at a time (AnimationTracks::accumulateTRS) and only the rest go one by one.
+//Returns false if the inputs do not allow it
+static bool blendTracks(const sBlendInput* inputs, int num_inputs, Matrix44* locals, size_t local_stride, int num_bones)
+{
+	const Animation* first = NULL;
+	for (int i = 0; i < num_inputs; ++i)
+	{
+		const Animation* anim = inputs[i].anim;
+		if (!anim || inputs[i].weight <= 0.0f)
+			continue;
+		if (!anim->tracks)
+			return false;
+		if (!first)
+			first = anim;
+		else if (anim->num_animated_bones != first->num_animated_bones || memcmp(anim->bones_map, first->bones_map, first->num_animated_bones) != 0)
+			return false;
+	}
+	if (!first)
+		return true;
+
+	const int8* bones_map = first->bones_map;
+	int num_animated = first->num_animated_bones;
+	int num_lanes = first->tracks->num_lanes;
+	bool animated[128];
+	memset(animated, 0, sizeof(animated));
+	for (int i = 0; i < num_animated; ++i)
+		animated[bones_map[i]] = true;
+
+	float acc[(AnimationTracks::NUM_STREAMS + 1) * 128];
+	memset(acc, 0, sizeof(float) * (AnimationTracks::NUM_STREAMS + 1) * num_lanes);
+	sBlendAccum rest[128];
+	memset(rest, 0, sizeof(sBlendAccum) * num_bones);
+
+	float weights[128];
+	for (int i = num_animated; i < num_lanes; ++i)
+		weights[i] = 0.0f; //padding lanes
+	for (int i = 0; i < num_inputs; ++i)
+	{
+		const sBlendInput& input = inputs[i];
+		const Animation* anim = input.anim;
+		if (!anim || input.weight <= 0.0f)
+			continue;
+		const Skeleton& skeleton = anim->skeleton;
+		assert(skeleton.num_bones == num_bones && "blended animations must use the same skeleton");
+
+		for (int l = 0; l < num_animated; ++l)
+			weights[l] = affectsBone(input, skeleton, bones_map[l]) ? input.weight : 0.0f;
+		int index, index2;
+		float f;
+		anim->getSamplePosition(input.time, input.loop, index, index2, f);
+		anim->tracks->accumulateTRS(index, index2, f, weights, acc);
+
+		//bones that are not animated contribute the pose of the skeleton of the animation (like blendSkeleton)
+		for (int b = 0; b < num_bones; ++b)
+		{
+			if (animated[b] || !affectsBone(input, skeleton, b))
+				continue;
+			sBoneTRS bone;
+			anim->getRestBone(b, bone);
+			accumulateTRS(rest[b], bone, input.weight);
+		}
+	}
+
+	for (int l = 0; l < num_animated; ++l)
+	{
+		sBlendAccum bone;
+		for (int j = 0; j < 4; ++j)
+			bone.rotation[j] = acc[(AnimationTracks::QX + j) * num_lanes + l];
+		for (int j = 0; j < 3; ++j)
+		{
+			bone.translation[j] = acc[(AnimationTracks::TX + j) * num_lanes + l];
+			bone.scale[j] = acc[(AnimationTracks::SX + j) * num_lanes + l];
+		}
+		bone.total = acc[AnimationTracks::NUM_STREAMS * num_lanes + l];
+		if (bone.total > 0.0f)
+			writeBone(bone, *(Matrix44*)((char*)locals + bones_map[l] * local_stride));
+	}
+	for (int b = 0; b < num_bones; ++b)
+		if (!animated[b] && rest[b].total > 0.0f)
+			writeBone(rest[b], *(Matrix44*)((char*)locals + b * local_stride));
+	return true;
+}
+
+void blendAnimations(const sBlendInput* inputs, int num_inputs, Matrix44* locals, size_t local_stride, int num_bones)
+{
+	assert(num_bones > 0 && num_bones <= 128);
+
+	if (blendTracks(inputs, num_inputs, locals, local_stride, num_bones))
+		return;
+
+	//any other mix of inputs goes bone by bone
+	sBlendAccum acc[128];
+	memset(acc, 0, sizeof(sBlendAccum) * num_bones);
+
+	sBoneTRS sample[128];
+	for (int i = 0; i < num_inputs; ++i)
+	{
+		const sBlendInput& input = inputs[i];
+		const Animation* anim = input.anim;
+		if (!anim || input.weight <= 0.0f)
+			continue;
+		const Skeleton& skeleton = anim->skeleton;
+		assert(skeleton.num_bones == num_bones && "blended animations must use the same skeleton");
+
+		//bones that are not animated contribute the pose of the skeleton of the animation (like blendSkeleton)
+		anim->sampleBonesTRS(input.time, sample, input.loop);
+		for (int b = 0; b < num_bones; ++b)
+			if (affectsBone(input, skeleton, b))
+				accumulateTRS(acc[b], sample[b], input.weight);
+	}
+
+	for (int b = 0; b < num_bones; ++b)
+		if (acc[b].total > 0.0f)
+			writeBone(acc[b], *(Matrix44*)((char*)locals + b * local_stride));
+}
+
+void BlendTree::add(const Animation* anim, float time, float weight, uint8 layers, bool loop)
+{
+	sBlendInput input;
+	input.anim = anim;
+	input.time = time;
+	input.weight = weight;
+	input.layers = layers;
+	input.loop = loop;
+	inputs.push_back(input);
+}
+
+void BlendTree::evaluate(SkeletonPose& pose) const
+{
+	if (inputs.size())
+		blendAnimations(&inputs[0], (int)inputs.size(), pose.locals, sizeof(Matrix44), pose.num_bones);
+}
+
+void BlendTree::evaluate(Skeleton& skeleton) const
+{
+	if (inputs.size())
+		blendAnimations(&inputs[0], (int)inputs.size(), &skeleton.bones[0].model, sizeof(Skeleton::Bone), skeleton.num_bones);
+}
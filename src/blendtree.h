@@ -0,0 +1,46 @@
+/*  Blend of any number of animations evaluated straight into a pose.
+	Every input is a clip sampled at its own time, with a weight and the layers it affects (BODY_LAYERS), and
+	every bone ends with the weighted average of the inputs that affect it, bones that no input affects keep
+	their pose. A tree of blends becomes a flat list multiplying the weights along its branches.
+	The inputs are sampled as rotation, translation and scale and accumulated in a buffer on the stack (the rotations
+	in the hemisphere of the first input that affects the bone, then normalized, so nothing is sheared), and the
+	matrices are built once at the end, no Skeleton is copied. When every input is stored as AnimationTracks with
+	the same animated bones the sums are made with SSE over the streams of the tracks, four bones at a time, and
+	the bones that are not animated take the rest pose cached in the Animation.
+*/
+
+#ifndef BLENDTREE_H
+#define BLENDTREE_H
+
+#include <vector>
+#include "framework.h"
+
+class Animation;
+class Skeleton;
+class SkeletonPose;
+
+struct sBlendInput {
+	const Animation* anim;
+	float time;
+	float weight; //relative to the other inputs that affect the same bone, 0 is skipped
+	uint8 layers; //bones affected, 0xFF all
+	bool loop;
+};
+
+//all the inputs must use the same skeleton, locals are local_stride bytes apart (to write them in other structs)
+void blendAnimations(const sBlendInput* inputs, int num_inputs, Matrix44* locals, size_t local_stride, int num_bones);
+
+class BlendTree
+{
+public:
+	std::vector<sBlendInput> inputs;
+
+	void clear() { inputs.clear(); }
+	void add(const Animation* anim, float time, float weight, uint8 layers = 0xFF, bool loop = true);
+
+	//local matrices only, update the global ones after
+	void evaluate(SkeletonPose& pose) const;
+	void evaluate(Skeleton& skeleton) const;
+};
+
+#endif
@@ -0,0 +1,906 @@
+#include "bvh.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+
+#ifdef FRAMEWORK_USE_SSE
+	#define BVH_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+#define BVH_NUM_BINS 12
+#define BVH_MAX_DEPTH 64 //size of the traversal stacks, the build never goes deeper
+#define BVH_MEDIAN_SPLIT_DEPTH (BVH_MAX_DEPTH - 32) //from here nodes are split in halves, 2^32 triangles fit in the remaining levels
+#define BVH_FAR 1e30f
+
+BVH::BVH()
+{
+	num_triangles = 0;
+	source_hash = 0;
+}
+
+void BVH::clear()
+{
+	nodes.clear();
+	packets.clear();
+	tri_location.clear();
+	num_triangles = 0;
+	source_hash = 0;
+}
+
+unsigned int BVH::hashVertices(const std::vector<Vector3>& vertices)
+{
+	//FNV-1a of the bits of every coordinate, a word at a time
+	unsigned int hash = 2166136261u;
+	const unsigned int* words = vertices.size() ? (const unsigned int*)&vertices[0] : NULL;
+	size_t num = vertices.size() * 3;
+	for (size_t i = 0; i < num; ++i)
+		hash = (hash ^ words[i]) * 16777619u;
+	return (hash ^ (unsigned int)vertices.size()) * 16777619u;
+}
+
+// BUILD *********************************
+
+struct sBinBounds {
+	float min[3];
+	float max[3];
+	void reset() { min[0] = min[1] = min[2] = BVH_FAR; max[0] = max[1] = max[2] = -BVH_FAR; }
+	void grow(const float* v) { for (int i = 0; i < 3; ++i) { min[i] = v[i] < min[i] ? v[i] : min[i]; max[i] = v[i] > max[i] ? v[i] : max[i]; } }
+	void grow(const sBinBounds& b) { for (int i = 0; i < 3; ++i) { min[i] = b.min[i] < min[i] ? b.min[i] : min[i]; max[i] = b.max[i] > max[i] ? b.max[i] : max[i]; } }
+	float area() const { float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2]; if (x < 0.0f) return 0.0f; return x * y + y * z + z * x; }
+};
+
+void BVH::build(const std::vector<Vector3>& vertices)
+{
+	clear();
+	num_triangles = vertices.size() / 3;
+	source_hash = hashVertices(vertices);
+	if (!num_triangles)
+		return;
+
+	//precompute the bounds and centroids of every triangle
+	std::vector<sBinBounds> tri_bounds(num_triangles);
+	std::vector<Vector3> centroids(num_triangles);
+	std::vector<unsigned int> tri_index(num_triangles);
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		const Vector3* v = &vertices[i * 3];
+		tri_bounds[i].reset();
+		tri_bounds[i].grow(v[0].v);
+		tri_bounds[i].grow(v[1].v);
+		tri_bounds[i].grow(v[2].v);
+		centroids[i] = (v[0] + v[1] + v[2]) * (1.0f / 3.0f);
+		tri_index[i] = i;
+	}
+
+	//while building, leafs use left_first as the first index in tri_index
+	nodes.reserve(num_triangles * 2);
+	Node root;
+	root.left_first = 0;
+	root.count = num_triangles;
+	nodes.push_back(root);
+
+	std::vector< std::pair<unsigned int, int> > pending; //node and depth
+	pending.push_back(std::make_pair(0u, 0));
+
+	while (pending.size())
+	{
+		unsigned int node_index = pending.back().first;
+		int depth = pending.back().second;
+		pending.pop_back();
+
+		unsigned int first = nodes[node_index].left_first;
+		unsigned int count = nodes[node_index].count;
+
+		//bounds of the node and of the centroids
+		sBinBounds bounds, centroid_bounds;
+		bounds.reset();
+		centroid_bounds.reset();
+		for (unsigned int i = first; i < first + count; ++i)
+		{
+			bounds.grow(tri_bounds[tri_index[i]]);
+			centroid_bounds.grow(centroids[tri_index[i]].v);
+		}
+		memcpy(nodes[node_index].bb_min, bounds.min, sizeof(float) * 3);
+		memcpy(nodes[node_index].bb_max, bounds.max, sizeof(float) * 3);
+
+		//a packet tests four triangles at the cost of one, so there is no point in splitting further
+		if (count <= BVH_LEAF_SIZE)
+			continue; //leaf
+
+		//degenerated geometry can make the SAH split one triangle at a time, deep nodes are split
+		//by the median centroid so the depth stays under BVH_MAX_DEPTH
+		if (depth >= BVH_MEDIAN_SPLIT_DEPTH)
+		{
+			int axis = 0;
+			for (int i = 1; i < 3; ++i)
+				if (centroid_bounds.max[i] - centroid_bounds.min[i] > centroid_bounds.max[axis] - centroid_bounds.min[axis])
+					axis = i;
+			unsigned int* indices = &tri_index[0];
+			std::nth_element(indices + first, indices + first + count / 2, indices + first + count, [&](unsigned int a, unsigned int b) {
+				return centroids[a].v[axis] < centroids[b].v[axis];
+			});
+		}
+
+		//find the best split using binned SAH
+		int best_axis = -1;
+		int best_bin = 0;
+		float best_cost = BVH_FAR;
+		for (int axis = 0; axis < 3 && depth < BVH_MEDIAN_SPLIT_DEPTH; ++axis)
+		{
+			float cmin = centroid_bounds.min[axis];
+			float extent = centroid_bounds.max[axis] - cmin;
+			if (extent <= 0.0f)
+				continue;
+
+			sBinBounds bins[BVH_NUM_BINS];
+			unsigned int bin_count[BVH_NUM_BINS];
+			for (int b = 0; b < BVH_NUM_BINS; ++b)
+			{
+				bins[b].reset();
+				bin_count[b] = 0;
+			}
+
+			float scale = BVH_NUM_BINS / extent;
+			for (unsigned int i = first; i < first + count; ++i)
+			{
+				unsigned int tri = tri_index[i];
+				int b = (int)((centroids[tri].v[axis] - cmin) * scale);
+				if (b >= BVH_NUM_BINS)
+					b = BVH_NUM_BINS - 1;
+				bins[b].grow(tri_bounds[tri]);
+				bin_count[b]++;
+			}
+
+			//sweep from both sides to get the cost of every plane between bins
+			float left_area[BVH_NUM_BINS - 1], right_area[BVH_NUM_BINS - 1];
+			unsigned int left_count[BVH_NUM_BINS - 1], right_count[BVH_NUM_BINS - 1];
+			sBinBounds left_box, right_box;
+			left_box.reset();
+			right_box.reset();
+			unsigned int left_sum = 0, right_sum = 0;
+			for (int b = 0; b < BVH_NUM_BINS - 1; ++b)
+			{
+				left_sum += bin_count[b];
+				left_count[b] = left_sum;
+				left_box.grow(bins[b]);
+				left_area[b] = left_box.area();
+
+				right_sum += bin_count[BVH_NUM_BINS - 1 - b];
+				right_count[BVH_NUM_BINS - 2 - b] = right_sum;
+				right_box.grow(bins[BVH_NUM_BINS - 1 - b]);
+				right_area[BVH_NUM_BINS - 2 - b] = right_box.area();
+			}
+
+			for (int b = 0; b < BVH_NUM_BINS - 1; ++b)
+			{
+				if (!left_count[b] || !right_count[b])
+					continue;
+				float cost = left_count[b] * left_area[b] + right_count[b] * right_area[b];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+
+		//partition the triangles
+		unsigned int left_count = 0;
+		if (best_axis != -1)
+		{
+			float cmin = centroid_bounds.min[best_axis];
+			float scale = BVH_NUM_BINS / (centroid_bounds.max[best_axis] - cmin);
+			int i = first;
+			int j = first + count - 1;
+			while (i <= j)
+			{
+				int b = (int)((centroids[tri_index[i]].v[best_axis] - cmin) * scale);
+				if (b >= BVH_NUM_BINS)
+					b = BVH_NUM_BINS - 1;
+				if (b <= best_bin)
+					i++;
+				else
+					std::swap(tri_index[i], tri_index[j--]);
+			}
+			left_count = i - first;
+		}
+
+		//all centroids in the same spot (or too deep), split by half
+		if (left_count == 0 || left_count == count)
+			left_count = count / 2;
+
+		Node left, right;
+		left.left_first = first;
+		left.count = left_count;
+		right.left_first = first + left_count;
+		right.count = count - left_count;
+
+		unsigned int left_index = nodes.size();
+		nodes.push_back(left);
+		nodes.push_back(right);
+		nodes[node_index].left_first = left_index;
+		nodes[node_index].count = 0;
+
+		pending.push_back(std::make_pair(left_index, depth + 1));
+		pending.push_back(std::make_pair(left_index + 1, depth + 1));
+	}
+
+	//pack the triangles of every leaf in SoA
+	tri_location.resize(num_triangles);
+	packets.reserve((nodes.size() + 1) / 2);
+	for (unsigned int i = 0; i < nodes.size(); ++i)
+	{
+		Node& node = nodes[i];
+		if (!node.count)
+			continue;
+
+		TriPacket packet;
+		memset(&packet, 0, sizeof(packet));
+		for (int k = 0; k < 4; ++k)
+			packet.id[k] = -1;
+
+		for (unsigned int k = 0; k < node.count; ++k)
+		{
+			unsigned int tri = tri_index[node.left_first + k];
+			const Vector3* v = &vertices[tri * 3];
+			Vector3 e1 = v[1] - v[0];
+			Vector3 e2 = v[2] - v[0];
+			for (int c = 0; c < 3; ++c)
+			{
+				packet.v0[c][k] = v[0].v[c];
+				packet.e1[c][k] = e1.v[c];
+				packet.e2[c][k] = e2.v[c];
+			}
+			packet.id[k] = tri;
+			tri_location[tri] = packets.size() * 4 + k;
+		}
+
+		node.left_first = packets.size();
+		packets.push_back(packet);
+	}
+
+	nodes.shrink_to_fit();
+}
+
+void BVH::getTriangle(int id, Vector3& v0, Vector3& v1, Vector3& v2) const
+{
+	assert(id >= 0 && id < (int)num_triangles);
+	unsigned int location = tri_location[id];
+	const TriPacket& packet = packets[location / 4];
+	int k = location % 4;
+	v0.set(packet.v0[0][k], packet.v0[1][k], packet.v0[2][k]);
+	v1 = v0 + Vector3(packet.e1[0][k], packet.e1[1][k], packet.e1[2][k]);
+	v2 = v0 + Vector3(packet.e2[0][k], packet.e2[1][k], packet.e2[2][k]);
+}
+
+// RAY *********************************
+
+#ifdef BVH_USE_SSE
+
+static inline float hmax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float hmin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+//returns the distance to the box or BVH_FAR if missed. The fourth lane of the node (left_first/count) is masked out
+static inline float intersectNode(const BVH::Node& node, __m128 origin, __m128 inv_dir, __m128 xyz_mask, float max_t)
+{
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bb_min), origin), inv_dir);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bb_max), origin), inv_dir);
+	__m128 vmin = _mm_min_ps(t1, t2);
+	__m128 vmax = _mm_max_ps(t1, t2);
+	vmin = _mm_and_ps(vmin, xyz_mask); //fourth lane becomes 0, the start of the ray
+	vmax = _mm_or_ps(_mm_and_ps(vmax, xyz_mask), _mm_andnot_ps(xyz_mask, _mm_set1_ps(max_t)));
+	float tnear = hmax(vmin);
+	float tfar = hmin(vmax);
+	return tnear <= tfar ? tnear : BVH_FAR;
+}
+
+//tests the ray against the four triangles of the packet, updates max_t and returns the slot or -1
+static inline int intersectPacket(const BVH::TriPacket& p, const __m128* o, const __m128* d, float& max_t)
+{
+	__m128 e1x = _mm_loadu_ps(p.e1[0]), e1y = _mm_loadu_ps(p.e1[1]), e1z = _mm_loadu_ps(p.e1[2]);
+	__m128 e2x = _mm_loadu_ps(p.e2[0]), e2y = _mm_loadu_ps(p.e2[1]), e2z = _mm_loadu_ps(p.e2[2]);
+
+	//Moller-Trumbore
+	__m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 tx = _mm_sub_ps(o[0], _mm_loadu_ps(p.v0[0]));
+	__m128 ty = _mm_sub_ps(o[1], _mm_loadu_ps(p.v0[1]));
+	__m128 tz = _mm_sub_ps(o[2], _mm_loadu_ps(p.v0[2]));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv_det);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_cmpneq_ps(det, zero);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(max_t)));
+	if (!_mm_movemask_ps(mask))
+		return -1;
+
+	float ts[4];
+	_mm_storeu_ps(ts, _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, _mm_set1_ps(BVH_FAR))));
+	int slot = -1;
+	for (int k = 0; k < 4; ++k)
+		if (ts[k] < max_t || (slot == -1 && ts[k] <= max_t))
+		{
+			max_t = ts[k];
+			slot = k;
+		}
+	return slot;
+}
+
+#else
+
+static inline float intersectNode(const BVH::Node& node, const Vector3& origin, const Vector3& inv_dir, float max_t)
+{
+	float tnear = 0.0f;
+	float tfar = max_t;
+	for (int i = 0; i < 3; ++i)
+	{
+		float t1 = (node.bb_min[i] - origin.v[i]) * inv_dir.v[i];
+		float t2 = (node.bb_max[i] - origin.v[i]) * inv_dir.v[i];
+		tnear = fmax(tnear, fmin(t1, t2));
+		tfar = fmin(tfar, fmax(t1, t2));
+	}
+	return tnear <= tfar ? tnear : BVH_FAR;
+}
+
+static inline int intersectPacket(const BVH::TriPacket& p, const Vector3& o, const Vector3& d, float& max_t)
+{
+	int slot = -1;
+	for (int k = 0; k < 4; ++k)
+	{
+		if (p.id[k] == -1)
+			break;
+		Vector3 e1(p.e1[0][k], p.e1[1][k], p.e1[2][k]);
+		Vector3 e2(p.e2[0][k], p.e2[1][k], p.e2[2][k]);
+		Vector3 pvec = d.cross(e2);
+		float det = e1.dot(pvec);
+		if (det == 0.0f)
+			continue;
+		float inv_det = 1.0f / det;
+		Vector3 tvec = o - Vector3(p.v0[0][k], p.v0[1][k], p.v0[2][k]);
+		float u = tvec.dot(pvec) * inv_det;
+		if (u < 0.0f || u > 1.0f)
+			continue;
+		Vector3 qvec = tvec.cross(e1);
+		float v = d.dot(qvec) * inv_det;
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+		float t = e2.dot(qvec) * inv_det;
+		if (t <= 0.0f || t > max_t)
+			continue;
+		max_t = t;
+		slot = k;
+	}
+	return slot;
+}
+
+#endif
+
+int BVH::testRay(const Vector3& origin, const Vector3& direction, float max_t, float& t) const
+{
+	if (nodes.empty())
+		return -1;
+
+	//avoid infinities (and NaNs when multiplied by 0) in the slab test
+	Vector3 dir = direction;
+	for (int i = 0; i < 3; ++i)
+		if (fabs(dir.v[i]) < 1e-20f)
+			dir.v[i] = dir.v[i] < 0.0f ? -1e-20f : 1e-20f;
+	Vector3 inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+
+#ifdef BVH_USE_SSE
+	__m128 o4 = _mm_setr_ps(origin.x, origin.y, origin.z, 0.0f);
+	__m128 rd4 = _mm_setr_ps(inv_dir.x, inv_dir.y, inv_dir.z, 0.0f);
+	__m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128 o[3] = { _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z) };
+	__m128 d[3] = { _mm_set1_ps(direction.x), _mm_set1_ps(direction.y), _mm_set1_ps(direction.z) };
+	#define NODE_TEST(n) intersectNode(n, o4, rd4, xyz_mask, max_t)
+	#define PACKET_TEST(p) intersectPacket(p, o, d, max_t)
+#else
+	#define NODE_TEST(n) intersectNode(n, origin, inv_dir, max_t)
+	#define PACKET_TEST(p) intersectPacket(p, origin, direction, max_t)
+#endif
+
+	int hit = -1;
+	if (NODE_TEST(nodes[0]) == BVH_FAR)
+		return -1;
+
+	const Node* stack[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	const Node* node = &nodes[0];
+
+	while (true)
+	{
+		if (node->count) //leaf
+		{
+			const TriPacket& packet = packets[node->left_first];
+			int slot = PACKET_TEST(packet);
+			if (slot != -1)
+				hit = packet.id[slot];
+			if (!stack_size)
+				break;
+			node = stack[--stack_size];
+			continue;
+		}
+
+		//visit the closest child first and keep the other for later
+		const Node* child1 = &nodes[node->left_first];
+		const Node* child2 = child1 + 1;
+		float dist1 = NODE_TEST(*child1);
+		float dist2 = NODE_TEST(*child2);
+		if (dist1 > dist2)
+		{
+			std::swap(dist1, dist2);
+			std::swap(child1, child2);
+		}
+
+		if (dist1 == BVH_FAR)
+		{
+			if (!stack_size)
+				break;
+			node = stack[--stack_size];
+			continue;
+		}
+
+		node = child1;
+		if (dist2 != BVH_FAR)
+		{
+			assert(stack_size < BVH_MAX_DEPTH);
+			stack[stack_size++] = child2;
+		}
+	}
+
+	#undef NODE_TEST
+	#undef PACKET_TEST
+
+	if (hit != -1)
+		t = max_t;
+	return hit;
+}
+
+#ifdef BVH_USE_SSE
+
+//tests a node against four rays, returns the mask of the rays that hit and their entry distance
+static inline __m128 intersectNode4(const BVH::Node& node, const __m128* o, const __m128* inv_dir, __m128 max_t, __m128& tnear)
+{
+	__m128 tmin = _mm_setzero_ps();
+	__m128 tmax = max_t;
+	for (int i = 0; i < 3; ++i)
+	{
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bb_min[i]), o[i]), inv_dir[i]);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bb_max[i]), o[i]), inv_dir[i]);
+		tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+		tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+	}
+	__m128 mask = _mm_cmple_ps(tmin, tmax);
+	tnear = _mm_or_ps(_mm_and_ps(mask, tmin), _mm_andnot_ps(mask, _mm_set1_ps(BVH_FAR)));
+	return mask;
+}
+
+//tests one triangle of the packet against four rays, updates max_t and the hit triangles
+static inline void intersectTriangle4(const BVH::TriPacket& p, int k, const __m128* o, const __m128* d, __m128& max_t, int* hits)
+{
+	__m128 e1x = _mm_set1_ps(p.e1[0][k]), e1y = _mm_set1_ps(p.e1[1][k]), e1z = _mm_set1_ps(p.e1[2][k]);
+	__m128 e2x = _mm_set1_ps(p.e2[0][k]), e2y = _mm_set1_ps(p.e2[1][k]), e2z = _mm_set1_ps(p.e2[2][k]);
+
+	__m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 tx = _mm_sub_ps(o[0], _mm_set1_ps(p.v0[0][k]));
+	__m128 ty = _mm_sub_ps(o[1], _mm_set1_ps(p.v0[1][k]));
+	__m128 tz = _mm_sub_ps(o[2], _mm_set1_ps(p.v0[2][k]));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv_det);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_cmpneq_ps(det, zero);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(t, max_t));
+	int bits = _mm_movemask_ps(mask);
+	if (!bits)
+		return;
+
+	max_t = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, max_t));
+	for (int i = 0; i < 4; ++i)
+		if (bits & (1 << i))
+			hits[i] = p.id[k];
+}
+
+#endif
+
+void BVH::testRay4(const float origin[3][4], const float direction[3][4], float max_t[4], int triangles[4]) const
+{
+	triangles[0] = triangles[1] = triangles[2] = triangles[3] = -1;
+
+#ifdef BVH_USE_SSE
+	if (nodes.empty())
+		return;
+
+	__m128 o[3], d[3], inv_dir[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		o[i] = _mm_loadu_ps(origin[i]);
+		d[i] = _mm_loadu_ps(direction[i]);
+		//avoid infinities (and NaNs when multiplied by 0) in the slab test
+		__m128 sign = _mm_and_ps(d[i], _mm_set1_ps(-0.0f));
+		__m128 abs_d = _mm_max_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), d[i]), _mm_set1_ps(1e-20f));
+		inv_dir[i] = _mm_div_ps(_mm_set1_ps(1.0f), _mm_or_ps(abs_d, sign));
+	}
+	__m128 tmax = _mm_loadu_ps(max_t);
+
+	__m128 tnear;
+	if (!_mm_movemask_ps(intersectNode4(nodes[0], o, inv_dir, tmax, tnear)))
+		return;
+
+	const Node* stack[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	const Node* node = &nodes[0];
+
+	while (true)
+	{
+		if (node->count) //leaf
+		{
+			const TriPacket& packet = packets[node->left_first];
+			for (unsigned int k = 0; k < node->count; ++k)
+				intersectTriangle4(packet, k, o, d, tmax, triangles);
+			if (!stack_size)
+				break;
+			node = stack[--stack_size];
+			continue;
+		}
+
+		//the rays visit the children in the order of the closest entry of any of them
+		const Node* child1 = &nodes[node->left_first];
+		const Node* child2 = child1 + 1;
+		__m128 tnear1, tnear2;
+		bool hit1 = _mm_movemask_ps(intersectNode4(*child1, o, inv_dir, tmax, tnear1)) != 0;
+		bool hit2 = _mm_movemask_ps(intersectNode4(*child2, o, inv_dir, tmax, tnear2)) != 0;
+
+		if (hit1 && hit2)
+		{
+			if (hmin(tnear2) < hmin(tnear1))
+				std::swap(child1, child2);
+			assert(stack_size < BVH_MAX_DEPTH);
+			stack[stack_size++] = child2;
+			node = child1;
+		}
+		else if (hit1)
+			node = child1;
+		else if (hit2)
+			node = child2;
+		else
+		{
+			if (!stack_size)
+				break;
+			node = stack[--stack_size];
+		}
+	}
+
+	_mm_storeu_ps(max_t, tmax);
+#else
+	for (int i = 0; i < 4; ++i)
+	{
+		float t = 0.0f;
+		triangles[i] = testRay(Vector3(origin[0][i], origin[1][i], origin[2][i]), Vector3(direction[0][i], direction[1][i], direction[2][i]), max_t[i], t);
+		if (triangles[i] != -1)
+			max_t[i] = t;
+	}
+#endif
+}
+
+// SPHERE *********************************
+
+static inline bool sphereOverlapsNode(const BVH::Node& node, const Vector3& center, float radius)
+{
+	float dist = 0.0f;
+	for (int i = 0; i < 3; ++i)
+	{
+		float v = center.v[i];
+		if (v < node.bb_min[i])
+			dist += (node.bb_min[i] - v) * (node.bb_min[i] - v);
+		else if (v > node.bb_max[i])
+			dist += (v - node.bb_max[i]) * (v - node.bb_max[i]);
+	}
+	return dist <= radius * radius;
+}
+
+//from Real-Time Collision Detection (Christer Ericson), 5.1.5
+static Vector3 closestPointInTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c)
+{
+	Vector3 ab = b - a;
+	Vector3 ac = c - a;
+	Vector3 ap = p - a;
+	float d1 = ab.dot(ap);
+	float d2 = ac.dot(ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vector3 bp = p - b;
+	float d3 = ab.dot(bp);
+	float d4 = ac.dot(bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vector3 cp = p - c;
+	float d5 = ab.dot(cp);
+	float d6 = ac.dot(cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+int BVH::testSphere(const Vector3& center, float radius, Vector3& point) const
+{
+	return testSphere(center, radius, NULL, center, radius, point);
+}
+
+//in object space the sphere becomes an ellipsoid, the tree is traversed with the sphere that contains it
+//(radius divided by the smallest scale of the model) and the triangles are tested in world space
+int BVH::testSphere(const Matrix44& model, const Vector3& center, float radius, Vector3& point) const
+{
+	Matrix44 inv = model;
+	if (!inv.inverseAffine())
+		return -1;
+
+	Vector3 axis[3];
+	for (int i = 0; i < 3; ++i)
+		axis[i].set(model.M[i][0], model.M[i][1], model.M[i][2]);
+	float scale_x = axis[0].length(), scale_y = axis[1].length(), scale_z = axis[2].length();
+	float min_scale = scale_x < scale_y ? scale_x : scale_y;
+	min_scale = min_scale < scale_z ? min_scale : scale_z;
+	if (min_scale <= 0.0f)
+		return -1;
+
+	//with shear the axis do not give the smallest scale, the norm of the inverse is a bound that is always valid
+	float tolerance = 1e-4f * (scale_x + scale_y + scale_z) * (scale_x + scale_y + scale_z);
+	float local_radius = radius / min_scale;
+	if (fabsf(axis[0].dot(axis[1])) > tolerance || fabsf(axis[0].dot(axis[2])) > tolerance || fabsf(axis[1].dot(axis[2])) > tolerance)
+	{
+		float norm = 0.0f;
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				norm += inv.M[i][j] * inv.M[i][j];
+		local_radius = radius * sqrtf(norm);
+	}
+
+	return testSphere(inv * center, local_radius, &model, center, radius, point);
+}
+
+int BVH::testSphere(const Vector3& local_center, float local_radius, const Matrix44* model, const Vector3& center, float radius, Vector3& point) const
+{
+	if (nodes.empty() || !sphereOverlapsNode(nodes[0], local_center, local_radius))
+		return -1;
+
+	const Node* stack[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	stack[stack_size++] = &nodes[0];
+
+	while (stack_size)
+	{
+		const Node* node = stack[--stack_size];
+		if (node->count)
+		{
+			const TriPacket& packet = packets[node->left_first];
+			Vector3 corners[BVH_LEAF_SIZE * 3];
+			for (unsigned int k = 0; k < node->count; ++k)
+			{
+				Vector3& a = corners[k * 3];
+				a.set(packet.v0[0][k], packet.v0[1][k], packet.v0[2][k]);
+				corners[k * 3 + 1] = a + Vector3(packet.e1[0][k], packet.e1[1][k], packet.e1[2][k]);
+				corners[k * 3 + 2] = a + Vector3(packet.e2[0][k], packet.e2[1][k], packet.e2[2][k]);
+			}
+			if (model) //the whole leaf goes to world space at once
+				transformPoints(*model, corners, corners, node->count * 3);
+			for (unsigned int k = 0; k < node->count; ++k)
+			{
+				Vector3 closest = closestPointInTriangle(center, corners[k * 3], corners[k * 3 + 1], corners[k * 3 + 2]);
+				Vector3 delta = closest - center;
+				if (delta.dot(delta) <= radius * radius)
+				{
+					point = closest;
+					return packet.id[k];
+				}
+			}
+			continue;
+		}
+
+		const Node* child = &nodes[node->left_first];
+		for (int i = 0; i < 2; ++i)
+			if (sphereOverlapsNode(child[i], local_center, local_radius))
+			{
+				assert(stack_size < BVH_MAX_DEPTH);
+				stack[stack_size++] = child + i;
+			}
+	}
+
+	return -1;
+}
+
+// STORAGE *********************************
+
+typedef struct
+{
+	int version;
+	int header_bytes;
+	unsigned int num_nodes;
+	unsigned int num_packets;
+	unsigned int num_triangles;
+	unsigned int source_hash;
+	char extra[12]; //unused
+} sBVHInfo;
+
+bool BVH::readBin(const char* filename)
+{
+	assert(filename);
+	struct stat stbuffer;
+	if (stat(filename, &stbuffer) != 0)
+		return false;
+
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+
+	unsigned int size = stbuffer.st_size;
+	if (size < 4 + sizeof(sBVHInfo))
+	{
+		fclose(f);
+		return false;
+	}
+
+	char* data = new char[size];
+	fread(data, size, 1, f);
+	fclose(f);
+
+	sBVHInfo info;
+	memcpy(&info, data + 4, sizeof(sBVHInfo));
+	if (memcmp(data, "BVHB", 4) != 0 || info.version != BVH_BIN_VERSION || info.header_bytes != sizeof(sBVHInfo) ||
+		!info.num_nodes || !info.num_packets || info.num_triangles > info.num_packets * 4ULL ||
+		size != 4 + sizeof(sBVHInfo) + (unsigned long long)info.num_nodes * sizeof(Node) + (unsigned long long)info.num_packets * sizeof(TriPacket))
+	{
+		std::cout << "[WARN] loading BVH: old version or invalid content: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
+
+	char* pos = data + 4 + sizeof(sBVHInfo);
+	clear();
+	num_triangles = info.num_triangles;
+	source_hash = info.source_hash;
+	nodes.resize(info.num_nodes);
+	memcpy((void*)&nodes[0], pos, sizeof(Node) * info.num_nodes);
+	pos += sizeof(Node) * info.num_nodes;
+	packets.resize(info.num_packets);
+	memcpy((void*)&packets[0], pos, sizeof(TriPacket) * info.num_packets);
+
+	delete[] data;
+
+	if (!validate())
+	{
+		std::cout << "[WARN] loading BVH: corrupted content: " << filename << std::endl;
+		clear();
+		return false;
+	}
+	return true;
+}
+
+//checks every index of a loaded tree before it is used and rebuilds the location of every triangle
+bool BVH::validate()
+{
+	//children always come after their parent, so there are no cycles and the depth of a node is known before its children
+	std::vector<int> depth(nodes.size(), 0);
+	for (unsigned int i = 0; i < nodes.size(); ++i)
+	{
+		const Node& node = nodes[i];
+		if (node.count)
+		{
+			if (node.count > BVH_LEAF_SIZE || node.left_first >= packets.size())
+				return false;
+			continue;
+		}
+		if (node.left_first <= i || node.left_first >= nodes.size() - 1 || depth[i] + 1 > BVH_MAX_DEPTH - 2) //same limit as the build
+			return false;
+		for (int j = 0; j < 2; ++j)
+			depth[node.left_first + j] = depth[node.left_first + j] > depth[i] + 1 ? depth[node.left_first + j] : depth[i] + 1;
+	}
+
+	//every triangle must be in exactly one slot
+	tri_location.assign(num_triangles, 0xFFFFFFFF);
+	for (unsigned int i = 0; i < packets.size(); ++i)
+		for (int k = 0; k < 4; ++k)
+		{
+			int id = packets[i].id[k];
+			if (id == -1)
+				continue;
+			if (id < 0 || (unsigned int)id >= num_triangles || tri_location[id] != 0xFFFFFFFF)
+				return false;
+			tri_location[id] = i * 4 + k;
+		}
+	for (unsigned int i = 0; i < num_triangles; ++i)
+		if (tri_location[i] == 0xFFFFFFFF)
+			return false;
+	return true;
+}
+
+bool BVH::writeBin(const char* filename)
+{
+	assert(nodes.size());
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write BVH: " << filename << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("BVHB", sizeof(char), 4, f);
+
+	sBVHInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = BVH_BIN_VERSION;
+	info.header_bytes = sizeof(sBVHInfo);
+	info.num_nodes = nodes.size();
+	info.num_packets = packets.size();
+	info.num_triangles = num_triangles;
+	info.source_hash = source_hash;
+	fwrite((void*)&info, sizeof(sBVHInfo), 1, f);
+
+	fwrite((void*)&nodes[0], sizeof(Node) * nodes.size(), 1, f);
+	fwrite((void*)&packets[0], sizeof(TriPacket) * packets.size(), 1, f);
+
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,76 @@
+/*  Bounding Volume Hierarchy over the triangles of a mesh.
+	It is used by the Mesh to answer ray and sphere queries (picking, line of sight, etc).
+	The tree is built with a binned SAH, every node takes 32 bytes and the leafs store
+	up to four triangles in SoA so they can be tested at once using SIMD.
+*/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "framework.h"
+
+#define BVH_BIN_VERSION 2 //this is used to regenerate the cached files if the format changes
+#define BVH_LEAF_SIZE 4 //max triangles per leaf (one packet)
+
+class BVH
+{
+public:
+	//inner nodes have count 0 and left_first points to the left child (the right one is left_first + 1)
+	//leafs have count > 0 and left_first points to the packet with its triangles
+	struct Node {
+		float bb_min[3];
+		unsigned int left_first;
+		float bb_max[3];
+		unsigned int count;
+	};
+
+	//four triangles stored as SoA (x[4],y[4],z[4]), unused slots are degenerated and have id -1
+	struct TriPacket {
+		float v0[3][4];
+		float e1[3][4]; //v1 - v0
+		float e2[3][4]; //v2 - v0
+		int id[4]; //index of the triangle in the original mesh
+	};
+
+	std::vector<Node> nodes;
+	std::vector<TriPacket> packets;
+	unsigned int num_triangles;
+	unsigned int source_hash; //of the vertices it was built from, a cached file is only valid for the same vertices
+
+	BVH();
+
+	static unsigned int hashVertices(const std::vector<Vector3>& vertices);
+
+	//vertices contains three consecutive Vector3 per triangle
+	void build(const std::vector<Vector3>& vertices);
+	void clear();
+
+	//all in object space. t is expressed in units of direction, returns the triangle index or -1
+	int testRay(const Vector3& origin, const Vector3& direction, float max_t, float& t) const;
+	//four rays in SoA (origin[axis][ray]), max_t gets the distance of the rays that hit and triangles the index or -1
+	//it traverses the tree once for the four rays, so it is faster than testRay when they are coherent
+	void testRay4(const float origin[3][4], const float direction[3][4], float max_t[4], int triangles[4]) const;
+	//returns the triangle index or -1, point is the closest point of that triangle to the center
+	int testSphere(const Vector3& center, float radius, Vector3& point) const;
+	//same with the sphere in world space and the tree transformed by model (also with non uniform scale), point is in world space
+	int testSphere(const Matrix44& model, const Vector3& center, float radius, Vector3& point) const;
+	//fetches the vertices of a triangle using the index returned by the tests
+	void getTriangle(int id, Vector3& v0, Vector3& v1, Vector3& v2) const;
+
+	unsigned int getMemoryUsage() const { return nodes.size() * sizeof(Node) + packets.size() * sizeof(TriPacket) + tri_location.size() * sizeof(unsigned int); }
+
+	//storage
+	bool readBin(const char* filename);
+	bool writeBin(const char* filename);
+
+private:
+	std::vector<unsigned int> tri_location; //packet * 4 + slot of every triangle, to find them from its id
+
+	bool validate(); //used after reading a file, false if any index is out of range
+
+	//traverses with a sphere in object space and tests the triangles with another one, transformed by model if there is one
+	int testSphere(const Vector3& local_center, float local_radius, const Matrix44* model, const Vector3& center, float radius, Vector3& point) const;
+};
+
+#endif
@@ -57,7 +57,7 @@ void Camera::updateProjectionMatrix()
 Vector3 Camera::getLocalVector(const Vector3& v)
 {
 	Matrix44 iV = view_matrix;
-	if (iV.inverse() == false)
+	if (iV.inverseAffine() == false)
 		std::cout << "Matrix Inverse error" << std::endl;
 	Vector3 result = iV.rotateVector(v);
 	return result;
@@ -322,6 +322,18 @@ float Camera::getProjectedScale(Vector3 pos3D, float radius) {
 	return ((float)sin(fov*DEG2RAD) / dist) * radius * 200.0f; //100 is to compensate width in pixels
 }
 
+float Camera::getScreenCoverage(const Vector3& center, float radius)
+{
+	if (testSphereInFrustum(center, radius) == CLIP_OUTSIDE)
+		return 0.0f;
+	if (type == ORTHOGRAPHIC)
+		return clamp(2.0f * radius / fabs(top - bottom), 0.0f, 1.0f);
+	float dist = eye.distance(center);
+	if (dist <= radius)
+		return 1.0f;
+	return clamp(radius / (dist * (float)tan(fov * 0.5f * DEG2RAD)), 0.0f, 1.0f);
+}
+
 
 char Camera::testSphereInFrustum( const Vector3& v, float radius)
 {
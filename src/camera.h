@@ -73,6 +73,7 @@ public:
 	Vector3 project(Vector3 pos3d, float window_width, float window_height); //to project 3D points to screen coordinates
 	Vector3 unproject( Vector3 coord2d, float window_width, float window_height ); //to project screen coordinates to world coordinates
 	float getProjectedScale(Vector3 pos3D, float radius); //used to know how big one unit will look at this distance
+	float getScreenCoverage(const Vector3& center, float radius); //fraction of the screen height covered by a sphere (0 if it is outside the frustum, up to 1)
 	Vector3 getRayDirection(int mouse_x, int mouse_y, float window_width, float window_height);
 
 	//culling
@@ -0,0 +1,405 @@
+#include "compressedanimation.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#define QUAT_QUANTIZATION_MAX 32767.0f //15 bits
+#define MAX_KEY_GAP 255 //limits the cost of the key reduction
+
+static const float s_sqrt2 = 1.41421356f;
+
+void quantizeQuaternion(const Quaternion& q, sQuantizedQuat& out)
+{
+	int largest = 0;
+	for (int i = 1; i < 4; ++i)
+		if (fabsf(q.q[i]) > fabsf(q.q[largest]))
+			largest = i;
+
+	//q and -q are the same rotation, flip it so the dropped component is positive
+	float sign = q.q[largest] < 0.0f ? -1.0f : 1.0f;
+	uint16 values[3];
+	for (int i = 0, j = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+		//the other components are between -1/sqrt(2) and 1/sqrt(2)
+		float v = clamp(q.q[i] * sign * s_sqrt2 * 0.5f + 0.5f, 0.0f, 1.0f);
+		values[j++] = (uint16)(v * QUAT_QUANTIZATION_MAX + 0.5f);
+	}
+	out.v[0] = values[0] | ((largest >> 1) << 15);
+	out.v[1] = values[1] | ((largest & 1) << 15);
+	out.v[2] = values[2];
+}
+
+void dequantizeQuaternion(const sQuantizedQuat& in, Quaternion& q)
+{
+	int largest = ((in.v[0] >> 15) << 1) | (in.v[1] >> 15);
+	float sum = 0.0f;
+	for (int i = 0, j = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+		float v = ((in.v[j++] & 0x7FFF) / QUAT_QUANTIZATION_MAX - 0.5f) * 2.0f / s_sqrt2;
+		q.q[i] = v;
+		sum += v * v;
+	}
+	q.q[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+}
+
+void decomposeMatrix(const Matrix44& m, Vector3& translation, Quaternion& rotation, Vector3& scale)
+{
+	translation.set(m.m[12], m.m[13], m.m[14]);
+
+	//rows of the rotation scaled
+	Vector3 rows[3] = { Vector3(m.m[0], m.m[1], m.m[2]), Vector3(m.m[4], m.m[5], m.m[6]), Vector3(m.m[8], m.m[9], m.m[10]) };
+	scale.set((float)rows[0].length(), (float)rows[1].length(), (float)rows[2].length());
+	if (rows[0].cross(rows[1]).dot(rows[2]) < 0.0f) //mirrored
+		scale.x = -scale.x;
+	for (int i = 0; i < 3; ++i)
+		if (scale.v[i] != 0.0f)
+			rows[i] = rows[i] * (1.0f / scale.v[i]);
+
+	//inverse of Quaternion::toMatrix
+	float r[3][3] = { { rows[0].x, rows[0].y, rows[0].z }, { rows[1].x, rows[1].y, rows[1].z }, { rows[2].x, rows[2].y, rows[2].z } };
+	float trace = r[0][0] + r[1][1] + r[2][2];
+	if (trace > 0.0f)
+	{
+		float s = 0.5f / sqrtf(trace + 1.0f);
+		rotation.set((r[2][1] - r[1][2]) * s, (r[0][2] - r[2][0]) * s, (r[1][0] - r[0][1]) * s, 0.25f / s);
+	}
+	else if (r[0][0] > r[1][1] && r[0][0] > r[2][2])
+	{
+		float s = 2.0f * sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+		rotation.set(0.25f * s, (r[0][1] + r[1][0]) / s, (r[0][2] + r[2][0]) / s, (r[2][1] - r[1][2]) / s);
+	}
+	else if (r[1][1] > r[2][2])
+	{
+		float s = 2.0f * sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+		rotation.set((r[0][1] + r[1][0]) / s, 0.25f * s, (r[1][2] + r[2][1]) / s, (r[0][2] - r[2][0]) / s);
+	}
+	else
+	{
+		float s = 2.0f * sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+		rotation.set((r[0][2] + r[2][0]) / s, (r[1][2] + r[2][1]) / s, 0.25f * s, (r[1][0] - r[0][1]) / s);
+	}
+	rotation.normalize();
+}
+
+void composeMatrix(const Vector3& translation, const Quaternion& rotation, const Vector3& scale, Matrix44& m)
+{
+	rotation.toMatrix(m);
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			m.M[i][j] *= scale.v[i];
+	m.m[12] = translation.x;
+	m.m[13] = translation.y;
+	m.m[14] = translation.z;
+}
+
+//normalized lerp through the shortest path, close enough to slerp between near keys
+static inline void nlerp(const Quaternion& a, const Quaternion& b, float f, Quaternion& out)
+{
+	float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	float fb = dot < 0.0f ? -f : f;
+	float fa = 1.0f - f;
+	out.set(a.x * fa + b.x * fb, a.y * fa + b.y * fb, a.z * fa + b.z * fb, a.w * fa + b.w * fb);
+	float length = sqrtf(out.x * out.x + out.y * out.y + out.z * out.z + out.w * out.w);
+	if (length > 0.0f)
+		out *= 1.0f / length;
+}
+
+void blendTRS(const sBoneTRS& a, const sBoneTRS& b, float f, sBoneTRS& out)
+{
+	Quaternion rotation;
+	nlerp(a.rotation, b.rotation, f, rotation);
+	out.rotation = rotation;
+	out.translation = a.translation + (b.translation - a.translation) * f;
+	out.scale = a.scale + (b.scale - a.scale) * f;
+}
+
+//how the key reduction deals with every kind of track
+struct sRotationChannel {
+	typedef Quaternion Value;
+	typedef sQuantizedQuat Key;
+	float distance; //virtual distance multiplied by the biggest scale of the bone
+	Key encode(const Value& v) const { Key k; quantizeQuaternion(v, k); return k; }
+	Value decode(const Key& k) const { Value v; dequantizeQuaternion(k, v); return v; }
+	Value interpolate(const Value& a, const Value& b, float f) const { Value v; nlerp(a, b, f, v); return v; }
+	float error(const Value& a, const Value& b) const
+	{
+		//a point at distance d rotated by an angle moves 2 * d * sin(angle / 2)
+		float dot = fabsf(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+		return 2.0f * distance * sqrtf(std::max(0.0f, 1.0f - dot * dot));
+	}
+};
+
+struct sVectorChannel {
+	typedef Vector3 Value;
+	typedef Vector3 Key;
+	float distance; //1 for translations, the virtual distance for scales
+	Key encode(const Value& v) const { return v; }
+	Value decode(const Key& k) const { return k; }
+	Value interpolate(const Value& a, const Value& b, float f) const { return a + (b - a) * f; }
+	float error(const Value& a, const Value& b) const { return (float)(a - b).length() * distance; }
+};
+
+//keeps the keys needed so every sample can be interpolated from them with an error under max_error
+template<typename Channel> static void reduceTrack(const Channel& channel, const std::vector<typename Channel::Value>& samples, float max_error,
+	std::vector<uint16>& times, std::vector<typename Channel::Key>& keys, CompressedAnimation::sTrack& track)
+{
+	typedef typename Channel::Value Value;
+	int num = (int)samples.size();
+	track.first_key = (uint32)keys.size();
+
+	//constant
+	Value first = channel.decode(channel.encode(samples[0]));
+	bool constant = true;
+	for (int i = 1; i < num && constant; ++i)
+		constant = channel.error(first, samples[i]) <= max_error;
+	times.push_back(0);
+	keys.push_back(channel.encode(samples[0]));
+	if (constant || num == 1)
+	{
+		track.num_keys = 1;
+		return;
+	}
+
+	//extend every segment while the samples inside can be interpolated (the last sample is always a key)
+	int start = 0;
+	while (start < num - 1)
+	{
+		Value start_value = channel.decode(keys.back());
+		int end = start + 1;
+		for (int candidate = start + 2; candidate < num && candidate - start <= MAX_KEY_GAP; ++candidate)
+		{
+			Value end_value = channel.decode(channel.encode(samples[candidate]));
+			bool valid = true;
+			for (int i = start + 1; i < candidate && valid; ++i)
+				valid = channel.error(channel.interpolate(start_value, end_value, (i - start) / float(candidate - start)), samples[i]) <= max_error;
+			if (!valid)
+				break;
+			end = candidate;
+		}
+		times.push_back((uint16)end);
+		keys.push_back(channel.encode(samples[end]));
+		start = end;
+	}
+	track.num_keys = (uint32)keys.size() - track.first_key;
+}
+
+CompressedAnimation::CompressedAnimation()
+{
+	num_keyframes = 0;
+	num_animated_bones = 0;
+	tolerance = 0.0f;
+	virtual_distance = 0.0f;
+}
+
+bool CompressedAnimation::compress(const Matrix44* keyframes, int num_keyframes, int num_animated_bones, float tolerance, float virtual_distance)
+{
+	assert(keyframes && num_keyframes > 0);
+	if (num_keyframes > 65536)
+		return false; //key times are stored in 16 bits
+	this->num_keyframes = num_keyframes;
+	this->num_animated_bones = num_animated_bones;
+	this->tolerance = tolerance;
+	this->virtual_distance = virtual_distance;
+	tracks.resize(num_animated_bones);
+	rotation_times.clear(); rotations.clear();
+	translation_times.clear(); translations.clear();
+	scale_times.clear(); scales.clear();
+
+	std::vector<Vector3> bone_translations(num_keyframes);
+	std::vector<Quaternion> bone_rotations(num_keyframes);
+	std::vector<Vector3> bone_scales(num_keyframes);
+
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		float max_scale = 0.0f;
+		for (int k = 0; k < num_keyframes; ++k)
+		{
+			decomposeMatrix(keyframes[k * num_animated_bones + i], bone_translations[k], bone_rotations[k], bone_scales[k]);
+			Quaternion& q = bone_rotations[k];
+			if (k && q.x * bone_rotations[k - 1].x + q.y * bone_rotations[k - 1].y + q.z * bone_rotations[k - 1].z + q.w * bone_rotations[k - 1].w < 0.0f)
+				q *= -1.0f; //keep them in the same hemisphere
+			max_scale = std::max(max_scale, std::max(fabsf(bone_scales[k].x), std::max(fabsf(bone_scales[k].y), fabsf(bone_scales[k].z))));
+		}
+
+		//the errors of the three channels add up, so every one gets a third of the tolerance
+		float channel_tolerance = tolerance / 3.0f;
+		sRotationChannel rotation_channel = { virtual_distance * std::max(max_scale, 1.0f) };
+		sVectorChannel translation_channel = { 1.0f };
+		sVectorChannel scale_channel = { virtual_distance };
+		reduceTrack(rotation_channel, bone_rotations, channel_tolerance, rotation_times, rotations, tracks[i].rotation);
+		reduceTrack(translation_channel, bone_translations, channel_tolerance, translation_times, translations, tracks[i].translation);
+		reduceTrack(scale_channel, bone_scales, channel_tolerance, scale_times, scales, tracks[i].scale);
+	}
+	return true;
+}
+
+//keys around the sample position v, after the last key it goes back to the first one
+static inline void findKeys(const uint16* times, uint32 num_keys, float v, uint32& k0, uint32& k1, float& f)
+{
+	if (num_keys == 1)
+	{
+		k0 = k1 = 0;
+		f = 0.0f;
+		return;
+	}
+	int index = (int)v;
+	if (index >= times[num_keys - 1])
+	{
+		k0 = num_keys - 1;
+		k1 = 0;
+		f = v - index;
+		return;
+	}
+	k0 = uint32(std::upper_bound(times, times + num_keys, (uint16)index) - times) - 1;
+	k1 = k0 + 1;
+	f = (v - times[k0]) / float(times[k1] - times[k0]);
+}
+
+void CompressedAnimation::sample(int bone, float v, Vector3& translation, Quaternion& rotation, Vector3& scale) const
+{
+	assert(bone >= 0 && bone < num_animated_bones);
+	const sBoneTracks& bone_tracks = tracks[bone];
+	uint32 k0, k1;
+	float f;
+
+	const sTrack& r = bone_tracks.rotation;
+	findKeys(&rotation_times[r.first_key], r.num_keys, v, k0, k1, f);
+	Quaternion q0, q1;
+	dequantizeQuaternion(rotations[r.first_key + k0], q0);
+	if (k0 == k1)
+		rotation = q0;
+	else
+	{
+		dequantizeQuaternion(rotations[r.first_key + k1], q1);
+		nlerp(q0, q1, f, rotation);
+	}
+
+	const sTrack& t = bone_tracks.translation;
+	findKeys(&translation_times[t.first_key], t.num_keys, v, k0, k1, f);
+	const Vector3& t0 = translations[t.first_key + k0];
+	translation = k0 == k1 ? t0 : t0 + (translations[t.first_key + k1] - t0) * f;
+
+	const sTrack& s = bone_tracks.scale;
+	findKeys(&scale_times[s.first_key], s.num_keys, v, k0, k1, f);
+	const Vector3& s0 = scales[s.first_key + k0];
+	scale = k0 == k1 ? s0 : s0 + (scales[s.first_key + k1] - s0) * f;
+}
+
+void CompressedAnimation::sample(int bone, float v, Matrix44& m) const
+{
+	Vector3 translation, scale;
+	Quaternion rotation;
+	sample(bone, v, translation, rotation, scale);
+	composeMatrix(translation, rotation, scale, m);
+}
+
+size_t CompressedAnimation::getMemoryUsage() const
+{
+	return sizeof(CompressedAnimation) + tracks.size() * sizeof(sBoneTracks) +
+		rotation_times.size() * sizeof(uint16) + rotations.size() * sizeof(sQuantizedQuat) +
+		translation_times.size() * sizeof(uint16) + translations.size() * sizeof(Vector3) +
+		scale_times.size() * sizeof(uint16) + scales.size() * sizeof(Vector3);
+}
+
+struct sCompressedAnimHeader {
+	int num_keyframes;
+	int num_animated_bones;
+	float tolerance;
+	float virtual_distance;
+	int num_rotation_keys;
+	int num_translation_keys;
+	int num_scale_keys;
+};
+
+template<typename T> static void writeVector(FILE* f, const std::vector<T>& v)
+{
+	if (v.size())
+		fwrite(&v[0], sizeof(T), v.size(), f);
+}
+
+template<typename T> static bool readVector(const char*& pos, const char* end, std::vector<T>& v, size_t num)
+{
+	if (pos + num * sizeof(T) > end)
+		return false;
+	v.resize(num);
+	if (num)
+		memcpy(&v[0], pos, num * sizeof(T));
+	pos += num * sizeof(T);
+	return true;
+}
+
+void CompressedAnimation::write(FILE* f) const
+{
+	sCompressedAnimHeader header;
+	header.num_keyframes = num_keyframes;
+	header.num_animated_bones = num_animated_bones;
+	header.tolerance = tolerance;
+	header.virtual_distance = virtual_distance;
+	header.num_rotation_keys = (int)rotations.size();
+	header.num_translation_keys = (int)translations.size();
+	header.num_scale_keys = (int)scales.size();
+	fwrite(&header, sizeof(header), 1, f);
+
+	writeVector(f, tracks);
+	writeVector(f, rotation_times);
+	writeVector(f, rotations);
+	writeVector(f, translation_times);
+	writeVector(f, translations);
+	writeVector(f, scale_times);
+	writeVector(f, scales);
+}
+
+//at least one key inside the array, the first at sample 0 and the rest in increasing order (findKeys needs it)
+static bool isValidTrack(const CompressedAnimation::sTrack& track, const std::vector<uint16>& times, int num_keyframes)
+{
+	if (track.num_keys < 1 || uint64(track.first_key) + track.num_keys > times.size())
+		return false;
+	const uint16* t = &times[track.first_key];
+	if (t[0] != 0)
+		return false;
+	for (uint32 i = 1; i < track.num_keys; ++i)
+		if (t[i] <= t[i - 1] || t[i] >= num_keyframes)
+			return false;
+	return true;
+}
+
+bool CompressedAnimation::read(const char*& pos, const char* end)
+{
+	sCompressedAnimHeader header;
+	if (pos + sizeof(header) > end)
+		return false;
+	memcpy(&header, pos, sizeof(header));
+	pos += sizeof(header);
+
+	//negative counts would wrap around in readVector
+	if (header.num_keyframes <= 0 || header.num_keyframes > 65536 || header.num_animated_bones <= 0 ||
+		header.num_rotation_keys < 0 || header.num_translation_keys < 0 || header.num_scale_keys < 0)
+		return false;
+
+	num_keyframes = header.num_keyframes;
+	num_animated_bones = header.num_animated_bones;
+	tolerance = header.tolerance;
+	virtual_distance = header.virtual_distance;
+	if (!readVector(pos, end, tracks, header.num_animated_bones) ||
+		!readVector(pos, end, rotation_times, header.num_rotation_keys) ||
+		!readVector(pos, end, rotations, header.num_rotation_keys) ||
+		!readVector(pos, end, translation_times, header.num_translation_keys) ||
+		!readVector(pos, end, translations, header.num_translation_keys) ||
+		!readVector(pos, end, scale_times, header.num_scale_keys) ||
+		!readVector(pos, end, scales, header.num_scale_keys))
+		return false;
+
+	//sample indexes the keys of every track without checking them
+	for (size_t i = 0; i < tracks.size(); ++i)
+		if (!isValidTrack(tracks[i].rotation, rotation_times, num_keyframes) ||
+			!isValidTrack(tracks[i].translation, translation_times, num_keyframes) ||
+			!isValidTrack(tracks[i].scale, scale_times, num_keyframes))
+			return false;
+	return true;
+}
@@ -0,0 +1,84 @@
+/*  Compressed version of the keyframes of an Animation.
+	Every sampled matrix is decomposed in rotation, translation and scale, and every one of them becomes a track.
+	Tracks that do not change are stored once, the rest only keep the keys that cannot be interpolated from
+	their neighbours without moving a point at virtual_distance from the bone more than the tolerance.
+	Rotations are quantized to 48 bits (smallest three), so a bone with a moving rotation costs 6 bytes per key.
+*/
+
+#ifndef COMPRESSEDANIMATION_H
+#define COMPRESSEDANIMATION_H
+
+#include <vector>
+#include <cstdio>
+#include "framework.h"
+
+//unit quaternion without its largest component (recomputed from the others), 2 bits for its index and 15 bits for the others
+struct sQuantizedQuat {
+	uint16 v[3];
+};
+
+void quantizeQuaternion(const Quaternion& q, sQuantizedQuat& out);
+void dequantizeQuaternion(const sQuantizedQuat& in, Quaternion& q);
+
+//bone matrices as rotation, translation and scale (rows of the rotation scaled, translation in the last row)
+void decomposeMatrix(const Matrix44& m, Vector3& translation, Quaternion& rotation, Vector3& scale);
+void composeMatrix(const Vector3& translation, const Quaternion& rotation, const Vector3& scale, Matrix44& m);
+
+//local transform of a bone while poses are blended, blending the matrices element by element would shear and shrink them
+struct sBoneTRS {
+	Quaternion rotation;
+	Vector3 translation;
+	Vector3 scale;
+
+	void fromMatrix(const Matrix44& m) { decomposeMatrix(m, translation, rotation, scale); }
+	void toMatrix(Matrix44& m) const { composeMatrix(translation, rotation, scale, m); }
+};
+
+//nlerp of the rotations through the shortest path and lerp of the rest, out can be a or b
+void blendTRS(const sBoneTRS& a, const sBoneTRS& b, float f, sBoneTRS& out);
+
+class CompressedAnimation
+{
+public:
+	//keys of one channel of a bone, a track with one key is constant
+	struct sTrack {
+		uint32 first_key;
+		uint32 num_keys;
+	};
+	struct sBoneTracks {
+		sTrack rotation;
+		sTrack translation;
+		sTrack scale;
+	};
+
+	int num_keyframes; //samples of the original animation
+	int num_animated_bones;
+	float tolerance; //max error in bone space units
+	float virtual_distance; //distance from the bone of the points used to measure the error
+
+	std::vector<sBoneTracks> tracks; //one per animated bone
+	std::vector<uint16> rotation_times; //sample of every key
+	std::vector<sQuantizedQuat> rotations;
+	std::vector<uint16> translation_times;
+	std::vector<Vector3> translations;
+	std::vector<uint16> scale_times;
+	std::vector<Vector3> scales;
+
+	CompressedAnimation();
+
+	//keyframes has num_keyframes * num_animated_bones matrices (all the bones of the first sample, then the second, ...)
+	//returns false without changing anything if there are more than 65536 keyframes (key times are 16 bits)
+	bool compress(const Matrix44* keyframes, int num_keyframes, int num_animated_bones, float tolerance, float virtual_distance);
+
+	//transform of an animated bone at a sample position (v = time * samples_per_second), between the last sample and the first it interpolates to the first
+	void sample(int bone, float v, Vector3& translation, Quaternion& rotation, Vector3& scale) const;
+	void sample(int bone, float v, Matrix44& m) const;
+
+	size_t getMemoryUsage() const;
+
+	//binary storage (used in the ABIN), read returns false if the data does not fit or any track is out of its keys
+	void write(FILE* f) const;
+	bool read(const char*& pos, const char* end);
+};
+
+#endif
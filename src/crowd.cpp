@@ -0,0 +1,297 @@
+#include "crowd.h"
+#include "animation.h"
+#include "threadpool.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#define CROWD_TASKS_PER_THREAD 8
+
+//scratch of a task, taken from the frame arena
+struct sCrowdScratch {
+	Matrix44 pose[128]; //sampled pose of anim
+	sBoneTRS bones_a[128]; //both poses by skeleton bone when they are blended
+	sBoneTRS bones_b[128];
+};
+
+sCrowdAgent::sCrowdAgent()
+{
+	skeleton = NULL;
+	mesh = NULL;
+	bone_matrices = NULL;
+	time = 0.0f;
+	loop = true;
+	time_b = 0.0f;
+	loop_b = true;
+	weight = 0.0f;
+	layers = 0xFF;
+	coverage = 1.0f;
+	lod = 0;
+	frames_to_target = -1;
+	lod_interval = 1;
+	checked_anim = NULL;
+}
+
+CrowdAnimator::CrowdAnimator() : arena(1024 * 1024)
+{
+	grain = 16;
+	pool = NULL;
+	last_update_ms = 0.0f;
+	frame = 0;
+	num_sampled = 0;
+
+	//a character 1.8 units tall covers the whole screen at 2 units with a fov of 45
+	sAnimationLOD default_lods[] = {
+		{ 0.25f, 1, 0 },
+		{ 0.1f, 2, 0 },
+		{ 0.04f, 4, 0 },
+		{ 0.0f, 8, LEFT_ARM | RIGHT_ARM },
+	};
+	lods.assign(default_lods, default_lods + sizeof(default_lods) / sizeof(sAnimationLOD));
+}
+
+void CrowdAnimator::update()
+{
+	long start_time = getTime();
+	arena.reset();
+
+	//the pools are not thread safe, mark the animations as used from here
+	for (size_t i = 0; i < agents.size(); ++i)
+	{
+		sCrowdAgent& agent = agents[i];
+		assert(agent.skeleton && agent.anim && "agents need a skeleton and an animation");
+		agent.anim->touch();
+		if (agent.anim_b)
+			agent.anim_b->touch();
+
+		int lod = 0;
+		while (lod + 1 < (int)lods.size() && agent.coverage < lods[lod].min_coverage)
+			lod++;
+		agent.lod = lod;
+	}
+
+	//enough tasks to keep all the threads busy, few enough to keep the scratch memory small
+	ThreadPool* threads = pool ? pool : ThreadPool::Get();
+	int num_tasks = (threads->getNumThreads() + 1) * CROWD_TASKS_PER_THREAD;
+	int task_grain = std::max(grain, ((int)agents.size() + num_tasks - 1) / num_tasks);
+	std::atomic<int> sampled(0);
+	threads->parallelFor((int)agents.size(), task_grain, [this, &sampled](int start, int end) {
+		sCrowdScratch* scratch = arena.allocate<sCrowdScratch>(1);
+		int num = 0;
+		for (int i = start; i < end; ++i)
+			if (updateAgent(agents[i], i, scratch))
+				num++;
+		sampled += num;
+	});
+
+	num_sampled = sampled;
+	frame++;
+	last_update_ms = (float)(getTime() - start_time);
+}
+
+bool CrowdAnimator::updateAgent(sCrowdAgent& agent, int index, sCrowdScratch* scratch)
+{
+	const Animation* anim = agent.anim;
+	Skeleton& skeleton = *agent.skeleton;
+
+	//first time or the character changed of skeleton, the bones that are not animated keep the pose of anim.
+	//The names are only compared when the animation changes, the copy has its own map of names
+	if (agent.checked_anim != anim)
+	{
+		if (!skeleton.hasSameBones(anim->skeleton))
+		{
+			skeleton = anim->skeleton;
+			agent.frames_to_target = -1;
+		}
+		agent.checked_anim = anim;
+	}
+
+	if (agent.coverage <= 0.0f)
+	{
+		updateRootBone(agent);
+		agent.frames_to_target = -1; //sampled as soon as it is visible again
+		return false;
+	}
+
+	int interval = lods.empty() ? 1 : std::max(lods[agent.lod].interval, 1);
+	uint8 frozen_layers = lods.empty() ? 0 : lods[agent.lod].frozen_layers;
+	bool has_palette = agent.mesh && agent.bone_matrices;
+	bool palette_ready = has_palette && agent.bone_matrices->size() == agent.mesh->bones_info.size();
+
+	//staggered by index so the agents of the same level are not sampled in the same frame
+	bool sampled = (frame + index) % interval == 0 || agent.frames_to_target < 0 || (has_palette && !palette_ready);
+	if (sampled)
+	{
+		samplePose(agent, frozen_layers, scratch);
+		if (!has_palette)
+		{
+			skeleton.updateGlobalMatrices();
+			agent.frames_to_target = 0;
+		}
+		else if (interval == 1 || !palette_ready || agent.frames_to_target < 0)
+		{
+			skeleton.computeFinalBoneMatrices(*agent.bone_matrices, agent.mesh); //updates the global matrices too
+			agent.frames_to_target = 0;
+		}
+		else
+		{
+			//the palette reaches this pose just before the next sample, it starts from where it is now
+			std::vector<Matrix44>& palette = *agent.bone_matrices;
+			agent.lod_from.resize(palette.size());
+			for (size_t i = 0; i < palette.size(); ++i)
+				agent.lod_from[i].fromMatrix(palette[i]);
+			skeleton.computeFinalBoneMatrices(palette, agent.mesh);
+			agent.lod_to.resize(palette.size());
+			for (size_t i = 0; i < palette.size(); ++i)
+				agent.lod_to[i].fromMatrix(palette[i]);
+			agent.frames_to_target = interval;
+			agent.lod_interval = interval;
+		}
+	}
+
+	//moves the palette a step towards the target, the steps are even from the previous sample to the last one
+	if (agent.frames_to_target > 0)
+	{
+		std::vector<Matrix44>& palette = *agent.bone_matrices;
+		float f = float(agent.lod_interval - agent.frames_to_target + 1) / agent.lod_interval;
+		sBoneTRS step;
+		for (size_t i = 0; i < palette.size(); ++i)
+		{
+			blendTRS(agent.lod_from[i], agent.lod_to[i], f, step);
+			step.toMatrix(palette[i]);
+		}
+		agent.frames_to_target--;
+	}
+	return sampled;
+}
+
+void CrowdAnimator::samplePose(sCrowdAgent& agent, uint8 frozen_layers, sCrowdScratch* scratch)
+{
+	const Animation* anim = agent.anim;
+	Skeleton& skeleton = *agent.skeleton;
+
+	float w = clamp(agent.weight, 0.0f, 1.0f);
+	if (frozen_layers)
+	{
+		samplePartialPose(agent, frozen_layers, w);
+		return;
+	}
+
+	if (!agent.anim_b || w == 0.0f)
+	{
+		Matrix44* pose = scratch->pose;
+		anim->sampleLocal(agent.time, pose, agent.loop);
+		for (int i = 0; i < anim->num_animated_bones; ++i)
+			skeleton.bones[anim->bones_map[i]].model = pose[i];
+		return;
+	}
+
+	const Animation* anim_b = agent.anim_b;
+	assert(anim_b->skeleton.num_bones == skeleton.num_bones && "blended animations must use the same skeleton");
+
+	//both poses by skeleton bone as rotation, translation and scale, a lerp of the matrices would shear the bones
+	sBoneTRS* bones_a = scratch->bones_a;
+	sBoneTRS* bones_b = scratch->bones_b;
+	anim->sampleBonesTRS(agent.time, bones_a, agent.loop);
+	anim_b->sampleBonesTRS(agent.time_b, bones_b, agent.loop_b);
+
+	for (int i = 0; i < skeleton.num_bones; ++i)
+	{
+		Skeleton::Bone& bone = skeleton.bones[i];
+		if (agent.layers == 0xFF || (bone.layer & agent.layers))
+			blendTRS(bones_a[i], bones_b[i], w, bones_a[i]);
+		bones_a[i].toMatrix(bone.model);
+	}
+}
+
+void CrowdAnimator::samplePartialPose(sCrowdAgent& agent, uint8 frozen_layers, float w)
+{
+	const Animation* anim = agent.anim;
+	const Animation* anim_b = w > 0.0f ? agent.anim_b.get() : NULL;
+	Skeleton& skeleton = *agent.skeleton;
+
+	//animated index of every bone of the skeleton, to sample them one by one
+	int8 animated_a[128], animated_b[128];
+	memset(animated_a, -1, sizeof(animated_a));
+	for (int i = 0; i < anim->num_animated_bones; ++i)
+		animated_a[anim->bones_map[i]] = i;
+	if (anim_b)
+	{
+		assert(anim_b->skeleton.num_bones == skeleton.num_bones && "blended animations must use the same skeleton");
+		memset(animated_b, -1, sizeof(animated_b));
+		for (int i = 0; i < anim_b->num_animated_bones; ++i)
+			animated_b[anim_b->bones_map[i]] = i;
+	}
+
+	for (int i = 0; i < skeleton.num_bones; ++i)
+	{
+		Skeleton::Bone& bone = skeleton.bones[i];
+		if (bone.layer & frozen_layers)
+			continue;
+		if (!anim_b || !(agent.layers == 0xFF || (bone.layer & agent.layers)))
+		{
+			if (animated_a[i] >= 0)
+				anim->sampleBone(agent.time, animated_a[i], bone.model, agent.loop);
+			continue;
+		}
+
+		//the same as samplePose, the bones that are not animated take the rest pose of the animation
+		Matrix44 m_a, m_b;
+		if (animated_a[i] >= 0)
+			anim->sampleBone(agent.time, animated_a[i], m_a, agent.loop);
+		else
+			m_a = anim->skeleton.bones[i].model;
+		if (animated_b[i] >= 0)
+			anim_b->sampleBone(agent.time_b, animated_b[i], m_b, agent.loop_b);
+		else
+			m_b = anim_b->skeleton.bones[i].model;
+		sBoneTRS a, b;
+		a.fromMatrix(m_a);
+		b.fromMatrix(m_b);
+		blendTRS(a, b, w, a);
+		a.toMatrix(bone.model);
+	}
+}
+
+void CrowdAnimator::updateRootBone(sCrowdAgent& agent)
+{
+	const Animation* anim = agent.anim;
+	Skeleton& skeleton = *agent.skeleton;
+	if (!skeleton.num_bones)
+		return;
+
+	//the bones are sorted by depth, the first one is a root
+	if (skeleton.num_sorted_bones != skeleton.num_bones)
+		skeleton.sortHierarchy();
+	int root = skeleton.update_order[0];
+
+	Matrix44 m, m_b;
+	bool found = false;
+	for (int i = 0; i < anim->num_animated_bones && !found; ++i)
+		if (anim->bones_map[i] == root)
+		{
+			anim->sampleBone(agent.time, i, m, agent.loop);
+			found = true;
+		}
+	if (!found)
+		return;
+
+	float w = clamp(agent.weight, 0.0f, 1.0f);
+	const Animation* anim_b = agent.anim_b;
+	if (anim_b && w > 0.0f && (agent.layers == 0xFF || (skeleton.bones[root].layer & agent.layers)))
+		for (int i = 0; i < anim_b->num_animated_bones; ++i)
+			if (anim_b->bones_map[i] == root)
+			{
+				anim_b->sampleBone(agent.time_b, i, m_b, agent.loop_b);
+				sBoneTRS a, b;
+				a.fromMatrix(m);
+				b.fromMatrix(m_b);
+				blendTRS(a, b, w, a);
+				a.toMatrix(m);
+				break;
+			}
+	skeleton.bones[root].model = m;
+}
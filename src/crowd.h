@@ -0,0 +1,89 @@
+/*  Updates the animation of many characters at once using the thread pool.
+	Every frame the game fills one agent per character (animations, times and blend weight) and calls update,
+	the characters are split in chunks that the workers take as they become free, and every one of them
+	samples its animations, blends them, updates the global matrices and builds the skinning palette.
+	Every task takes its scratch poses from a frame arena, so the workers never touch the heap.
+	The cost follows the screen coverage of the characters: agents that look small are sampled every 2, 4 or 8
+	frames (staggered so every frame updates a similar amount) and their palette moves towards the last sampled
+	one in between, the smallest ones only sample the bones outside some layers, and agents out of the screen
+	only update their root bone. Keep the agents between frames (change their fields instead of adding them
+	again) so they keep that state.
+*/
+
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <vector>
+#include "framework.h"
+#include "framearena.h"
+#include "animation.h"
+#include "resource.h"
+
+class Mesh;
+class ThreadPool;
+struct sCrowdScratch;
+
+//how a range of screen coverage is animated
+struct sAnimationLOD {
+	float min_coverage; //fraction of the screen height (Camera::getScreenCoverage)
+	int interval; //frames between samples
+	uint8 frozen_layers; //bones in these layers are not sampled and keep their last pose (BODY_LAYERS)
+};
+
+//animation state of one character for this frame
+struct sCrowdAgent {
+	Skeleton* skeleton; //where the pose is stored, it takes the bones of anim the first time
+	Mesh* mesh; //skinned mesh, NULL to skip the palette
+	std::vector<Matrix44>* bone_matrices; //palette for the shader (only if there is a mesh)
+
+	ResourceHandle<Animation> anim; //held so the pool never evicts it while the agent uses it, load it with Animation::Get(name, true)
+	float time;
+	bool loop;
+
+	ResourceHandle<Animation> anim_b; //optional, blended over anim (same skeleton)
+	float time_b;
+	bool loop_b;
+	float weight; //of anim_b
+	uint8 layers; //bones where anim_b is blended
+
+	float coverage; //of the screen height, 0 when it is not visible (only the root bone is updated)
+
+	//LOD state, updated by the animator
+	int lod; //level used in the last update
+	int frames_to_target; //frames until the palette reaches lod_to, -1 to sample it in the next update
+	int lod_interval; //frames from lod_from to lod_to
+	const Animation* checked_anim; //anim whose bones were last compared with skeleton
+	std::vector<sBoneTRS> lod_from; //palette before the last sample and the sampled one, when it is not sampled every frame.
+	std::vector<sBoneTRS> lod_to; //the steps blend them as rotation, translation and scale so the bones do not shrink
+
+	sCrowdAgent();
+};
+
+class CrowdAnimator
+{
+public:
+	std::vector<sCrowdAgent> agents;
+	int grain; //min characters per task
+	ThreadPool* pool; //NULL uses the global one
+	FrameArena arena;
+	float last_update_ms;
+	std::vector<sAnimationLOD> lods; //sorted from the biggest min_coverage, empty samples everything every frame
+	unsigned int frame;
+	int num_sampled; //agents sampled in the last update
+
+	CrowdAnimator();
+
+	void clear() { agents.clear(); }
+	sCrowdAgent& add() { agents.push_back(sCrowdAgent()); return agents.back(); }
+
+	//animates all the agents, returns when they are done
+	void update();
+
+private:
+	bool updateAgent(sCrowdAgent& agent, int index, sCrowdScratch* scratch); //returns if its pose was sampled
+	void samplePose(sCrowdAgent& agent, uint8 frozen_layers, sCrowdScratch* scratch);
+	void samplePartialPose(sCrowdAgent& agent, uint8 frozen_layers, float w); //samples only the bones outside frozen_layers
+	void updateRootBone(sCrowdAgent& agent);
+};
+
+#endif
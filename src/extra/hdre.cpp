@@ -6,11 +6,13 @@
 
 #include "hdre.h"
 
-std::map<std::string, HDRE*> HDRE::sHDRELoaded;
+ResourcePool<HDRE> HDRE::sHDRELoaded("HDREs");
 
 HDRE::HDRE()
 {
-	
+	data = NULL;
+	width = height = 0;
+	numChannels = 0;
 }
 
 HDRE::~HDRE()
@@ -51,20 +53,39 @@ HDRE* HDRE::Get(const char* filename)
 {
 	assert(filename);
 
-	auto it = sHDRELoaded.find(filename);
-	if (it != sHDRELoaded.end())
-		return it->second;
+	HDRE* hdre = sHDRELoaded.find(filename);
+	if (hdre)
+		return hdre;
 
-	HDRE* hdre = new HDRE();
+	hdre = new HDRE();
 	if (!hdre->load(filename))
 	{
 		delete hdre;
 		return NULL;
 	}
 
+	// it was never registered, so every Get loaded it again
+	sHDRELoaded.add(filename, hdre, true);
 	return hdre;
 }
 
+void HDRE::getMemoryUsage(size_t& cpu, size_t& gpu) const
+{
+	cpu = 0;
+	gpu = 0;
+	if (!data)
+		return;
+
+	size_t floats = 0;
+	int w = width;
+	for (int i = 0; i < N_LEVELS; i++)
+	{
+		floats += size_t(w) * w * N_FACES * numChannels;
+		w = (int)(width / pow(2.0, i + 1));
+	}
+	cpu = floats * sizeof(float) * 3;
+}
+
 void flipYsides(float ** data, unsigned int size, short num_channels)
 {
 	// std::cout << "Flipping Y sides" << std::endl;
@@ -5,6 +5,8 @@
 #include <string>
 #include <cassert>
 
+#include "../resource.h"
+
 #define N_LEVELS 6
 #define N_FACES 6
 
@@ -42,7 +44,7 @@ typedef struct {
 
 } sHDRELevel;
 
-class HDRE {
+class HDRE : public Resource {
 
 private:
 
@@ -71,12 +73,13 @@ public:
 	~HDRE();
 
 	// class manager
-	static std::map<std::string, HDRE*> sHDRELoaded;
+	static ResourcePool<HDRE> sHDRELoaded;
 
 	bool load(const char* filename);
 
 	static HDRE* Get(const char* filename);
-	void setName(const char* name) { sHDRELoaded[name] = this; }
+	void setName(const char* name) { sHDRELoaded.add(name, this); }
+	void getMemoryUsage(size_t& cpu, size_t& gpu) const; // data is stored three times (full, per face and per level)
 
 	// useful methods
 	float getMaxLuminance() { return this->header.maxLuminance; };
@@ -0,0 +1,67 @@
+#include "framearena.h"
+
+#include <cassert>
+#include <cstdint>
+
+FrameArena::FrameArena(size_t size)
+{
+	capacity = size;
+	block = capacity ? new char[capacity] : NULL;
+	offset = 0;
+	peak = 0;
+	overflow_bytes = 0;
+}
+
+FrameArena::~FrameArena()
+{
+	reset();
+	delete[] block;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+
+	//reserving the worst case padding keeps it to a single atomic operation
+	size_t reserved = size + alignment - 1;
+	size_t start = offset.fetch_add(reserved);
+	if (start + reserved <= capacity)
+	{
+		uintptr_t address = (uintptr_t)(block + start);
+		return (void*)((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	}
+
+	//full, from the heap until the next reset
+	char* data = new char[reserved];
+	{
+		std::lock_guard<std::mutex> lock(overflow_mutex);
+		overflow.push_back(data);
+		overflow_bytes += reserved;
+	}
+	uintptr_t address = (uintptr_t)data;
+	return (void*)((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void FrameArena::reset()
+{
+	size_t used = offset.load();
+	if (used > capacity)
+		used = capacity;
+	used += overflow_bytes;
+	if (used > peak)
+		peak = used;
+
+	for (size_t i = 0; i < overflow.size(); ++i)
+		delete[] overflow[i];
+	overflow.clear();
+
+	//grow to fit the whole frame next time
+	if (overflow_bytes)
+	{
+		delete[] block;
+		capacity = peak + peak / 2;
+		block = new char[capacity];
+	}
+	overflow_bytes = 0;
+	offset = 0;
+}
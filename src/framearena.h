@@ -0,0 +1,45 @@
+/*  Memory for data that only lives during one frame (scratch poses, temporary arrays, ...).
+	Allocating is just moving an atomic offset, so it can be used from several threads at once,
+	and everything is released at once by reset. If a frame needs more than the block, the extra
+	allocations come from the heap and the block grows on the next reset to fit them.
+*/
+
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+class FrameArena
+{
+public:
+	FrameArena(size_t size = 1024 * 1024);
+	~FrameArena();
+
+	//thread safe, the memory is not initialized, alignment must be a power of two
+	void* allocate(size_t size, size_t alignment = 16);
+	template<typename T> T* allocate(size_t num) { return (T*)allocate(sizeof(T) * num, alignof(T) > 16 ? alignof(T) : 16); }
+
+	//frees everything allocated since the last reset, call it when nobody uses that memory anymore
+	void reset();
+
+	size_t getCapacity() const { return capacity; }
+	size_t getUsed() const { size_t used = offset.load(); return used < capacity ? used : capacity; }
+	size_t getPeak() const { return peak; } //bytes needed by the biggest frame
+
+private:
+	char* block;
+	size_t capacity;
+	std::atomic<size_t> offset;
+	size_t peak;
+
+	std::mutex overflow_mutex;
+	std::vector<char*> overflow; //allocations that did not fit in the block
+	size_t overflow_bytes;
+
+	FrameArena(const FrameArena&);
+	FrameArena& operator = (const FrameArena&);
+};
+
+#endif
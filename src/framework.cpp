@@ -1,10 +1,16 @@
 #include "framework.h"
+#include "threadpool.h"
+#include "random.h"
 
 #include "includes.h"
 #include <cassert>
 #include <cmath> //for sqrt (square root) function
 #include <math.h> //atan2
 
+#ifdef FRAMEWORK_USE_SSE
+	#include <emmintrin.h>
+#endif
+
 
 #define M_PI_2 1.57079632679489661923
 
@@ -26,9 +32,9 @@ float Vector2::perpdot( const Vector2& v )
 
 void Vector2::random(float range)
 {
-	//rand returns a value between 0 and RAND_MAX
-	x = (float)(rand() / (double)RAND_MAX) * 2 * range - range; //value between -range and range
-	y = (float)(rand() / (double)RAND_MAX) * 2 * range - range; //value between -range and range
+	Random& generator = Random::getThread();
+	x = generator.nextFloat(-range, range);
+	y = generator.nextFloat(-range, range);
 }
 
 void Vector2::parseFromText(const char* text)
@@ -105,18 +111,12 @@ float Vector3::dot( const Vector3& v ) const
 
 void Vector3::random(float range)
 {
-	//rand returns a value between 0 and RAND_MAX
-	x = (float)((rand() / (double)RAND_MAX) * 2 * range - range); //value between -range and range
-	y = (float)((rand() / (double)RAND_MAX) * 2 * range - range); //value between -range and range
-	z = (float)((rand() / (double)RAND_MAX) * 2 * range - range); //value between -range and range
+	*this = Random::getThread().nextVector3(Vector3(range, range, range)); //value between -range and range
 }
 
 void Vector3::random(Vector3 range)
 {
-	//rand returns a value between 0 and RAND_MAX
-	x = (float)((rand() / (double)RAND_MAX) * 2 * range.x - range.x); //value between -range and range
-	y = (float)((rand() / (double)RAND_MAX) * 2 * range.y - range.y); //value between -range and range
-	z = (float)((rand() / (double)RAND_MAX) * 2 * range.z - range.z); //value between -range and range
+	*this = Random::getThread().nextVector3(range); //value between -range and range
 }
 
 void Vector3::setMin(const Vector3 & v)
@@ -425,18 +425,7 @@ Vector3 Matrix44::project(const Vector3& v)
 Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
-
-	unsigned int i,j,k;
-	for (i=0;i<4;i++) 	
-	{
-		for (j=0;j<4;j++) 
-		{
-			ret.M[i][j]=0.0;
-			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[i][k] * matrix.M[k][j];
-		}
-	}
-
+	multiplyMatrices(*this, matrix, ret);
 	return ret;
 }
 
@@ -532,7 +521,131 @@ void Matrix44::setFrontAndOrthonormalize(Vector3 front)
 	
 }
 
+#ifdef FRAMEWORK_USE_SSE
+//shuffles with the lanes in the order they are written (x, y, z, w)
+#define VEC_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define VEC_SWIZZLE(a, x, y, z, w) _mm_shuffle_ps(a, a, _MM_SHUFFLE(w, z, y, x))
+
+//2x2 matrices stored as (m00, m01, m10, m11): a * b, adj(a) * b and a * adj(b)
+static inline __m128 mat2Mul(__m128 a, __m128 b) { return _mm_add_ps(_mm_mul_ps(a, VEC_SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(VEC_SWIZZLE(a, 1, 0, 3, 2), VEC_SWIZZLE(b, 2, 1, 2, 1))); }
+static inline __m128 mat2AdjMul(__m128 a, __m128 b) { return _mm_sub_ps(_mm_mul_ps(VEC_SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(VEC_SWIZZLE(a, 1, 1, 2, 2), VEC_SWIZZLE(b, 2, 3, 0, 1))); }
+static inline __m128 mat2MulAdj(__m128 a, __m128 b) { return _mm_sub_ps(_mm_mul_ps(a, VEC_SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(VEC_SWIZZLE(a, 1, 0, 3, 2), VEC_SWIZZLE(b, 2, 1, 2, 1))); }
+#endif
+
+#define MATRIX_MIN_DETERMINANT 1e-20 //below it the Gauss-Jordan version decides if it can be inverted
+
 bool Matrix44::inverse()
+{
+#ifdef FRAMEWORK_USE_SSE
+	//by 2x2 blocks: | A B |
+	//               | C D |
+	__m128 r0 = _mm_loadu_ps(m), r1 = _mm_loadu_ps(m + 4), r2 = _mm_loadu_ps(m + 8), r3 = _mm_loadu_ps(m + 12);
+	__m128 A = _mm_movelh_ps(r0, r1);
+	__m128 B = _mm_movehl_ps(r1, r0);
+	__m128 C = _mm_movelh_ps(r2, r3);
+	__m128 D = _mm_movehl_ps(r3, r2);
+
+	//determinants of the blocks (|A| |B| |C| |D|)
+	__m128 det_sub = _mm_sub_ps(_mm_mul_ps(VEC_SHUFFLE(r0, r2, 0, 2, 0, 2), VEC_SHUFFLE(r1, r3, 1, 3, 1, 3)), _mm_mul_ps(VEC_SHUFFLE(r0, r2, 1, 3, 1, 3), VEC_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+	__m128 det_a = VEC_SWIZZLE(det_sub, 0, 0, 0, 0);
+	__m128 det_b = VEC_SWIZZLE(det_sub, 1, 1, 1, 1);
+	__m128 det_c = VEC_SWIZZLE(det_sub, 2, 2, 2, 2);
+	__m128 det_d = VEC_SWIZZLE(det_sub, 3, 3, 3, 3);
+
+	__m128 d_c = mat2AdjMul(D, C);
+	__m128 a_b = mat2AdjMul(A, B);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, A), mat2Mul(B, d_c));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, D), mat2Mul(C, a_b));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, C), mat2MulAdj(D, a_b));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, B), mat2MulAdj(A, d_c));
+
+	//|M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C)
+	__m128 tr = _mm_mul_ps(a_b, VEC_SWIZZLE(d_c, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, VEC_SWIZZLE(tr, 2, 3, 0, 1));
+	tr = _mm_add_ps(tr, VEC_SWIZZLE(tr, 1, 0, 3, 2));
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+	float determinant = _mm_cvtss_f32(det);
+	if (!(fabsf(determinant) > MATRIX_MIN_DETERMINANT))
+		return inverseGaussJordan();
+
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+	x = _mm_mul_ps(x, inv_det);
+	y = _mm_mul_ps(y, inv_det);
+	z = _mm_mul_ps(z, inv_det);
+	w = _mm_mul_ps(w, inv_det);
+
+	//the blocks are adjugates, undo it while storing them
+	_mm_storeu_ps(m, VEC_SHUFFLE(x, y, 3, 1, 3, 1));
+	_mm_storeu_ps(m + 4, VEC_SHUFFLE(x, y, 2, 0, 2, 0));
+	_mm_storeu_ps(m + 8, VEC_SHUFFLE(z, w, 3, 1, 3, 1));
+	_mm_storeu_ps(m + 12, VEC_SHUFFLE(z, w, 2, 0, 2, 0));
+	return true;
+#else
+	//cofactors of the transpose, the inverse of the transpose is the transpose of the inverse
+	float inv[16];
+	inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+	inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+	inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+	inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+	inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+	inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+	inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+	inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+	inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+	inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+	inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+	inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+	inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+	inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+	inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+	inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+	float determinant = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+	if (!(fabsf(determinant) > MATRIX_MIN_DETERMINANT))
+		return inverseGaussJordan();
+	float inv_det = 1.0f / determinant;
+	for (int i = 0; i < 16; ++i)
+		m[i] = inv[i] * inv_det;
+	return true;
+#endif
+}
+
+bool Matrix44::inverseAffine()
+{
+	if (m[3] != 0.0f || m[7] != 0.0f || m[11] != 0.0f || m[15] != 1.0f)
+		return inverse();
+
+	//the 3x3 part by cofactors, then the translation moved back by it
+	float c0 = m[5] * m[10] - m[6] * m[9];
+	float c1 = m[6] * m[8] - m[4] * m[10];
+	float c2 = m[4] * m[9] - m[5] * m[8];
+	float determinant = m[0] * c0 + m[1] * c1 + m[2] * c2;
+	if (!(fabsf(determinant) > MATRIX_MIN_DETERMINANT))
+		return inverseGaussJordan();
+	float inv_det = 1.0f / determinant;
+
+	float r[9];
+	r[0] = c0 * inv_det;
+	r[1] = (m[2] * m[9] - m[1] * m[10]) * inv_det;
+	r[2] = (m[1] * m[6] - m[2] * m[5]) * inv_det;
+	r[3] = c1 * inv_det;
+	r[4] = (m[0] * m[10] - m[2] * m[8]) * inv_det;
+	r[5] = (m[2] * m[4] - m[0] * m[6]) * inv_det;
+	r[6] = c2 * inv_det;
+	r[7] = (m[1] * m[8] - m[0] * m[9]) * inv_det;
+	r[8] = (m[0] * m[5] - m[1] * m[4]) * inv_det;
+
+	float tx = m[12], ty = m[13], tz = m[14];
+	m[0] = r[0]; m[1] = r[1]; m[2] = r[2];
+	m[4] = r[3]; m[5] = r[4]; m[6] = r[5];
+	m[8] = r[6]; m[9] = r[7]; m[10] = r[8];
+	m[12] = -(tx * r[0] + ty * r[3] + tz * r[6]);
+	m[13] = -(tx * r[1] + ty * r[4] + tz * r[7]);
+	m[14] = -(tx * r[2] + ty * r[5] + tz * r[8]);
+	return true;
+}
+
+bool Matrix44::inverseGaussJordan()
 {
    unsigned int i, j, k, swap;
    float t;
@@ -1183,6 +1296,11 @@ void Quaternion::setAxisAngle(float ax, float ay, float az, float angle)
 
 }
 
+float random(float range, int offset)
+{
+	return Random::getThread().nextFloat() * range + offset;
+}
+
 float ComputeSignedAngle(Vector2 a, Vector2 b)
 {
 	a.normalize();
@@ -1222,23 +1340,160 @@ float signedDistanceToPlane( const Vector4& plane, const Vector3& point )
 	return dot(plane.xyz, point) + plane.w;
 }
 
-const Vector3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
+//same box as transforming the 8 corners: the center is transformed and every axis of the result
+//gets the halfsize projected on it by the absolute value of the matrix (Arvo)
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box)
+{
+	BoundingBox result;
+	transformBoundingBoxes(m, &box, &result, 1);
+	return result;
+}
+
+void transformBoundingBoxes(const Matrix44& m, const BoundingBox* boxes, BoundingBox* out, int num)
+{
+#ifdef FRAMEWORK_USE_SSE
+	__m128 r0 = _mm_loadu_ps(m.m), r1 = _mm_loadu_ps(m.m + 4), r2 = _mm_loadu_ps(m.m + 8), r3 = _mm_loadu_ps(m.m + 12);
+	__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 a0 = _mm_and_ps(r0, abs_mask), a1 = _mm_and_ps(r1, abs_mask), a2 = _mm_and_ps(r2, abs_mask), zero = _mm_setzero_ps();
+	for (int i = 0; i < num; ++i)
+	{
+		const Vector3& c = boxes[i].center;
+		const Vector3& h = boxes[i].halfsize;
+		__m128 center = combineRows(r0, r1, r2, r3, c.x, c.y, c.z);
+		__m128 halfsize = combineRows(a0, a1, a2, zero, h.x, h.y, h.z);
+		_mm_storel_pi((__m64*)&out[i].center.x, center);
+		_mm_store_ss(&out[i].center.z, _mm_movehl_ps(center, center));
+		_mm_storel_pi((__m64*)&out[i].halfsize.x, halfsize);
+		_mm_store_ss(&out[i].halfsize.z, _mm_movehl_ps(halfsize, halfsize));
+	}
+#else
+	for (int i = 0; i < num; ++i)
+	{
+		Vector3 h = boxes[i].halfsize; //out can be boxes
+		out[i].center = m * boxes[i].center;
+		for (int j = 0; j < 3; ++j)
+			out[i].halfsize.v[j] = fabsf(m.M[0][j]) * h.x + fabsf(m.M[1][j]) * h.y + fabsf(m.M[2][j]) * h.z;
+	}
+#endif
+}
+
+void transformPoints(const Matrix44& m, const Vector3* points, Vector3* out, int num)
+{
+	transformPoints(m, points, sizeof(Vector3), out, sizeof(Vector3), num);
+}
+
+void transformVectors4(const Matrix44& m, const Vector4* in, Vector4* out, int num)
+{
+#ifdef FRAMEWORK_USE_SSE
+	__m128 r0 = _mm_loadu_ps(m.m), r1 = _mm_loadu_ps(m.m + 4), r2 = _mm_loadu_ps(m.m + 8), r3 = _mm_loadu_ps(m.m + 12);
+	for (int i = 0; i < num; ++i)
+	{
+		const Vector4& v = in[i];
+		_mm_storeu_ps(&out[i].x, combineRows(r0, r1, r2, _mm_mul_ps(_mm_set1_ps(v.w), r3), v.x, v.y, v.z));
+	}
+#else
+	for (int i = 0; i < num; ++i)
+		out[i] = m * in[i];
+#endif
+}
+
+#define TRANSFORM_VECTORS_PER_TASK 16384 //smaller arrays are not worth waking the pool
 
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
+enum { TRANSFORM_POINT, TRANSFORM_DIRECTION, TRANSFORM_NORMAL, TRANSFORM_PROJECT };
+
+//every vector is read before its output is written so in and out can be the same buffer
+static void transformRange(const Matrix44& m, int mode, const char* in, int in_stride, char* out, int out_stride, int num, const Vector3& viewport)
 {
-	Vector3 box_min(10000000.0f,1000000.0f, 1000000.0f);
-	Vector3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
+	bool translate = mode == TRANSFORM_POINT || mode == TRANSFORM_PROJECT;
+#ifdef FRAMEWORK_USE_SSE
+	__m128 r0 = _mm_loadu_ps(m.m), r1 = _mm_loadu_ps(m.m + 4), r2 = _mm_loadu_ps(m.m + 8);
+	__m128 r3 = translate ? _mm_loadu_ps(m.m + 12) : _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 half_viewport = _mm_setr_ps(viewport.x * 0.5f, viewport.y * 0.5f, viewport.z * 0.5f, 0.0f);
+	for (int i = 0; i < num; ++i)
+	{
+		const float* p = (const float*)(in + (size_t)i * in_stride);
+		__m128 v = combineRows(r0, r1, r2, r3, p[0], p[1], p[2]);
+		if (mode == TRANSFORM_NORMAL)
+		{
+			__m128 sq = _mm_mul_ps(v, v);
+			__m128 len2 = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)));
+			if (_mm_cvtss_f32(len2) > 0.0f)
+			{
+				__m128 len = _mm_sqrt_ss(len2);
+				v = _mm_div_ps(v, _mm_shuffle_ps(len, len, _MM_SHUFFLE(0, 0, 0, 0)));
+			}
+		}
+		else if (mode == TRANSFORM_PROJECT)
+			v = _mm_mul_ps(_mm_add_ps(_mm_div_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))), one), half_viewport);
+		//exactly 12 bytes, the next vector could be right after
+		float* dst = (float*)(out + (size_t)i * out_stride);
+		_mm_storel_pi((__m64*)dst, v);
+		_mm_store_ss(dst + 2, _mm_movehl_ps(v, v));
+	}
+#else
+	for (int i = 0; i < num; ++i)
+	{
+		const float* p = (const float*)(in + (size_t)i * in_stride);
+		Vector4 v = m * Vector4(p[0], p[1], p[2], translate ? 1.0f : 0.0f);
+		Vector3 result(v.x, v.y, v.z);
+		if (mode == TRANSFORM_NORMAL && result.length() > 0.0f)
+			result.normalize();
+		else if (mode == TRANSFORM_PROJECT)
+			result.set((v.x / v.w + 1.0f) * 0.5f * viewport.x, (v.y / v.w + 1.0f) * 0.5f * viewport.y, (v.z / v.w + 1.0f) * 0.5f * viewport.z);
+		float* dst = (float*)(out + (size_t)i * out_stride);
+		dst[0] = result.x;
+		dst[1] = result.y;
+		dst[2] = result.z;
+	}
+#endif
+}
 
-	for (int i = 0; i < 8; ++i)
+static void transformVectors(const Matrix44& m, int mode, const void* in, int in_stride, void* out, int out_stride, int num, const Vector3& viewport, bool multithread)
+{
+	if (!multithread || num <= TRANSFORM_VECTORS_PER_TASK)
 	{
-		Vector3 corner = corners[i];
-		corner = box.halfsize * corner;
-		corner = corner + box.center;
-		corner = m * corner;
-		box_min.setMin(corner);
-		box_max.setMax(corner);
+		transformRange(m, mode, (const char*)in, in_stride, (char*)out, out_stride, num, viewport);
+		return;
 	}
+	ThreadPool::Get()->parallelFor(num, TRANSFORM_VECTORS_PER_TASK, [&](int start, int end) {
+		transformRange(m, mode, (const char*)in + (size_t)start * in_stride, in_stride, (char*)out + (size_t)start * out_stride, out_stride, end - start, viewport);
+	});
+}
+
+void transformPoints(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread)
+{
+	transformVectors(m, TRANSFORM_POINT, in, in_stride, out, out_stride, num, Vector3(1, 1, 1), multithread);
+}
+
+void transformDirections(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread)
+{
+	transformVectors(m, TRANSFORM_DIRECTION, in, in_stride, out, out_stride, num, Vector3(1, 1, 1), multithread);
+}
 
-	Vector3 halfsize = (box_max - box_min) * 0.5;
-	return BoundingBox(box_max - halfsize, halfsize );
+//the inverse transpose of the 3x3 is the cofactor matrix divided by the determinant, every row of cofactors is the
+//cross product of the other two rows. Only the sign of the determinant matters because the result is normalized
+void transformNormals(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread)
+{
+	Vector3 a0(m.M[0][0], m.M[0][1], m.M[0][2]);
+	Vector3 a1(m.M[1][0], m.M[1][1], m.M[1][2]);
+	Vector3 a2(m.M[2][0], m.M[2][1], m.M[2][2]);
+	Vector3 c0 = a1.cross(a2);
+	Vector3 c1 = a2.cross(a0);
+	Vector3 c2 = a0.cross(a1);
+	float sign = a0.dot(c0) < 0.0f ? -1.0f : 1.0f;
+
+	Matrix44 normal_matrix;
+	for (int j = 0; j < 3; ++j)
+	{
+		normal_matrix.M[0][j] = c0.v[j] * sign;
+		normal_matrix.M[1][j] = c1.v[j] * sign;
+		normal_matrix.M[2][j] = c2.v[j] * sign;
+	}
+	transformVectors(normal_matrix, TRANSFORM_NORMAL, in, in_stride, out, out_stride, num, Vector3(1, 1, 1), multithread);
+}
+
+void projectPoints(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, const Vector3& viewport, bool multithread)
+{
+	transformVectors(m, TRANSFORM_PROJECT, in, in_stride, out, out_stride, num, viewport, multithread);
 }
@@ -8,6 +8,13 @@
 #include <vector>
 #include <cmath>
 
+//SSE2 is always available in x64 and in x86 when compiling with /arch:SSE2 (the default in MSVC)
+//the math below and the modules with SIMD paths use it when this is defined, the scalar code is used otherwise
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FRAMEWORK_USE_SSE
+	#include <emmintrin.h>
+#endif
+
 #ifndef PI
 	#define PI 3.14159265359
 #endif
@@ -21,6 +28,8 @@ typedef unsigned short uint16;
 typedef short int16;
 typedef int int32;
 typedef unsigned int uint32;
+typedef long long int64;
+typedef unsigned long long uint64;
 
 inline float clamp(float v, float a, float b) { return v < a ? a : (v > b ? b : v); }
 inline float lerp(float a, float b, float v ) { return a*(1.0-v) + b*v; }
@@ -78,6 +87,21 @@ public:
 	void set(unsigned int x, unsigned int y, unsigned int z) { this->x = x; this->y = y; this->z = z; }
 };
 
+class Vector3us
+{
+public:
+	union
+	{
+		struct { unsigned short x;
+				 unsigned short y;
+				 unsigned short z; };
+		unsigned short v[3];
+	};
+	Vector3us() { x = y = z = 0; }
+	Vector3us(unsigned short x, unsigned short y, unsigned short z) { this->x = x; this->y = y; this->z = z; }
+	void set(unsigned short x, unsigned short y, unsigned short z) { this->x = x; this->y = y; this->z = z; }
+};
+
 //*********************************
 
 class Vector3
@@ -217,7 +241,9 @@ class Matrix44
 		Vector3 topVector() { return Vector3(m[4],m[5],m[6]); }
 		Vector3 frontVector() { return Vector3(m[8],m[9],m[10]); }
 
-		bool inverse();
+		bool inverse(); //general inverse by cofactors, false if it is singular (then it is not changed)
+		bool inverseAffine(); //faster for matrices without projection (last column 0,0,0,1), any other uses inverse
+		bool inverseGaussJordan(); //slower but more stable with matrices close to singular
 		void setUpAndOrthonormalize(Vector3 up);
 		void setFrontAndOrthonormalize(Vector3 front);
 
@@ -262,6 +288,41 @@ class Matrix44
 Vector3 operator * (const Matrix44& matrix, const Vector3& v);
 Vector4 operator * (const Matrix44& matrix, const Vector4& v); 
 
+#ifdef FRAMEWORK_USE_SSE
+//x * r0 + y * r1 + z * r2 + w in this order, a row vector by the rows of a matrix (w is the fourth row or 0).
+//By reference because 32 bits MSVC cannot pass more than three __m128 by value
+inline __m128 combineRows(const __m128& r0, const __m128& r1, const __m128& r2, const __m128& w, float x, float y, float z)
+{
+	__m128 v = _mm_mul_ps(_mm_set1_ps(x), r0);
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(y), r1));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(z), r2));
+	return _mm_add_ps(v, w);
+}
+#endif
+
+//out = a * b, inlined for the loops that multiply many matrices (bone hierarchies, palettes), out can be a or b.
+//The SSE path sums in the same order as the scalar one so both give the same result
+inline void multiplyMatrices(const Matrix44& a, const Matrix44& b, Matrix44& out)
+{
+#ifdef FRAMEWORK_USE_SSE
+	//every row of the result is the rows of b weighted by a row of a
+	__m128 b0 = _mm_loadu_ps(b.m), b1 = _mm_loadu_ps(b.m + 4), b2 = _mm_loadu_ps(b.m + 8), b3 = _mm_loadu_ps(b.m + 12);
+	for (int i = 0; i < 16; i += 4)
+		_mm_storeu_ps(out.m + i, combineRows(b0, b1, b2, _mm_mul_ps(_mm_set1_ps(a.m[i + 3]), b3), a.m[i], a.m[i + 1], a.m[i + 2]));
+#else
+	float r[16];
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+		{
+			r[i * 4 + j] = 0.0f;
+			for (int k = 0; k < 4; ++k)
+				r[i * 4 + j] += a.M[i][k] * b.M[k][j];
+		}
+	for (int j = 0; j < 16; ++j)
+		out.m[j] = r[j];
+#endif
+}
+
 
 class Quaternion
 {
@@ -351,7 +412,26 @@ public:
 };
 
 //applies a transform to a AABB so it is 
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box);
+
+//batched versions of matrix * vector and transformBoundingBox for arrays under the same matrix, out can be the same array as the input
+void transformPoints(const Matrix44& m, const Vector3* points, Vector3* out, int num);
+void transformBoundingBoxes(const Matrix44& m, const BoundingBox* boxes, BoundingBox* out, int num);
+void transformVectors4(const Matrix44& m, const Vector4* in, Vector4* out, int num); //same as m * v
+
+//strided batched transforms, the stride is the bytes from one vector to the next (sizeof(Vector3) if packed) so they
+//work over interleaved vertices. out can be the same buffer as in if both use the same stride.
+//multithread splits big arrays in the thread pool
+void transformPoints(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread = false); //m * v
+void transformDirections(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread = false); //m.rotateVector(v)
+void transformNormals(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, bool multithread = false); //inverse transpose of m, normalized
+//like Matrix44::project, the result (0 to 1) is multiplied by viewport
+void projectPoints(const Matrix44& m, const void* in, int in_stride, void* out, int out_stride, int num, const Vector3& viewport = Vector3(1, 1, 1), bool multithread = false);
+
+//in place
+inline void transformPoints(const Matrix44& m, void* data, int stride, int num, bool multithread = false) { transformPoints(m, data, stride, data, stride, num, multithread); }
+inline void transformDirections(const Matrix44& m, void* data, int stride, int num, bool multithread = false) { transformDirections(m, data, stride, data, stride, num, multithread); }
+inline void transformNormals(const Matrix44& m, void* data, int stride, int num, bool multithread = false) { transformNormals(m, data, stride, data, stride, num, multithread); }
 
 enum {
 	CLIP_OUTSIDE = 0,
@@ -366,8 +446,8 @@ inline float ease(float f) { return f*f*f*(f*(f*6.0f - 15.0f) + 10.0f); }
 Vector3 RayPlaneCollision( const Vector3& plane_pos, const Vector3& plane_normal, const Vector3& ray_origin, const Vector3& ray_dir );
 Vector3 reflect(const Vector3& I, const Vector3& N);
 
-//value between 0 and 1
-inline float random(float range = 1.0f, int offset = 0) { return ((rand() % 1000) / (1000.0f)) * range + offset; }
+//value between 0 and 1 (using the generator of the calling thread, see Random)
+float random(float range = 1.0f, int offset = 0);
 
 
 typedef Vector3 vec2;
@@ -11,10 +11,13 @@
 
 #include "framework.h"
 #include "mesh.h"
+#include "ringbuffer.h"
+#include "resource.h"
 #include "camera.h"
 #include "utils.h"
 #include "input.h"
 #include "application.h"
+#include "benchmark.h"
 
 #include <iostream> //to output
 
@@ -112,6 +115,17 @@ void renderGUI(SDL_Window* window, Application * game)
 			ImGui::TreePop();
 		}
 
+		if (ImGui::TreeNode("Resources")) {
+			std::vector<ResourcePoolBase*>& pools = ResourcePoolBase::getPools();
+			for (size_t i = 0; i < pools.size(); ++i)
+				if (ImGui::TreeNode(pools[i]->name.c_str()))
+				{
+					pools[i]->renderInMenu();
+					ImGui::TreePop();
+				}
+			ImGui::TreePop();
+		}
+
 		//Scene graph
 		if (ImGui::TreeNode("Entities"))
 		{
@@ -214,6 +228,9 @@ void mainLoop(SDL_Window* window)
 			frames_this_second = 0;
 		}
 
+		//upload the meshes loaded in the background
+		Mesh::processPendingUploads();
+
 		//update game logic
 		game->update(elapsed_time);
 
@@ -222,6 +239,12 @@ void mainLoop(SDL_Window* window)
 
 		renderGUI(window, game);
 
+		//fence the per frame buffers (instances) so the next frames dont overwrite what the GPU is using
+		RingBuffer::EndFrameAll();
+
+		//free the least used resources of the pools over budget
+		ResourcePoolBase::EndFrameAll();
+
 		//check errors in opengl only when working in debug
 		#ifdef _DEBUG
 				checkGLErrors();
@@ -237,6 +260,10 @@ void mainLoop(SDL_Window* window)
 
 int main(int argc, char **argv)
 {
+	//headless benchmarks: --benchmark [name]
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+		return runBenchmarks(argc > 2 ? argv[2] : NULL);
+
 	std::cout << "Initiating engine..." << std::endl;
 
 	//prepare SDL
@@ -282,6 +282,21 @@ void PBRMaterial::renderInMenu()
 	ImGui::Checkbox("Gamma correction", &with_gamma);
 }
 
+PBRTangentMaterial::PBRTangentMaterial()
+{
+	derivatives_shader = shader;
+	shader = Shader::Get("data/shaders/basic.vs", "data/shaders/pbr.fs", "#define USE_TANGENTS\n");
+}
+
+void PBRTangentMaterial::render(Mesh* mesh, Matrix44 model, Camera* camera)
+{
+	Shader* tangents_shader = shader;
+	if (mesh && !mesh->tangents.size())
+		shader = derivatives_shader;
+	PBRMaterial::render(mesh, model, camera);
+	shader = tangents_shader;
+}
+
 PhongMaterial::PhongMaterial()
 {
 	color = vec4(1.f, 1.f, 1.f, 1.f);
@@ -6,12 +6,14 @@
 #include "light.h"
 #include "camera.h"
 #include "mesh.h"
+#include "texture.h"
 
 class Material {
 public:
 
-	Shader* shader = NULL;
-	Texture* texture = NULL;
+	//handles so the resource pools never evict what a material uses
+	ResourceHandle<Shader> shader;
+	ResourceHandle<Texture> texture;
 	vec4 color;
 
 	virtual void setUniforms(Camera* camera, Matrix44 model) = 0;
@@ -57,29 +59,29 @@ public:
 
 	// maps
 	float roughness_factor;
-	Texture* roughness_map;
+	ResourceHandle<Texture> roughness_map;
 
 	float metalness_factor;
 	bool with_direct_lighting;
 	bool with_indirect_lighting;
-	Texture* metalness_map;
+	ResourceHandle<Texture> metalness_map;
 
 	bool with_normal_map;
-	Texture* normal_map;
-	Texture* albedo_map;
-	Texture* brdf_lut;
+	ResourceHandle<Texture> normal_map;
+	ResourceHandle<Texture> albedo_map;
+	ResourceHandle<Texture> brdf_lut;
 	
 	// Optional maps
 	bool with_occlusion_map;
-	Texture* occlusion_map;
+	ResourceHandle<Texture> occlusion_map;
 	bool with_opacity_map;
-	Texture* opacity_map;
+	ResourceHandle<Texture> opacity_map;
 	
 	bool with_gamma;
 
 	// We create a collection of HDR cubemaps sorted by blur
 	// level (L2 slides, pp. 35)
-	Texture* texture_hdre_levels[5];
+	ResourceHandle<Texture> texture_hdre_levels[5];
 
 	void setUniforms(Camera* camera, Matrix44 model);
 	void setTextures(char* sky_texture);
@@ -87,6 +89,17 @@ public:
 	void renderInMenu();
 };
 
+//same as PBRMaterial but the normal map uses the tangents of the mesh instead of computing them per pixel
+//meshes without tangents (see Mesh::computeTangents) are rendered with the regular PBR shader
+class PBRTangentMaterial : public PBRMaterial {
+public:
+	ResourceHandle<Shader> derivatives_shader;
+
+	PBRTangentMaterial();
+
+	void render(Mesh* mesh, Matrix44 model, Camera * camera);
+};
+
 class PhongMaterial : public StandardMaterial {
 public:
 
@@ -7,20 +7,35 @@
 
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 #include <limits>
+#include <deque>
+#include <mutex>
 #include <sys/stat.h>
 
 #include "camera.h"
 #include "texture.h"
 #include "animation.h"
-#include "extra/coldet/coldet.h"
+#include "bvh.h"
+#include "threadpool.h"
+#include "ringbuffer.h"
+#include "terrain.h"
+#include "skinning.h"
 
-std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
+ResourcePool<Mesh> Mesh::sMeshesLoaded("Meshes");
 bool Mesh::use_binary = true;
 bool Mesh::auto_upload_to_vram = true;
 bool Mesh::interleave_meshes = true;
+bool Mesh::generate_tangents = true;
+bool Mesh::cache_collision_models = true;
+bool Mesh::background_collision_models = false;
+bool Mesh::use_vertex_array_objects = true;
+bool Mesh::use_16bit_indices = true;
+bool Mesh::split_indices_16bit = false;
+bool Mesh::use_cpu_skinning = false;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
+long Mesh::num_buffer_setups = 0;
 
 #define FORMAT_ASE 1
 #define FORMAT_OBJ 2
@@ -30,8 +45,11 @@ long Mesh::num_triangles_rendered = 0;
 Mesh::Mesh()
 {
 	radius = 0;
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = tangents_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	collision_model_ready = false;
+	skin_bindings = NULL;
+	load_state = LOAD_READY;
 	clear();
 }
 
@@ -52,6 +70,8 @@ void Mesh::clear()
 		glDeleteBuffersARB(1,&normals_vbo_id);
 	if (colors_vbo_id) 
 		glDeleteBuffersARB(1,&colors_vbo_id);
+	if (tangents_vbo_id)
+		glDeleteBuffersARB(1, &tangents_vbo_id);
 	if (interleaved_vbo_id)
 		glDeleteBuffersARB(1, &interleaved_vbo_id);
 	if (indices_vbo_id)
@@ -61,29 +81,101 @@ void Mesh::clear()
 	if (weights_vbo_id)
 		glDeleteBuffersARB(1, &weights_vbo_id);
 
+	releaseVAOs();
+
 	//VBOs ids
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = tangents_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = 0;
 
 	//buffers
 	vertices.clear();
 	normals.clear();
 	uvs.clear();
 	colors.clear();
+	tangents.clear();
 	interleaved.clear();
 	indices.clear();
+	indices16.clear();
+	index_chunks.clear();
 	bones.clear();
 	weights.clear();
+	for (sSkinBinding* binding = skin_bindings; binding;)
+	{
+		sSkinBinding* next = binding->next;
+		delete binding;
+		binding = next;
+	}
+	skin_bindings = NULL;
 
-	if (collision_model)
-		delete collision_model;
+	releaseCollisionModel();
+	edited = false;
 }
 
 int vertex_location = 1;
 int normal_location = 1;
 int uv_location = 1;
 int color_location = -1;
+int tangent_location = -1;
 int bones_location = -1;
 int weights_location = -1;
+GLuint bound_vao = 0; //while it is set drawCall doesnt bind the index buffer, the VAO has it
+
+unsigned int InstanceLayout::s_last_uid = 0;
+InstanceLayout InstanceLayout::model = InstanceLayout().add("u_model", 16);
+
+InstanceLayout::InstanceLayout()
+{
+	stride = 0;
+	uid = 0;
+}
+
+InstanceLayout& InstanceLayout::add(const char* name, int num_floats)
+{
+	Attribute attribute;
+	attribute.name = name;
+	attribute.num_floats = num_floats;
+	attribute.offset = stride;
+	attributes.push_back(attribute);
+	stride += num_floats * sizeof(float);
+	uid = ++s_last_uid; //VAOs recorded with the previous attributes are not valid
+	return *this;
+}
+
+//points the attributes of the layout to the instances buffer bound, offset is where the first instance starts
+void enableInstanceAttributes(Shader* shader, const InstanceLayout& layout, unsigned int offset)
+{
+	for (size_t i = 0; i < layout.attributes.size(); ++i)
+	{
+		const InstanceLayout::Attribute& attribute = layout.attributes[i];
+		int location = shader->getAttribLocation(attribute.name);
+		if (location == -1)
+			continue;
+
+		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
+		for (int k = 0; k * 4 < attribute.num_floats; ++k)
+		{
+			int num = std::min(attribute.num_floats - k * 4, 4);
+			glEnableVertexAttribArray(location + k);
+			glVertexAttribPointer(location + k, num, GL_FLOAT, GL_FALSE, layout.stride, (void*)(size_t)(offset + attribute.offset + k * 4 * sizeof(float)));
+			glVertexAttribDivisor(location + k, 1); // This makes it instanced!
+		}
+	}
+}
+
+void disableInstanceAttributes(Shader* shader, const InstanceLayout& layout)
+{
+	for (size_t i = 0; i < layout.attributes.size(); ++i)
+	{
+		const InstanceLayout::Attribute& attribute = layout.attributes[i];
+		int location = shader->getAttribLocation(attribute.name);
+		if (location == -1)
+			continue;
+		for (int k = 0; k * 4 < attribute.num_floats; ++k)
+		{
+			glDisableVertexAttribArray(location + k);
+			glVertexAttribDivisor(location + k, 0);
+		}
+	}
+}
 
 void Mesh::enableBuffers(Shader* sh)
 {
@@ -165,6 +257,23 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 
+	tangent_location = -1;
+	if (tangents.size())
+	{
+		tangent_location = sh->getAttribLocation("a_tangent");
+		if (tangent_location != -1)
+		{
+			glEnableVertexAttribArray(tangent_location);
+			if (tangents_vbo_id)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, tangents_vbo_id);
+				glVertexAttribPointer(tangent_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+			}
+			else
+				glVertexAttribPointer(tangent_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, &tangents[0]);
+		}
+	}
+
 	bones_location = -1;
 	if (bones.size())
 	{
@@ -204,6 +313,10 @@ void Mesh::enableBuffers(Shader* sh)
 
 void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 {
+	if (load_state != LOAD_READY)
+		return; //still loading in the background
+	touch();
+
 	Shader* shader = Shader::current;
 	if (!shader || !shader->compiled)
 	{
@@ -212,22 +325,103 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	}
 	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
 
-	//bind buffers to attribute locations
-	enableBuffers(shader);
+	//bind buffers to attribute locations (the VAO already has them)
+	unsigned int vao = getVAO(shader);
+	if (vao)
+		glBindVertexArray(vao);
+	else
+		enableBuffers(shader);
+	bound_vao = vao;
 
 	//draw call
 	drawCall(primitive, submesh_id, num_instances);
 
 	//unbind them
-	disableBuffers(shader);
+	bound_vao = 0;
+	if (vao)
+		glBindVertexArray(0);
+	else
+		disableBuffers(shader);
+}
+
+unsigned int Mesh::getVAO(Shader* shader, const InstanceLayout* layout, unsigned int instances_buffer)
+{
+	if (!use_vertex_array_objects || glGenVertexArrays == 0 || (!vertices_vbo_id && !interleaved_vbo_id))
+		return 0;
+
+	unsigned long long key = shader->uid;
+	if (layout)
+		key |= (unsigned long long)layout->uid << 32;
+
+	std::map<unsigned long long, unsigned int>::iterator it = vaos.find(key);
+	if (it != vaos.end())
+		return it->second;
+
+	//the VAOs of shaders that were destroyed or recompiled are never used again
+	for (it = vaos.begin(); it != vaos.end();)
+	{
+		if (Shader::isLiveUID((unsigned int)(it->first & 0xFFFFFFFF)))
+		{
+			++it;
+			continue;
+		}
+		glDeleteVertexArrays(1, &it->second);
+		it = vaos.erase(it);
+	}
+
+	//record the attribute pointers and the index buffer once for this shader
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	enableBuffers(shader);
+	if (indices_vbo_id)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	if (layout)
+	{
+		//the instances are selected with the base instance of the draw, so the pointers start at 0
+		glBindBuffer(GL_ARRAY_BUFFER, instances_buffer);
+		enableInstanceAttributes(shader, *layout, 0);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	assert(glGetError() == GL_NO_ERROR);
+
+	vaos[key] = vao;
+	return vao;
+}
+
+void Mesh::releaseVAOs()
+{
+	for (std::map<unsigned long long, unsigned int>::iterator it = vaos.begin(); it != vaos.end(); ++it)
+		glDeleteVertexArrays(1, &it->second);
+	vaos.clear();
+}
+
+//picks the glDrawElements variant that supports the parameters used
+static void drawElements(unsigned int primitive, int count, GLenum type, size_t offset, int num_instances, int base_instance, int base_vertex)
+{
+	if (num_instances > 0)
+	{
+		if (base_vertex)
+			glDrawElementsInstancedBaseVertexBaseInstance(primitive, count, type, (void*)offset, num_instances, base_vertex, base_instance);
+		else if (base_instance)
+			glDrawElementsInstancedBaseInstance(primitive, count, type, (void*)offset, num_instances, base_instance);
+		else
+			glDrawElementsInstanced(primitive, count, type, (void*)offset, num_instances);
+	}
+	else if (base_vertex)
+		glDrawElementsBaseVertex(primitive, count, type, (void*)offset, base_vertex);
+	else
+		glDrawElements(primitive, count, type, (void*)offset);
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int base_instance)
 {
 	int start = 0;
 	int size = vertices.size();
-	if (indices.size())
-		size = indices.size();
+	if (isIndexed())
+		size = getNumIndexedTriangles();
 	else if (interleaved.size())
 		size = interleaved.size();
 
@@ -240,30 +434,39 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 	}
 
 	//DRAW
-	if (indices.size())
+	if (isIndexed())
 	{
-		if (num_instances > 0)
-		{
-			assert(indices_vbo_id && "indices must be uploaded to the GPU");
+		assert((indices_vbo_id || !num_instances) && "indices must be uploaded to the GPU");
+		bool is_16bit = indices16.size() > 0;
+		GLenum type = is_16bit ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		size_t triangle_bytes = is_16bit ? sizeof(Vector3us) : sizeof(Vector3u);
+		size_t base = 0; //offset in the VBO or address of the indices in RAM
+		if (!indices_vbo_id)
+			base = is_16bit ? (size_t)&indices16[0] : (size_t)&indices[0];
+
+		if (indices_vbo_id && !bound_vao) //the VAO keeps the index buffer bound
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3)), num_instances);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		}
-		else
+
+		if (index_chunks.size()) //split mesh, every chunk has its own base vertex
 		{
-			if (indices_vbo_id)
+			assert(submesh_id == 0 && "split meshes cannot render submeshes");
+			for (unsigned int i = 0; i < index_chunks.size(); ++i)
 			{
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				const sIndexChunk& chunk = index_chunks[i];
+				drawElements(primitive, chunk.num * 3, type, base + chunk.start * triangle_bytes, num_instances, base_instance, chunk.base_vertex);
 			}
-			else
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&indices[0] + start)); //no multiply, its a vector3u pointer)
 		}
+		else
+			drawElements(primitive, size * 3, type, base + start * triangle_bytes, num_instances, base_instance, 0);
+
+		if (indices_vbo_id && !bound_vao)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 	else
 	{
-		if (num_instances > 0)
+		if (num_instances > 0 && base_instance)
+			glDrawArraysInstancedBaseInstance(primitive, start, size, num_instances, base_instance);
+		else if (num_instances > 0)
 			glDrawArraysInstanced(primitive, start, size, num_instances);
 		else
 			glDrawArrays(primitive, start, size);
@@ -281,52 +484,93 @@ void Mesh::disableBuffers(Shader* shader)
 	if (normal_location != -1) glDisableVertexAttribArray(normal_location);
 	if (uv_location != -1) glDisableVertexAttribArray(uv_location);
 	if (color_location != -1) glDisableVertexAttribArray(color_location);
+	if (tangent_location != -1) glDisableVertexAttribArray(tangent_location);
 	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
 	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
 	assert(glGetError() == GL_NO_ERROR);
+	num_buffer_setups++;
 }
 
-GLuint instances_buffer_id = 0;
+#define INSTANCES_RING_SIZE (16 * 1024 * 1024) //bytes per frame, 250k matrices
+
+RingBuffer* instances_ring = NULL; //shared by all the instanced draws of a frame
+GLuint instances_buffer_id = 0; //used when the ring is not supported or it is full
 
-//should be faster but in some system it is slower
 void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
+{
+	renderInstanced(primitive, instanced_models, num_instances, InstanceLayout::model);
+}
+
+void Mesh::renderInstanced(unsigned int primitive, const void* instances_data, int num_instances, const InstanceLayout& layout)
 {
 	if (!num_instances)
 		return;
 
+	if (load_state != LOAD_READY)
+		return;
+	touch();
+
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
+	assert(layout.stride && "the instance layout has no attributes");
+	assert(shader->getAttribLocation(layout.attributes[0].name) != -1 && "shader must have the instance attributes (not uniforms)");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
+	unsigned int size = num_instances * layout.stride;
 
-	int attribLocation = shader->getAttribLocation("u_model");
-	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
-	if (attribLocation == -1)
-		return; //this shader doesnt support instanced model
-
-	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
-	for (int k = 0; k < 4; ++k)
+	//copy the instances to the ring, the VAO of this layout already points to it and base_instance selects them
+	if (!instances_ring && use_vertex_array_objects && RingBuffer::isSupported() && glDrawElementsInstancedBaseInstance != 0 && glDrawArraysInstancedBaseInstance != 0)
+		instances_ring = new RingBuffer(INSTANCES_RING_SIZE);
+	unsigned int vao = instances_ring ? getVAO(shader, &layout, instances_ring->buffer_id) : 0;
+	if (vao)
 	{
-		glEnableVertexAttribArray(attribLocation + k );
-		int offset = sizeof(float) * 4 * k;
-		const Uint8* addr = (Uint8*) offset;
-		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr); 
-		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
+		unsigned int offset = 0;
+		void* dst = instances_ring->allocate(size, layout.stride, offset); //aligned to the stride so it is a whole instance
+		if (dst)
+		{
+			memcpy(dst, instances_data, size);
+			instances_ring->commit();
+
+			glBindVertexArray(vao);
+			bound_vao = vao;
+			drawCall(primitive, 0, num_instances, offset / layout.stride);
+			bound_vao = 0;
+			glBindVertexArray(0);
+			return;
+		}
+
+		static bool warned = false;
+		if (!warned)
+			std::cout << "[WARN] instances ring buffer full this frame, increase INSTANCES_RING_SIZE" << std::endl;
+		warned = true;
 	}
 
-	//regular render
-	render(primitive, 0, num_instances);
+	//stream them in a buffer orphaned every draw
+	if (instances_buffer_id == 0)
+		glGenBuffersARB(1, &instances_buffer_id);
+
+	//the instanced attribs are added to the VAO while drawing and removed after, so it can be reused
+	vao = getVAO(shader);
+	if (vao)
+		glBindVertexArray(vao);
+	else
+		enableBuffers(shader);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, size, instances_data, GL_STREAM_DRAW_ARB);
+	enableInstanceAttributes(shader, layout, 0);
+
+	bound_vao = vao;
+	drawCall(primitive, 0, num_instances);
+	bound_vao = 0;
 
 	//disable instanced attribs
-	for (int k = 0; k < 4; ++k)
-	{
-		glDisableVertexAttribArray(attribLocation + k);
-		glVertexAttribDivisor(attribLocation + k, 0);
-	}
+	disableInstanceAttributes(shader, layout);
+
+	if (vao)
+		glBindVertexArray(0);
+	else
+		disableBuffers(shader);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 }
 
 //super obsolete rendering method, do not use
@@ -399,11 +643,60 @@ void Mesh::renderFixedPipeline(int primitive)
 	glBindBuffer(GL_ARRAY_BUFFER, 0); //if it crashes, comment this line
 }
 
+#define SKINNING_RING_SIZE (32 * 1024 * 1024) //bytes per frame, 1.4M skinned vertices
+
+RingBuffer* skinning_ring = NULL; //deformed vertices of the meshes skinned in the CPU this frame
+
 void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 {
 	Shader* shader = Shader::current;
 	std::vector<Matrix44> bone_matrices;
 	assert(bones.size());
+
+	if (use_cpu_skinning && bones_info.size())
+	{
+		if (load_state != LOAD_READY)
+			return;
+		touch();
+		skeleton->computeFinalBoneMatrices(bone_matrices, this);
+
+		//written straight to VRAM when the ring is persistent, from RAM otherwise
+		unsigned int num_vertices = getNumVertices();
+		unsigned int size = num_vertices * sizeof(sSkinnedVertex);
+		if (!skinning_ring && RingBuffer::isSupported())
+			skinning_ring = new RingBuffer(SKINNING_RING_SIZE);
+		unsigned int offset = 0;
+		sSkinnedVertex* dst = skinning_ring && size <= SKINNING_RING_SIZE ? (sSkinnedVertex*)skinning_ring->allocate(size, sizeof(sSkinnedVertex), offset) : NULL;
+		bool in_ring = dst != NULL;
+		static std::vector<sSkinnedVertex> skinned; //when the ring is not available or full
+		if (!in_ring)
+		{
+			skinned.resize(num_vertices);
+			dst = &skinned[0];
+		}
+		skinVertices(this, &bone_matrices[0], (int)bone_matrices.size(), dst);
+		if (in_ring)
+			skinning_ring->commit();
+
+		//the static attributes come from the mesh, position and normal from the deformed stream
+		enableBuffers(shader);
+		if (vertex_location == -1)
+			return;
+		if (bones_location != -1)
+			glDisableVertexAttribArray(bones_location);
+		if (weights_location != -1)
+			glDisableVertexAttribArray(weights_location);
+		bones_location = weights_location = -1;
+		glBindBuffer(GL_ARRAY_BUFFER, in_ring ? skinning_ring->buffer_id : 0);
+		const char* base = in_ring ? (const char*)(size_t)offset : (const char*)dst;
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, sizeof(sSkinnedVertex), base);
+		if (normal_location != -1)
+			glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, sizeof(sSkinnedVertex), base + sizeof(Vector3));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		drawCall(primitive, 0, 0);
+		disableBuffers(shader);
+		return;
+	}
 	int bones_loc = shader->getUniformLocation("u_bones");
 	if (bones_loc != -1)
 	{
@@ -418,6 +711,9 @@ void Mesh::uploadToVRAM()
 {
 	assert(vertices.size() || interleaved.size());
 
+	//the streams could be different now, VAOs are recorded again when needed
+	releaseVAOs();
+
 	if (glGenBuffersARB == 0)
 	{
 		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
@@ -468,6 +764,15 @@ void Mesh::uploadToVRAM()
 		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
 	}
 
+	// Tangents
+	if (tangents.size())
+	{
+		if (tangents_vbo_id == 0)
+			glGenBuffersARB(1, &tangents_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, tangents_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, tangents.size() * sizeof(Vector4ub), &tangents[0], GL_STATIC_DRAW_ARB);
+	}
+
 	if (bones.size())
 	{
 		if (bones_vbo_id == 0)
@@ -486,105 +791,161 @@ void Mesh::uploadToVRAM()
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
 	// Indices
-	if (indices.size())
+	if (isIndexed())
 	{
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Vector3u), &indices[0], GL_STATIC_DRAW_ARB);
+		if (indices16.size())
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices16.size() * sizeof(Vector3us), &indices16[0], GL_STATIC_DRAW_ARB);
+		else
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Vector3u), &indices[0], GL_STATIC_DRAW_ARB);
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 
 
 	checkGLErrors();
+	sMeshesLoaded.update(this);
 
 	//clear buffers to save memory
 }
 
+//several threads can query the same mesh, the first one builds the BVH and the others wait for it.
+//If the background build did not start yet it is built here and the task finds it done
 bool Mesh::createCollisionModel(bool is_static)
 {
-	if (collision_model)
-		return true;
-
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+	//the buffers are still being written by the loader
+	if (load_state != LOAD_READY)
+		return false;
 
-	if (indices.size()) //indexed
+	std::lock_guard<std::mutex> lock(collision_model_mutex);
+	if (!collision_model)
 	{
-		collision_model->setTriangleNumber(indices.size());
+		collision_model = buildCollisionModel(); //the pool counts it in its next trim, it can run in any thread
+		collision_model_ready = collision_model != NULL;
+	}
+	return collision_model != NULL;
+}
 
-		if (interleaved.size())
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = interleaved[indices[i].x];
-				auto v2 = interleaved[indices[i].y];
-				auto v3 = interleaved[indices[i].z];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-			for (unsigned int i = 0; i < indices.size(); ++i)
+void Mesh::createCollisionModelAsync()
+{
+	if (load_state != LOAD_READY)
+		return;
+
+	std::lock_guard<std::mutex> lock(collision_model_mutex);
+	if (collision_model || collision_model_task.valid())
+		return;
+	collision_model_task = ThreadPool::Get()->enqueue([this]() {
+		std::lock_guard<std::mutex> lock(collision_model_mutex);
+		if (!collision_model)
+		{
+			collision_model = buildCollisionModel();
+			collision_model_ready = collision_model != NULL;
+		}
+	});
+}
+
+bool Mesh::isCollisionModelReady()
+{
+	//set after the BVH is stored, so a true here means it is complete even if another thread holds the mutex
+	return collision_model_ready;
+}
+
+void Mesh::releaseCollisionModel()
+{
+	//the worker could still be reading the buffers
+	if (collision_model_task.valid())
+		collision_model_task.get();
+	std::lock_guard<std::mutex> lock(collision_model_mutex);
+	collision_model_ready = false;
+	if (collision_model)
+		delete (BVH*)collision_model;
+	collision_model = NULL;
+}
+
+BVH* Mesh::buildCollisionModel()
+{
+	//triangle soup in object space, the transform is applied to the query instead of the triangles
+	std::vector<Vector3> triangles;
+	if (isIndexed()) //indexed
+	{
+		unsigned int num_triangles = getNumIndexedTriangles();
+		triangles.resize(num_triangles * 3);
+		for (unsigned int i = 0; i < num_triangles; ++i)
+		{
+			Vector3u triangle = getTriangleIndices(i);
+			for (int j = 0; j < 3; ++j)
 			{
-				auto v1 = vertices[indices[i].x];
-				auto v2 = vertices[indices[i].y];
-				auto v3 = vertices[indices[i].z];
-				collision_model->addTriangle(v1.v, v2.v, v3.v);
+				unsigned int index = triangle.v[j];
+				triangles[i * 3 + j] = interleaved.size() ? interleaved[index].vertex : vertices[index];
 			}
+		}
 	}
 	else if (interleaved.size()) //is interleaved
 	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
+		triangles.resize(interleaved.size());
+		for (unsigned int i = 0; i < interleaved.size(); ++i)
+			triangles[i] = interleaved[i].vertex;
 	}
 	else if (vertices.size()) //non interleaved
-	{
-		collision_model->setTriangleNumber(vertices.size() / 3);
-		for (unsigned int i = 0; i < vertices.size(); i+=3)
-		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
+		triangles = vertices;
 	else
 	{
 		assert(0 && "mesh without vertices, cannot create collision model");
-		return false;
+		return NULL;
 	}
-	collision_model->finalize();
-	this->collision_model = collision_model;
-	return true;
+
+	BVH* bvh = new BVH();
+
+	//try to reuse the one stored in disk, only if it was built from the same vertices (the mesh file could be regenerated)
+	std::string bvh_filename = name + ".bvh";
+	bool use_cache = cache_collision_models && name.size() && !edited;
+	bool cached = use_cache && bvh->readBin(bvh_filename.c_str()) &&
+		bvh->num_triangles == triangles.size() / 3 && bvh->source_hash == BVH::hashVertices(triangles);
+	if (!cached)
+	{
+		bvh->build(triangles);
+		if (use_cache)
+			bvh->writeBin(bvh_filename.c_str());
+	}
+
+	return bvh;
 }
 
 //help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
 bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space )
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
+	if (!createCollisionModel())
+		return false;
 
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	BVH* bvh = (BVH*)this->collision_model;
+	assert(bvh && "BVH must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform( model.m );
-	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
-		return false;
+	//move the ray to object space, t is the same in both spaces as long as the direction is transformed too
+	Matrix44 inv = model;
+	inv.inverseAffine();
+	Vector3 local_start = inv * start;
+	Vector3 local_front = inv.rotateVector(front);
 
-	collision_model->getCollisionPoint( collision.v, in_object_space);
+	float t = 0.0f;
+	int triangle = bvh->testRay(local_start, local_front, max_ray_dist, t);
+	if (triangle == -1)
+		return false;
 
-	float t1[9],t2[9];
-	collision_model->getCollidingTriangles(t1,t2, in_object_space);
+	Vector3 t1, t2, t3;
+	bvh->getTriangle(triangle, t1, t2, t3);
+	collision = local_start + local_front * t;
+	if (!in_object_space)
+	{
+		collision = model * collision;
+		t1 = model * t1;
+		t2 = model * t2;
+		t3 = model * t3;
+	}
 
-	Vector3 v1;
-	Vector3 v2;
-	v1=Vector3(t1[3]-t1[0],t1[4]-t1[1],t1[5]-t1[2]);
-	v2=Vector3(t1[6]-t1[0],t1[7]-t1[1],t1[8]-t1[2]);
+	Vector3 v1 = t2 - t1;
+	Vector3 v2 = t3 - t1;
 	v1.normalize();
 	v2.normalize();
 	normal = v1.cross(v2);
@@ -594,26 +955,21 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector
 
 bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal)
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
-
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
-
-	collision_model->setTransform(model.m);
-	if (collision_model->sphereCollision(center.v, radius) == false)
+	if (!createCollisionModel())
 		return false;
 
-	collision_model->getCollisionPoint(collision.v, false);
+	BVH* bvh = (BVH*)this->collision_model;
+	assert(bvh && "BVH must be created before using it, call createCollisionModel");
 
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
+	//the radius cannot be moved to object space if the scale is not uniform, so the test is done in world space
+	int triangle = bvh->testSphere(model, center, radius, collision);
+	if (triangle == -1)
+		return false;
 
-	Vector3 v1;
-	Vector3 v2;
-	v1 = Vector3(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
+	Vector3 t1, t2, t3;
+	bvh->getTriangle(triangle, t1, t2, t3);
+	Vector3 v1 = model * t2 - model * t1;
+	Vector3 v2 = model * t3 - model * t1;
 	v1.normalize();
 	v2.normalize();
 	normal = v1.cross(v2);
@@ -621,6 +977,149 @@ bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vec
 	return true;
 }
 
+void RayBatch::resize(unsigned int num)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		origin[i].resize(num);
+		direction[i].resize(num);
+	}
+	max_t.resize(num);
+}
+
+void RayBatch::set(unsigned int i, const Vector3& origin, const Vector3& direction, float max_t)
+{
+	for (int j = 0; j < 3; ++j)
+	{
+		this->origin[j][i] = origin.v[j];
+		this->direction[j][i] = direction.v[j];
+	}
+	this->max_t[i] = max_t;
+}
+
+#define RAYS_PER_TASK 256 //must be a multiple of 4
+
+//tests a range of rays against several meshes keeping the closest hit of every ray, rays are moved to the space of every mesh in groups of four
+static void testRaysRange(Mesh** meshes, const Matrix44* models, const Matrix44* inv_models, int num_meshes, const RayBatch& rays, RayHit* hits, int start, int end, bool in_object_space)
+{
+	for (int i = start; i < end; i += 4)
+	{
+		int num = end - i < 4 ? end - i : 4;
+		float max_t[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			max_t[k] = k < num ? rays.max_t[i + k] : -1.0f; //negative max_t disables the unused lanes
+			if (k < num)
+			{
+				hits[i + k].triangle = -1;
+				hits[i + k].mesh = -1;
+			}
+		}
+
+		for (int j = 0; j < num_meshes; ++j)
+		{
+			BVH* bvh = (BVH*)meshes[j]->collision_model;
+			if (!bvh)
+				continue;
+
+			Vector3 o[4];
+			Vector3 d[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				int ray = i + (k < num ? k : 0);
+				o[k].set(rays.origin[0][ray], rays.origin[1][ray], rays.origin[2][ray]);
+				d[k].set(rays.direction[0][ray], rays.direction[1][ray], rays.direction[2][ray]);
+			}
+			transformPoints(inv_models[j], o, o, 4);
+			transformDirections(inv_models[j], d, sizeof(Vector3), 4);
+
+			float origin[3][4];
+			float direction[3][4];
+			int octant[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					origin[c][k] = o[k].v[c];
+					direction[c][k] = d[k].v[c];
+				}
+				octant[k] = (d[k].x < 0.0f) | ((d[k].y < 0.0f) << 1) | ((d[k].z < 0.0f) << 2);
+			}
+
+			float t[4] = { max_t[0], max_t[1], max_t[2], max_t[3] };
+			int triangles[4];
+			bool coherent = octant[0] == octant[1] && octant[0] == octant[2] && octant[0] == octant[3];
+			if (coherent)
+				bvh->testRay4(origin, direction, t, triangles);
+			else
+				for (int k = 0; k < num; ++k)
+					triangles[k] = bvh->testRay(Vector3(origin[0][k], origin[1][k], origin[2][k]), Vector3(direction[0][k], direction[1][k], direction[2][k]), max_t[k], t[k]);
+
+			for (int k = 0; k < num; ++k)
+				if (triangles[k] != -1)
+				{
+					max_t[k] = t[k];
+					hits[i + k].t = t[k];
+					hits[i + k].triangle = triangles[k];
+					hits[i + k].mesh = j;
+				}
+		}
+
+		//same normal as testRayCollision
+		for (int k = 0; k < num; ++k)
+		{
+			RayHit& hit = hits[i + k];
+			if (hit.triangle == -1)
+				continue;
+			Vector3 v0, v1, v2;
+			((BVH*)meshes[hit.mesh]->collision_model)->getTriangle(hit.triangle, v0, v1, v2);
+			Vector3 e1 = v1 - v0;
+			Vector3 e2 = v2 - v0;
+			if (!in_object_space)
+			{
+				e1 = models[hit.mesh].rotateVector(e1);
+				e2 = models[hit.mesh].rotateVector(e2);
+			}
+			e1.normalize();
+			e2.normalize();
+			hit.normal = e1.cross(e2);
+		}
+	}
+}
+
+static void testRaysBatch(Mesh** meshes, const Matrix44* models, int num_meshes, const RayBatch& rays, std::vector<RayHit>& hits, bool in_object_space)
+{
+	hits.resize(rays.size());
+	if (!rays.size())
+		return;
+
+	//collision models are built here because it is not safe to do it from the workers
+	std::vector<Matrix44> inv_models(num_meshes);
+	for (int i = 0; i < num_meshes; ++i)
+	{
+		meshes[i]->createCollisionModel();
+		inv_models[i] = models[i];
+		inv_models[i].inverseAffine();
+	}
+
+	RayHit* hits_data = &hits[0];
+	const Matrix44* inv_data = inv_models.data();
+	ThreadPool::Get()->parallelFor(rays.size(), RAYS_PER_TASK, [&](int start, int end) {
+		testRaysRange(meshes, models, inv_data, num_meshes, rays, hits_data, start, end, in_object_space);
+	});
+}
+
+void Mesh::testRaysCollision(const Matrix44& model, const RayBatch& rays, std::vector<RayHit>& hits, bool in_object_space)
+{
+	Mesh* mesh = this;
+	testRaysBatch(&mesh, &model, 1, rays, hits, in_object_space);
+}
+
+void Mesh::testRaysCollision(Mesh** meshes, const Matrix44* models, int num_meshes, const RayBatch& rays, std::vector<RayHit>& hits)
+{
+	testRaysBatch(meshes, models, num_meshes, rays, hits, false);
+}
+
 bool Mesh::interleaveBuffers()
 {
 	if (!vertices.size() || !normals.size() || !uvs.size())
@@ -644,6 +1143,240 @@ bool Mesh::interleaveBuffers()
 	return true;
 }
 
+Vector3u Mesh::getTriangleIndices(unsigned int i) const
+{
+	if (indices.size())
+		return indices[i];
+
+	const Vector3us& triangle = indices16[i];
+	unsigned int base = 0;
+	if (index_chunks.size())
+	{
+		//last chunk that starts before the triangle
+		unsigned int first = 0, last = index_chunks.size() - 1;
+		while (first < last)
+		{
+			unsigned int middle = (first + last + 1) / 2;
+			if (index_chunks[middle].start <= i)
+				first = middle;
+			else
+				last = middle - 1;
+		}
+		base = index_chunks[first].base_vertex;
+	}
+	return Vector3u(triangle.x + base, triangle.y + base, triangle.z + base);
+}
+
+#define MAX_16BIT_VERTICES 65536
+#define MIN_TRIANGLES_PER_CHUNK 1024 //if the split needs smaller chunks the vertices are too scattered and it is not worth it
+
+bool Mesh::narrowIndices()
+{
+	if (!indices.size())
+		return false;
+
+	std::vector<sIndexChunk> chunks;
+	if (getNumVertices() > MAX_16BIT_VERTICES)
+	{
+		if (!split_indices_16bit)
+			return false;
+
+		//greedy: every chunk grows while the range of vertices it uses fits in 16 bits
+		sIndexChunk chunk;
+		chunk.start = chunk.num = chunk.base_vertex = 0;
+		unsigned int min_index = 0, max_index = 0;
+		for (unsigned int i = 0; i < indices.size(); ++i)
+		{
+			const Vector3u& t = indices[i];
+			unsigned int t_min = std::min(t.x, std::min(t.y, t.z));
+			unsigned int t_max = std::max(t.x, std::max(t.y, t.z));
+			if (t_max - t_min >= MAX_16BIT_VERTICES)
+				return false;
+			if (chunk.num && (std::max(max_index, t_max) - std::min(min_index, t_min) >= MAX_16BIT_VERTICES))
+			{
+				chunk.base_vertex = min_index;
+				chunks.push_back(chunk);
+				chunk.start = i;
+				chunk.num = 0;
+			}
+			min_index = chunk.num ? std::min(min_index, t_min) : t_min;
+			max_index = chunk.num ? std::max(max_index, t_max) : t_max;
+			chunk.num++;
+		}
+		chunk.base_vertex = min_index;
+		chunks.push_back(chunk);
+
+		if (chunks.size() * MIN_TRIANGLES_PER_CHUNK > indices.size())
+			return false;
+	}
+
+	indices16.resize(indices.size());
+	if (chunks.empty())
+	{
+		for (unsigned int i = 0; i < indices.size(); ++i)
+			indices16[i].set(indices[i].x, indices[i].y, indices[i].z);
+	}
+	else
+		for (unsigned int i = 0; i < chunks.size(); ++i)
+		{
+			unsigned int base = chunks[i].base_vertex;
+			for (unsigned int j = chunks[i].start; j < chunks[i].start + chunks[i].num; ++j)
+				indices16[j].set(indices[j].x - base, indices[j].y - base, indices[j].z - base);
+		}
+
+	index_chunks = chunks;
+	std::vector<Vector3u>().swap(indices); //free the memory
+	return true;
+}
+
+//normalizes without asserting on degenerated vectors
+static inline bool safeNormalize(Vector3& v)
+{
+	float len = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+	if (len < 1e-20f)
+		return false;
+	v = v * (1.0f / len);
+	return true;
+}
+
+//used to find the corners that share the same vertex data (the meshes are not indexed usually)
+struct sTangentKey {
+	float data[8]; //position, normal, uv
+	int orientation; //corners with mirrored uvs are not merged
+	bool operator < (const sTangentKey& other) const { return memcmp(this, &other, sizeof(sTangentKey)) < 0; }
+	bool operator == (const sTangentKey& other) const { return memcmp(this, &other, sizeof(sTangentKey)) == 0; }
+};
+
+#define TANGENTS_PER_TASK 4096
+
+//same results as MikkTSpace for meshes without degenerated triangles: the tangent of every triangle is projected to the plane
+//of the vertex normal, weighted by the angle of the corner and accumulated over the corners that share the same vertex data
+bool Mesh::computeTangents()
+{
+	bool is_interleaved = interleaved.size() > 0;
+	unsigned int num_vertices = is_interleaved ? interleaved.size() : vertices.size();
+	if (!num_vertices || (!is_interleaved && (normals.size() != num_vertices || uvs.size() != num_vertices)))
+		return false;
+
+	bool is_indexed = isIndexed();
+	unsigned int num_triangles = is_indexed ? getNumIndexedTriangles() : num_vertices / 3;
+	unsigned int num_corners = num_triangles * 3;
+
+	std::vector<Vector3> corner_tangent(num_corners);
+	std::vector<Vector3> corner_bitangent(num_corners);
+	std::vector<sTangentKey> keys(num_corners);
+
+	//every triangle computes the contribution of its three corners
+	ThreadPool::Get()->parallelFor(num_triangles, TANGENTS_PER_TASK, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			Vector3 p[3], n[3];
+			Vector2 uv[3];
+			Vector3u triangle = is_indexed ? getTriangleIndices(i) : Vector3u(i * 3, i * 3 + 1, i * 3 + 2);
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int index = triangle.v[k];
+				p[k] = is_interleaved ? interleaved[index].vertex : vertices[index];
+				n[k] = is_interleaved ? interleaved[index].normal : normals[index];
+				uv[k] = is_interleaved ? interleaved[index].uv : uvs[index];
+			}
+
+			Vector3 e1 = p[1] - p[0];
+			Vector3 e2 = p[2] - p[0];
+			Vector2 duv1(uv[1].x - uv[0].x, uv[1].y - uv[0].y);
+			Vector2 duv2(uv[2].x - uv[0].x, uv[2].y - uv[0].y);
+			float area = duv1.x * duv2.y - duv2.x * duv1.y;
+			float sign = area < 0.0f ? -1.0f : 1.0f;
+			Vector3 face_tangent = (e1 * duv2.y - e2 * duv1.y) * sign;
+			Vector3 face_bitangent = (e2 * duv1.x - e1 * duv2.x) * sign;
+			bool valid = area != 0.0f && safeNormalize(face_tangent);
+			safeNormalize(face_bitangent);
+
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int corner = i * 3 + k;
+				Vector3 normal = n[k];
+				safeNormalize(normal);
+
+				//angle of the corner in the plane of the vertex normal
+				Vector3 a = p[(k + 1) % 3] - p[k];
+				Vector3 b = p[(k + 2) % 3] - p[k];
+				a = a - normal * normal.dot(a);
+				b = b - normal * normal.dot(b);
+				float angle = 0.0f;
+				if (valid && safeNormalize(a) && safeNormalize(b))
+					angle = acos(clamp(a.dot(b), -1.0f, 1.0f));
+
+				Vector3 t = face_tangent - normal * normal.dot(face_tangent);
+				Vector3 bt = face_bitangent - normal * normal.dot(face_bitangent);
+				safeNormalize(t);
+				safeNormalize(bt);
+				corner_tangent[corner] = t * angle;
+				corner_bitangent[corner] = bt * angle;
+
+				sTangentKey& key = keys[corner];
+				memcpy(key.data, p[k].v, sizeof(float) * 3);
+				memcpy(key.data + 3, n[k].v, sizeof(float) * 3);
+				key.data[6] = uv[k].x;
+				key.data[7] = uv[k].y;
+				//-0.0 and 0.0 are the same vertex but not the same bits
+				for (int j = 0; j < 8; ++j)
+					if (key.data[j] == 0.0f)
+						key.data[j] = 0.0f;
+				//indexed vertices cannot be split, so both orientations go to the same vertex
+				key.orientation = is_indexed ? 0 : (area > 0.0f ? 1 : 0);
+			}
+		}
+	});
+
+	//sort the corners so the ones that share the vertex are together
+	std::vector<unsigned int> order(num_corners);
+	for (unsigned int i = 0; i < num_corners; ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+
+	std::vector<unsigned int> groups; //first corner of every group in order
+	for (unsigned int i = 0; i < num_corners; ++i)
+		if (i == 0 || !(keys[order[i]] == keys[order[i - 1]]))
+			groups.push_back(i);
+	groups.push_back(num_corners);
+
+	tangents.resize(num_vertices);
+	ThreadPool::Get()->parallelFor(groups.size() - 1, TANGENTS_PER_TASK, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			Vector3 tangent, bitangent;
+			for (unsigned int j = groups[i]; j < groups[i + 1]; ++j)
+			{
+				tangent = tangent + corner_tangent[order[j]];
+				bitangent = bitangent + corner_bitangent[order[j]];
+			}
+
+			//Gram-Schmidt against the normal, any perpendicular vector if there was no valid triangle
+			const sTangentKey& key = keys[order[groups[i]]];
+			Vector3 normal(key.data[3], key.data[4], key.data[5]);
+			safeNormalize(normal);
+			tangent = tangent - normal * normal.dot(tangent);
+			if (!safeNormalize(tangent))
+			{
+				tangent = normal.cross(fabs(normal.x) < 0.9f ? Vector3(1.0f, 0.0f, 0.0f) : Vector3(0.0f, 1.0f, 0.0f));
+				safeNormalize(tangent);
+			}
+			float sign = normal.cross(tangent).dot(bitangent) < 0.0f ? -1.0f : 1.0f;
+
+			//packed as unsigned normalized bytes rounded to the nearest, the shader moves them back to [-1,1]
+			Vector4ub packed((unsigned char)(tangent.x * 127.5f + 128.0f), (unsigned char)(tangent.y * 127.5f + 128.0f), (unsigned char)(tangent.z * 127.5f + 128.0f), sign > 0.0f ? 255 : 0);
+			for (unsigned int j = groups[i]; j < groups[i + 1]; ++j)
+			{
+				unsigned int corner = order[j];
+				tangents[is_indexed ? getTriangleIndices(corner / 3).v[corner % 3] : corner] = packed;
+			}
+		}
+	});
+
+	return true;
+}
+
 typedef struct 
 {
 	int version;
@@ -658,8 +1391,9 @@ typedef struct
 	int num_bones;
 	int material_range[4];
 	Matrix44 bind_matrix;
-	char streams[8]; //Normal|Uvs|Color|Indices|Bones|Weights|Extra
-	char extra[32]; //unused
+	char streams[8]; //Vertex|Normal|Uvs|Color|Indices (I 32 bits, S 16 bits)|Bones|Weights|Tangents
+	int num_index_chunks; //stored after the indices
+	char extra[28]; //unused
 } sMeshInfo;
 
 bool Mesh::readBin(const char* filename)
@@ -739,6 +1473,19 @@ bool Mesh::readBin(const char* filename)
 		pos += sizeof(Vector3u) * info.num_indices;
 	}
 
+	if (info.streams[4] == 'S')
+	{
+		indices16.resize(info.num_indices);
+		memcpy((void*)&indices16[0], pos, sizeof(Vector3us) * info.num_indices);
+		pos += sizeof(Vector3us) * info.num_indices;
+		if (info.num_index_chunks)
+		{
+			index_chunks.resize(info.num_index_chunks);
+			memcpy((void*)&index_chunks[0], pos, sizeof(sIndexChunk) * info.num_index_chunks);
+			pos += sizeof(sIndexChunk) * info.num_index_chunks;
+		}
+	}
+
 	if (info.streams[5] == 'B')
 	{
 		bones.resize(info.size);
@@ -753,6 +1500,13 @@ bool Mesh::readBin(const char* filename)
 		pos += sizeof(Vector4) * info.size;
 	}
 
+	if (info.streams[7] == 'T')
+	{
+		tangents.resize(info.size);
+		memcpy((void*)&tangents[0], pos, sizeof(Vector4ub) * info.size);
+		pos += sizeof(Vector4ub) * info.size;
+	}
+
 	if (info.num_bones)
 	{
 		bones_info.resize(info.num_bones);
@@ -775,7 +1529,6 @@ bool Mesh::readBin(const char* filename)
 
 	delete[] data;
 
-	createCollisionModel();
 	return true;
 }
 
@@ -800,7 +1553,8 @@ bool Mesh::writeBin(const char* filename)
 	info.version = MESH_BIN_VERSION;
 	info.header_bytes = sizeof(sMeshInfo);
 	info.size = interleaved.size() ? interleaved.size() : vertices.size();
-	info.num_indices = indices.size();
+	info.num_indices = getNumIndexedTriangles();
+	info.num_index_chunks = index_chunks.size();
 	info.aabb_max = aabb_max;
 	info.aabb_min = aabb_min;
 	info.center = box.center;
@@ -813,9 +1567,10 @@ bool Mesh::writeBin(const char* filename)
 	info.streams[1] = normals.size() ? 'N' : ' ';
 	info.streams[2] = uvs.size() ? 'U' : ' ';
 	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = indices.size() ? 'I' : ' ';
+	info.streams[4] = indices.size() ? 'I' : (indices16.size() ? 'S' : ' ');
 	info.streams[5] = bones.size() ? 'B' : ' ';
 	info.streams[6] = weights.size() ? 'W' : ' ';
+	info.streams[7] = tangents.size() ? 'T' : ' ';
 
 	for (unsigned int i = 0; i < 4; i++)
 		info.material_range[i] = material_range.size() > i ? material_range[i] : -1;
@@ -840,11 +1595,17 @@ bool Mesh::writeBin(const char* filename)
 
 	if (indices.size())
 		fwrite((void*)&indices[0], indices.size() * sizeof(Vector3u), 1, f);
+	if (indices16.size())
+		fwrite((void*)&indices16[0], indices16.size() * sizeof(Vector3us), 1, f);
+	if (index_chunks.size())
+		fwrite((void*)&index_chunks[0], index_chunks.size() * sizeof(sIndexChunk), 1, f);
 
 	if (bones.size())
 		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
 	if (weights.size())
 		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
+	if (tangents.size())
+		fwrite((void*)&tangents[0], tangents.size() * sizeof(Vector4ub), 1, f);
 	if (bones_info.size())
 		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
 
@@ -1276,6 +2037,10 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered )
 	double iuv = 1 / (double)(subdivisions * size);
 	float sub_size = 1.0f / subdivisions;
 	vertices.clear();
+	uvs.clear();
+	normals.clear();
+	vertices.reserve(subdivisions * subdivisions * 6);
+	uvs.reserve(subdivisions * subdivisions * 6);
 
 	for (int x = 0; x < subdivisions; ++x)
 	{
@@ -1302,6 +2067,8 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered )
 			uvs.push_back(Vector2(sub_size, 0.0f) + offset);
 		}
 	}
+	normals.assign(vertices.size(), Vector3(0.0f, 1.0f, 0.0f));
+
 	if (centered)
 		box.center.set(0.0f, 0.0f, 0.0f);
 	else
@@ -1311,29 +2078,145 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered )
 	radius = box.halfsize.length();
 }
 
+void Mesh::createGridPatch(int resolution)
+{
+	clear();
+	int num = resolution + 1;
+	float step = 1.0f / resolution;
+	vertices.resize(num * num);
+	normals.assign(num * num, Vector3(0.0f, 1.0f, 0.0f));
+	uvs.resize(num * num);
+	for (int z = 0; z < num; ++z)
+		for (int x = 0; x < num; ++x)
+		{
+			vertices[z * num + x].set(x * step, 0.0f, z * step);
+			uvs[z * num + x].set(x * step, z * step);
+		}
+
+	//two triangles per quad sharing the vertices
+	indices.reserve(resolution * resolution * 2);
+	for (int z = 0; z < resolution; ++z)
+		for (int x = 0; x < resolution; ++x)
+		{
+			unsigned int i = z * num + x;
+			indices.push_back(Vector3u(i, i + num, i + 1));
+			indices.push_back(Vector3u(i + 1, i + num, i + num + 1));
+		}
+	narrowIndices();
+
+	box.center.set(0.5f, 0.0f, 0.5f);
+	box.halfsize.set(0.5f, 0.0f, 0.5f);
+	aabb_min.set(0.0f, 0.0f, 0.0f);
+	aabb_max.set(1.0f, 0.0f, 1.0f);
+	radius = box.halfsize.length();
+}
+
 void Mesh::displace(Image* heightmap, float altitude)
 {
 	assert(heightmap && heightmap->data && "image without data");
-	assert(uvs.size() && "cannot displace without uvs");
 
+	HeightMap floats;
+	floats.fromImage(heightmap, altitude);
+	displace(floats);
+}
+
+#define DISPLACE_VERTICES_PER_TASK 4096
+
+void Mesh::displace(const HeightMap& heightmap, bool update_normals)
+{
+	assert(heightmap.width > 1 && heightmap.height > 1 && "heightmap without data");
+	assert(load_state == LOAD_READY && "mesh still loading");
 	bool is_interleaved = interleaved.size() != 0;
+	assert((is_interleaved || uvs.size()) && "cannot displace without uvs");
+
 	int num = is_interleaved ? interleaved.size() : vertices.size();
 	assert(num && "no vertices found");
+	update_normals = update_normals && (is_interleaved || normals.size() == num);
+
+	//distance between samples in world units to compute the normals
+	float cell_x = box.halfsize.x * 2.0f / (heightmap.width - 1);
+	float cell_z = box.halfsize.z * 2.0f / (heightmap.height - 1);
+	float max_x = (float)(heightmap.width - 1);
+	float max_y = (float)(heightmap.height - 1);
+
+	ThreadPool::Get()->parallelFor(num, DISPLACE_VERTICES_PER_TASK, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			const Vector2& uv = is_interleaved ? interleaved[i].uv : uvs[i];
+			float x = uv.x * max_x;
+			float y = uv.y * max_y;
+			float h = heightmap.getInterpolated(x, y);
+			if (is_interleaved)
+				interleaved[i].vertex.y = h;
+			else
+				vertices[i].y = h;
 
-	for (int i = 0; i < num; ++i)
+			if (!update_normals)
+				continue;
+			Vector3 normal = heightmap.getNormal(x, y, cell_x, cell_z);
+			if (is_interleaved)
+				interleaved[i].normal = normal;
+			else
+				normals[i] = normal;
+		}
+	});
+
+	//the triangles moved, it is built again the next time it is needed
+	updateBoundingBox();
+	releaseCollisionModel();
+	edited = true;
+}
+
+void Mesh::updateBoundingBox()
+{
+	bool is_interleaved = interleaved.size() != 0;
+	int num = is_interleaved ? interleaved.size() : vertices.size();
+	if (!num)
+		return;
+
+	aabb_min = aabb_max = is_interleaved ? interleaved[0].vertex : vertices[0];
+	for (int i = 1; i < num; ++i)
 	{
-		Vector2& uv = uvs[i];
-		Color c = heightmap->getPixelInterpolated(uv.x * heightmap->width, uv.y * heightmap->height);
-		if (is_interleaved)
-			interleaved[i].vertex.y = (c.x / 255.0f) * altitude;
-		else
-			vertices[i].y = (c.x / 255.0f) * altitude;
+		const Vector3& v = is_interleaved ? interleaved[i].vertex : vertices[i];
+		aabb_min.setMin(v);
+		aabb_max.setMax(v);
 	}
-	box.center.y += altitude*0.5f;
-	box.halfsize.y += altitude*0.5f;
-	radius = box.halfsize.length();
+	box.center = (aabb_max + aabb_min) * 0.5;
+	box.halfsize = (aabb_max - box.center);
+	radius = (float)fmax(aabb_max.length(), aabb_min.length());
 }
 
+void Mesh::transform(const Matrix44& m)
+{
+	assert(load_state == LOAD_READY && "mesh still loading");
+	bool is_interleaved = interleaved.size() != 0;
+	int num = is_interleaved ? interleaved.size() : vertices.size();
+	if (!num)
+		return;
+
+	if (is_interleaved)
+	{
+		transformPoints(m, &interleaved[0].vertex, sizeof(tInterleaved), num, true);
+		transformNormals(m, &interleaved[0].normal, sizeof(tInterleaved), num, true);
+	}
+	else
+	{
+		transformPoints(m, &vertices[0], sizeof(Vector3), num, true);
+		if (normals.size() == num)
+			transformNormals(m, &normals[0], sizeof(Vector3), num, true);
+	}
+	if (tangents.size())
+		computeTangents();
+
+	box = transformBoundingBox(m, box);
+	aabb_min = box.center - box.halfsize;
+	aabb_max = box.center + box.halfsize;
+	radius = (float)fmax(aabb_max.length(), aabb_min.length());
+
+	//the triangles moved, it is built again the next time it is needed
+	releaseCollisionModel();
+	edited = true;
+}
 
 void Mesh::createGrid(float dist)
 {
@@ -1406,16 +2289,124 @@ Mesh* Mesh::getQuad()
 	return quad;
 }
 
-Mesh* Mesh::Get(const char* filename)
+Mesh* Mesh::Get(const char* filename, bool evictable)
 {
 	assert(filename);
-	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
-	if (it != sMeshesLoaded.end())
-		return it->second;
+	Mesh* m = sMeshesLoaded.find(filename);
+	if (m)
+	{
+		if (!evictable)
+			m->evictable = false; //someone keeps a raw pointer
+		//requested before with GetAsync, the caller expects it ready to use
+		if (m->load_state == LOAD_PENDING)
+			m->waitForLoad();
+		return m->load_state == LOAD_READY ? m : NULL;
+	}
+
+	m = new Mesh();
+	m->name = filename; //used to locate the cached files
+	if (!m->loadFile(filename))
+	{
+		delete m;
+		return NULL;
+	}
+
+	//and upload them to VRAM
+	if (auto_upload_to_vram)
+		m->uploadToVRAM();
+
+	if (background_collision_models)
+		m->createCollisionModelAsync();
+
+	m->registerMesh(filename, evictable);
+	return m;
+}
 
-	Mesh* m = new Mesh();
-	std::string name = filename;
+//meshes loaded in the workers waiting to be uploaded from the GL thread
+static std::deque<Mesh*> sPendingUploads;
+static std::mutex sPendingUploadsMutex;
 
+Mesh* Mesh::GetAsync(const char* filename, bool evictable)
+{
+	assert(filename);
+	Mesh* m = sMeshesLoaded.find(filename);
+	if (m)
+	{
+		if (!evictable)
+			m->evictable = false;
+		return m;
+	}
+
+	//registered right away so other calls get the same mesh, it cannot be evicted until the worker is done
+	m = new Mesh();
+	m->load_state = LOAD_PENDING;
+	m->registerMesh(filename, evictable);
+
+	m->load_task = ThreadPool::Get()->enqueue([m]() {
+		if (!m->loadFile(m->name.c_str()))
+		{
+			m->load_state = LOAD_FAILED;
+			return;
+		}
+		std::lock_guard<std::mutex> lock(sPendingUploadsMutex);
+		sPendingUploads.push_back(m);
+	});
+	return m;
+}
+
+void Mesh::finishLoad()
+{
+	if (auto_upload_to_vram)
+		uploadToVRAM();
+	load_state = LOAD_READY;
+	sMeshesLoaded.update(this);
+
+	if (background_collision_models)
+		createCollisionModelAsync();
+}
+
+void Mesh::waitForLoad()
+{
+	if (load_task.valid())
+		load_task.get();
+	if (load_state != LOAD_PENDING)
+		return; //failed
+
+	//it is uploaded now instead of in processPendingUploads
+	{
+		std::lock_guard<std::mutex> lock(sPendingUploadsMutex);
+		std::deque<Mesh*>::iterator it = std::find(sPendingUploads.begin(), sPendingUploads.end(), this);
+		if (it == sPendingUploads.end())
+			return;
+		sPendingUploads.erase(it);
+	}
+	finishLoad();
+}
+
+void Mesh::processPendingUploads(long budget_ms)
+{
+	long start = getTime();
+	while (true)
+	{
+		Mesh* m = NULL;
+		{
+			std::lock_guard<std::mutex> lock(sPendingUploadsMutex);
+			if (sPendingUploads.empty())
+				return;
+			m = sPendingUploads.front();
+			sPendingUploads.pop_front();
+		}
+
+		m->finishLoad();
+
+		//at least one per frame so it always progresses
+		if (getTime() - start >= budget_ms)
+			return;
+	}
+}
+
+bool Mesh::loadFile(const char* filename)
+{
 	//detect format
 	char file_format = 0;
 	std::string ext = name.substr(name.find_last_of(".")+1);
@@ -1430,7 +2421,7 @@ Mesh* Mesh::Get(const char* filename)
 	else
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
 	//stats
@@ -1442,69 +2433,106 @@ Mesh* Mesh::Get(const char* filename)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if ( m->readBin(binfilename.c_str()) && use_binary )
+	if ( readBin(binfilename.c_str()) && use_binary )
 	{
-		if(interleave_meshes && m->interleaved.size() == 0)
+		if(interleave_meshes && interleaved.size() == 0)
 		{
 			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
-
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
+			interleaveBuffers();
 		}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		std::cout << "[OK BIN]  Faces: " << (interleaved.size() ? interleaved.size() : vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(filename);
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(filename);
 
 	if (!loaded)
 	{
-		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		return false;
+	}
+
+	//tangents for normal mapping, they are stored in the .mbin
+	if (generate_tangents && uvs.size() && normals.size())
+	{
+		std::cout << "[TANGENTS] ";
+		computeTangents();
 	}
 
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
 		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		interleaveBuffers();
 	}
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
-	}
+	//half the memory and bandwidth for the indices
+	if (use_16bit_indices && narrowIndices())
+		std::cout << "[16BIT] ";
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	std::cout << "[OK]  Faces: " << (interleaved.size() ? interleaved.size() : vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
+		writeBin(filename);
 		std::cout << "[OK]" << std::endl;
 	}
 
-	m->registerMesh(name);
-	return m;
+	return true;
 }
 
-void Mesh::registerMesh( std::string name )
+void Mesh::registerMesh( std::string name, bool evictable )
 {
 	this->name = name;
-	sMeshesLoaded[name] = this;
+	sMeshesLoaded.add(name, this, evictable);
+}
+
+template<typename T> static size_t vectorBytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+void Mesh::getMemoryUsage(size_t& cpu, size_t& gpu) const
+{
+	//the loader is still filling the buffers, it is counted when it is ready
+	if (load_state == LOAD_PENDING)
+	{
+		cpu = gpu = 0;
+		return;
+	}
+
+	cpu = vectorBytes(vertices) + vectorBytes(normals) + vectorBytes(uvs) + vectorBytes(colors) + vectorBytes(interleaved) + vectorBytes(tangents) +
+		vectorBytes(indices) + vectorBytes(indices16) + vectorBytes(index_chunks) + vectorBytes(bones) + vectorBytes(weights) + vectorBytes(bones_info);
+	//a BVH being built in other thread is counted once it is done
+	std::unique_lock<std::mutex> lock(collision_model_mutex, std::try_to_lock);
+	if (lock.owns_lock() && collision_model)
+		cpu += ((BVH*)collision_model)->getMemoryUsage();
+	for (const sSkinBinding* binding = skin_bindings; binding; binding = binding->next)
+		cpu += sizeof(sSkinBinding) + vectorBytes(binding->bone_indices) + vectorBytes(binding->bind_matrices) + binding->bone_names.size() * sizeof(std::string);
+
+	//the VBOs have the same size as the buffers they were uploaded from
+	gpu = 0;
+	if (interleaved_vbo_id)
+		gpu += interleaved.size() * sizeof(tInterleaved);
+	if (vertices_vbo_id)
+		gpu += vertices.size() * sizeof(Vector3);
+	if (normals_vbo_id)
+		gpu += normals.size() * sizeof(Vector3);
+	if (uvs_vbo_id)
+		gpu += uvs.size() * sizeof(Vector2);
+	if (colors_vbo_id)
+		gpu += colors.size() * sizeof(Vector4);
+	if (tangents_vbo_id)
+		gpu += tangents.size() * sizeof(Vector4ub);
+	if (bones_vbo_id)
+		gpu += bones.size() * sizeof(Vector4ub);
+	if (weights_vbo_id)
+		gpu += weights.size() * sizeof(Vector4);
+	if (indices_vbo_id)
+		gpu += indices16.size() ? indices16.size() * sizeof(Vector3us) : indices.size() * sizeof(Vector3u);
 }
@@ -3,33 +3,108 @@
 
 #include <vector>
 #include "framework.h"
+#include "resource.h"
 
 #include <map>
 #include <string>
+#include <future>
+#include <atomic>
+#include <mutex>
 
 class Shader; //for binding
 class Image; //for displace
+class HeightMap; //for displace
 class Skeleton; //for skinned meshes
+class BVH; //for collisions
 
-#define MESH_BIN_VERSION 7 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 9 //this is used to regenerate bins if the format changes
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
 	Matrix44 bind_pose;
 };
 
-class Mesh
+//bones of one skeleton layout used by the bones_info of a mesh, built the first time the mesh is skinned with it
+struct sSkinBinding {
+	uint32 skeleton_signature; //see Skeleton::signature
+	std::vector<std::string> bone_names; //of the skeleton, checked when the signature matches because different names can share it
+	std::vector<int> bone_indices; //skeleton bone of every entry of bones_info, -1 if the skeleton does not have it
+	std::vector<Matrix44> bind_matrices; //bind_matrix * bind_pose of every entry of bones_info
+	sSkinBinding* next; //next binding of the same mesh
+};
+
+//triangles of indices16 whose indices are relative to base_vertex, used by big meshes split to use 16 bits indices
+struct sIndexChunk {
+	unsigned int start; //first triangle
+	unsigned int num; //triangles
+	unsigned int base_vertex;
+};
+
+//rays stored as SoA for the batch collision tests
+struct RayBatch {
+	std::vector<float> origin[3];
+	std::vector<float> direction[3];
+	std::vector<float> max_t; //max distance in units of direction
+
+	void resize(unsigned int num);
+	void set(unsigned int i, const Vector3& origin, const Vector3& direction, float max_t = 3.4e+38F);
+	unsigned int size() const { return max_t.size(); }
+};
+
+struct RayHit {
+	float t; //collision point is origin + direction * t
+	Vector3 normal;
+	int triangle; //-1 if the ray did not hit anything
+	int mesh; //index of the mesh hit when testing several
+};
+
+//describes the data of every instance for renderInstanced, the attributes are floats packed in order
+//a mat4 takes 16 floats and four consecutive locations, for example: layout.add("u_model", 16).add("u_color", 4)
+class InstanceLayout
 {
 public:
-	static std::map<std::string, Mesh*> sMeshesLoaded;
+	struct Attribute {
+		const char* name;
+		int num_floats;
+		int offset; //bytes from the start of the instance
+	};
+
+	static InstanceLayout model; //only the mat4 u_model
+	static unsigned int s_last_uid;
+
+	std::vector<Attribute> attributes;
+	int stride; //bytes per instance
+	unsigned int uid; //changes with every attribute added, used as key for the VAOs
+
+	InstanceLayout();
+	InstanceLayout& add(const char* name, int num_floats);
+};
+
+class Mesh : public Resource
+{
+public:
+	static ResourcePool<Mesh> sMeshesLoaded;
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
+	static bool generate_tangents; //loaded meshes with normals and uvs get tangents for normal mapping
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool cache_collision_models; //store the collision BVH next to the mesh file (.bvh) and reuse it
+	static bool background_collision_models; //start building the collision BVH in a worker thread as soon as the mesh is loaded
+	static bool use_vertex_array_objects; //store the attribute setup of every shader in a VAO so drawing only needs to bind it
+	static bool use_16bit_indices; //indexed meshes with less than 65536 vertices store their indices in 16 bits
+	static bool split_indices_16bit; //bigger meshes are split in chunks addressable with 16 bits (drawn with a base vertex)
+	static bool use_cpu_skinning; //renderAnimated deforms the vertices in the CPU and streams them, the shader doesnt need u_bones
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
+	static long num_buffer_setups; //draws that had to enable and disable every attribute (no VAO available)
 
 	std::string name;
 
+	//meshes loaded with GetAsync are not ready until they are parsed and uploaded
+	enum eLoadState { LOAD_PENDING, LOAD_READY, LOAD_FAILED };
+	std::atomic<int> load_state; //the buffers of a pending mesh are being written by a worker, check it before reading them
+	bool isReady() const { return load_state == LOAD_READY; }
+
 	std::vector<std::string> material_name; 
 	std::vector<unsigned int> material_range; 
 
@@ -46,13 +121,18 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
+	std::vector< Vector4ub > tangents; //xyz from 0..255 to -1..1, w is the sign of the bitangent (0 is -1, 255 is 1)
+
 	std::vector< Vector3u > indices; //for indexed meshes
+	std::vector< Vector3us > indices16; //used instead of indices when they fit in 16 bits (see narrowIndices)
+	std::vector< sIndexChunk > index_chunks; //only for split meshes, empty if all indices16 are relative to vertex 0
 
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
 	std::vector< Vector4 > weights; //tells how much affect every bone
 	std::vector< BoneInfo > bones_info; //tells 
 	Matrix44 bind_matrix;
+	std::atomic<sSkinBinding*> skin_bindings; //list with one per skeleton layout it was skinned with, only prepended so it is read without locks (see Skeleton::getSkinBinding)
 
 	Vector3 aabb_min;
 	Vector3	aabb_max;
@@ -60,16 +140,21 @@ public:
 
 	float radius;
 
+	bool edited; //the vertices changed in memory (displace, transform) so they no longer match its file, its collision model is not cached in disk
+
 	unsigned int vertices_vbo_id;
 	unsigned int uvs_vbo_id;
 	unsigned int normals_vbo_id;
 	unsigned int colors_vbo_id;
+	unsigned int tangents_vbo_id;
 
 	unsigned int indices_vbo_id;
 	unsigned int interleaved_vbo_id;
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 
+	std::map<unsigned long long, unsigned int> vaos; //shader uid (and instance layout uid) -> VAO, removed when the mesh is uploaded again
+
 	Mesh();
 	~Mesh();
 
@@ -77,13 +162,17 @@ public:
 
 	void render( unsigned int primitive, int submesh_id = 0, int num_instances = 0 );
 	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	void renderInstanced(unsigned int primitive, const void* instances_data, int number, const InstanceLayout& layout); //number * layout.stride bytes
 	void renderBounding( const Matrix44& model, bool world_bounding = true );
 	void renderFixedPipeline(int primitive); //sloooooooow
 	void renderAnimated(unsigned int primitive, Skeleton *sk);
 
 	void enableBuffers(Shader* shader);
-	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
+	void drawCall(unsigned int primitive, int submesh_id, int num_instances, int base_instance = 0);
 	void disableBuffers(Shader* shader);
+	//returns 0 if the mesh cannot use VAOs (not in VRAM or not supported), with a layout it also points to the instances buffer
+	unsigned int getVAO(Shader* shader, const InstanceLayout* layout = NULL, unsigned int instances_buffer = 0);
+	void releaseVAOs();
 
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
@@ -91,37 +180,67 @@ public:
 	unsigned int getNumSubmaterials() { return material_name.size(); }
 	unsigned int getNumSubmeshes() { return material_range.size(); }
 	unsigned int getNumVertices() { return interleaved.size() ? interleaved.size() : vertices.size(); }
+	bool isIndexed() const { return indices.size() || indices16.size(); }
+	unsigned int getNumIndexedTriangles() const { return indices.size() ? indices.size() : indices16.size(); }
+	Vector3u getTriangleIndices(unsigned int i) const; //works with 32 and 16 bits indices
 
 	//collision testing
-	void* collision_model;
-	bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
+	//the collision model is built the first time it is needed, meshes that are never tested do not pay for it
+	void* collision_model; //BVH*
+	bool createCollisionModel(bool is_static = false); //builds the BVH (or waits for the background one), is_static is kept for compatibility (the ray is always moved to object space)
+	void createCollisionModelAsync(); //builds the BVH in a worker thread, the mesh must not change until it finishes
+	bool isCollisionModelReady(); //true if it can be tested without blocking
 	//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
 	bool testRayCollision( Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false );
 	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
+	//batch versions, they run in the thread pool and test coherent rays in packets of four, hits has one entry per ray
+	void testRaysCollision(const Matrix44& model, const RayBatch& rays, std::vector<RayHit>& hits, bool in_object_space = false);
+	static void testRaysCollision(Mesh** meshes, const Matrix44* models, int num_meshes, const RayBatch& rays, std::vector<RayHit>& hits);
 
 	//loader
-	static Mesh* Get(const char* filename);
-	void registerMesh(std::string name);
+	//evictable: the caller only keeps it in ResourceHandles (SceneNode, AnimationPlayer, crowds), a Get without it pins the mesh
+	static Mesh* Get(const char* filename, bool evictable = false); //if it was requested with GetAsync it waits for the load and uploads it
+	static Mesh* GetAsync(const char* filename, bool evictable = false); //returns the mesh right away, it is loaded in the thread pool and uploaded by processPendingUploads
+	static void processPendingUploads(long budget_ms = 2); //call it once per frame from the GL thread, uploads meshes until the time budget is spent
+	void registerMesh(std::string name, bool evictable = false); //see Resource::evictable
+	void getMemoryUsage(size_t& cpu, size_t& gpu) const; //buffers in RAM, VBOs and collision model
 
 	//create help meshes
 	void createQuad(float center_x, float center_y, float w, float h, bool flip_uvs);
 	void createPlane(float size);
 	void createSubdividedPlane(float size = 1, int subdivisions = 256, bool centered = false);
+	void createGridPatch(int resolution); //indexed grid from 0 to 1 in XZ with resolution quads per side, shared by the terrain chunks
 	void createCube();
 	void createWireBox();
 	void createGrid(float dist);
 	void displace(Image* heightmap, float altitude);
+	void displace(const HeightMap& heightmap, bool update_normals = true); //heights in world units, sampled with the uvs
+	void transform(const Matrix44& m); //bakes m into the vertices and normals, call uploadToVRAM again if it was uploaded
+	void updateBoundingBox(); //box, aabb and radius from the vertices
 	static Mesh* getQuad(); //get global quad
 
 
 	//optimize meshes
 	void uploadToVRAM();
 	bool interleaveBuffers();
+	bool computeTangents(); //MikkTSpace tangents, needs normals and uvs
+	bool narrowIndices(); //moves indices to indices16 when possible (and split_indices_16bit for big meshes)
 
 private:
 	bool loadASE(const char* filename);
 	bool loadOBJ(const char* filename);
 	bool loadMESH(const char* filename); //personal format used for animations
+	bool loadFile(const char* filename); //reads the .mbin or parses the file, does not use GL so it can run in a worker
+
+	std::future<void> load_task; //loadFile in the thread pool when it comes from GetAsync
+	void finishLoad(); //uploads a mesh loaded in the background and makes it ready, from the GL thread
+	void waitForLoad(); //blocks until the background load ends and finishes it here
+
+	mutable std::mutex collision_model_mutex; //held while the BVH is built, the first thread that gets it builds it
+	std::future<void> collision_model_task; //pending background build, it must finish before the mesh is deleted
+	std::atomic<bool> collision_model_ready; //set once collision_model is published, read without the mutex
+	BVH* buildCollisionModel();
+	void releaseCollisionModel(); //waits for the background build and deletes the BVH
 };
 
 #endif
\ No newline at end of file
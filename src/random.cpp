@@ -0,0 +1,180 @@
+#include "random.h"
+
+#ifdef FRAMEWORK_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+std::atomic<uint64> Random::thread_seed(0);
+std::atomic<int> Random::thread_generation(0);
+std::atomic<int> Random::thread_streams(0);
+
+//spreads the bits of a counter, used to fill the state from a 64 bits seed
+static uint64 splitMix64(uint64& x)
+{
+	uint64 z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint32 rotl(uint32 x, int k) { return (x << k) | (x >> (32 - k)); }
+
+//the same step for xoshiro128** and xoshiro128+, only the output changes
+static inline void advance(uint32* s)
+{
+	uint32 t = s[1] << 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 11);
+}
+
+Random::Random(uint64 seed, uint64 stream)
+{
+	generation = -1;
+	this->seed(seed, stream);
+}
+
+void Random::seed(uint64 seed, uint64 stream)
+{
+	uint64 x = seed ^ splitMix64(stream);
+	uint64 a = splitMix64(x);
+	uint64 b = splitMix64(x);
+	state[0] = (uint32)a;
+	state[1] = (uint32)(a >> 32);
+	state[2] = (uint32)b;
+	state[3] = (uint32)(b >> 32);
+	if (!(state[0] | state[1] | state[2] | state[3]))
+		state[0] = 1; //the only state that never changes
+}
+
+uint32 Random::next()
+{
+	uint32 result = rotl(state[1] * 5, 7) * 9;
+	advance(state);
+	return result;
+}
+
+uint32 Random::nextBits()
+{
+	uint32 result = state[0] + state[3];
+	advance(state);
+	return result;
+}
+
+Vector3 Random::nextVector3(const Vector3& range)
+{
+	float x = nextFloat();
+	float y = nextFloat();
+	float z = nextFloat();
+	return Vector3(-range.x + x * (2.0f * range.x), -range.y + y * (2.0f * range.y), -range.z + z * (2.0f * range.z));
+}
+
+//four xoshiro128+ streams seeded from the generator, value i comes from stream i % 4.
+//min and size have 12 values (three groups of four) that repeat, so vectors can have a range per axis
+static void fillRanges(Random& generator, float* out, int num, const float* min, const float* size)
+{
+	uint32 lanes[4][4]; //[word][stream]
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			lanes[j][i] = generator.next();
+
+#ifdef FRAMEWORK_USE_SSE
+	__m128i s0 = _mm_loadu_si128((__m128i*)lanes[0]);
+	__m128i s1 = _mm_loadu_si128((__m128i*)lanes[1]);
+	__m128i s2 = _mm_loadu_si128((__m128i*)lanes[2]);
+	__m128i s3 = _mm_loadu_si128((__m128i*)lanes[3]);
+	__m128 mins[3] = { _mm_loadu_ps(min), _mm_loadu_ps(min + 4), _mm_loadu_ps(min + 8) };
+	__m128 sizes[3] = { _mm_loadu_ps(size), _mm_loadu_ps(size + 4), _mm_loadu_ps(size + 8) };
+	__m128 to_float = _mm_set1_ps(1.0f / 16777216.0f);
+	for (int i = 0, group = 0; i < num; i += 4, group = group == 2 ? 0 : group + 1)
+	{
+		__m128i bits = _mm_add_epi32(s0, s3);
+		__m128i t = _mm_slli_epi32(s1, 9);
+		s2 = _mm_xor_si128(s2, s0);
+		s3 = _mm_xor_si128(s3, s1);
+		s1 = _mm_xor_si128(s1, s2);
+		s0 = _mm_xor_si128(s0, s3);
+		s2 = _mm_xor_si128(s2, t);
+		s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(bits, 8)), to_float);
+		__m128 v = _mm_add_ps(mins[group], _mm_mul_ps(f, sizes[group]));
+		if (i + 4 <= num)
+			_mm_storeu_ps(out + i, v);
+		else
+		{
+			float values[4];
+			_mm_storeu_ps(values, v);
+			for (int k = 0; i + k < num; ++k)
+				out[i + k] = values[k];
+		}
+	}
+#else
+	for (int i = 0, group = 0; i < num; i += 4, group = group == 2 ? 0 : group + 1)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			uint32 s[4] = { lanes[0][k], lanes[1][k], lanes[2][k], lanes[3][k] };
+			uint32 bits = s[0] + s[3];
+			advance(s);
+			for (int j = 0; j < 4; ++j)
+				lanes[j][k] = s[j];
+			if (i + k < num)
+				out[i + k] = min[group * 4 + k] + (float)(bits >> 8) * (1.0f / 16777216.0f) * size[group * 4 + k];
+		}
+	}
+#endif
+}
+
+void Random::fillFloats(float* out, int num, float min, float max)
+{
+	float mins[12], sizes[12];
+	for (int i = 0; i < 12; ++i)
+	{
+		mins[i] = min;
+		sizes[i] = max - min;
+	}
+	fillRanges(*this, out, num, mins, sizes);
+}
+
+void Random::fillVector3(Vector3* out, int num, const Vector3& range)
+{
+	float mins[12], sizes[12];
+	for (int i = 0; i < 12; ++i)
+	{
+		mins[i] = -range.v[i % 3];
+		sizes[i] = 2.0f * range.v[i % 3];
+	}
+	fillRanges(*this, &out[0].x, num * 3, mins, sizes);
+}
+
+Random& Random::getThreadGenerator()
+{
+	static thread_local Random generator;
+	return generator;
+}
+
+Random& Random::getThread()
+{
+	Random& generator = getThreadGenerator();
+	int current = thread_generation.load();
+	if (generator.generation != current)
+	{
+		generator.seed(thread_seed.load(), thread_streams++);
+		generator.generation = current;
+	}
+	return generator;
+}
+
+void Random::setThreadSeed(uint64 seed)
+{
+	thread_seed = seed;
+	thread_streams = 1;
+	int current = ++thread_generation;
+	Random& generator = getThreadGenerator();
+	generator.seed(seed, 0);
+	generator.generation = current;
+}
@@ -0,0 +1,46 @@
+/*  Random numbers for procedural content (xoshiro128, not for cryptography).
+	Every Random has its own 16 bytes of state, so there is no lock and the same seed always gives the
+	same sequence on every platform. For reproducible parallel work give every task its own stream with
+	Random(seed, task_index); Random::getThread() is a generator per thread for code that does not care.
+*/
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "framework.h"
+#include <atomic>
+
+class Random
+{
+public:
+	uint32 state[4];
+
+	Random(uint64 seed = 0, uint64 stream = 0);
+	void seed(uint64 seed, uint64 stream = 0); //different streams of the same seed are independent sequences
+
+	uint32 next(); //32 random bits (xoshiro128**)
+	float nextFloat() { return (nextBits() >> 8) * (1.0f / 16777216.0f); } //from 0 to 1 (1 not included)
+	float nextFloat(float min, float max) { return min + nextFloat() * (max - min); }
+	int nextInt(int max) { return (int)(((uint64)next() * (uint32)max) >> 32); } //from 0 to max - 1
+	Vector3 nextVector3(const Vector3& range); //every axis between -range and range, like Vector3::random
+
+	//bulk generation, four streams at once with SSE. The result depends only on the state, not on the build
+	void fillFloats(float* out, int num, float min = 0.0f, float max = 1.0f);
+	void fillVector3(Vector3* out, int num, const Vector3& range); //every axis between -range and range
+
+	//generator of the calling thread, the thread that calls setThreadSeed gets stream 0 so it is reproducible
+	//while the other threads get the next streams in the order they use it
+	static Random& getThread();
+	static void setThreadSeed(uint64 seed);
+
+private:
+	uint32 nextBits(); //xoshiro128+, the low bits are weak but floats only use the high ones
+
+	int generation; //reseeded by getThread when it does not match the global one
+	static Random& getThreadGenerator(); //without checking the generation
+	static std::atomic<uint64> thread_seed;
+	static std::atomic<int> thread_generation;
+	static std::atomic<int> thread_streams;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "resource.h"
+
+#include "includes.h"
+#include <iostream>
+
+unsigned long ResourcePoolBase::s_frame = 0;
+
+Resource::Resource()
+{
+	pool = NULL;
+	ref_count = 0;
+	evictable = false;
+	last_used_frame = 0;
+	cpu_bytes = 0;
+	gpu_bytes = 0;
+}
+
+Resource::Resource(const Resource& other)
+{
+	pool = NULL;
+	ref_count = 0;
+	evictable = false;
+	last_used_frame = 0;
+	cpu_bytes = 0;
+	gpu_bytes = 0;
+}
+
+Resource::~Resource()
+{
+	assert(ref_count == 0 && "deleting a resource that is still referenced");
+	if (pool)
+		pool->remove(this);
+}
+
+void Resource::touch()
+{
+	last_used_frame = ResourcePoolBase::s_frame;
+}
+
+std::vector<ResourcePoolBase*>& ResourcePoolBase::getPools()
+{
+	static std::vector<ResourcePoolBase*> pools;
+	return pools;
+}
+
+ResourcePoolBase::ResourcePoolBase(const char* name)
+{
+	this->name = name;
+	cpu_budget = size_t(512) * 1024 * 1024;
+	gpu_budget = size_t(1024) * 1024 * 1024;
+	min_idle_frames = 60;
+	cpu_bytes = 0;
+	gpu_bytes = 0;
+	num_evicted = 0;
+	getPools().push_back(this);
+}
+
+ResourcePoolBase::~ResourcePoolBase()
+{
+	std::vector<ResourcePoolBase*>& pools = getPools();
+	std::vector<ResourcePoolBase*>::iterator it = std::find(pools.begin(), pools.end(), this);
+	if (it != pools.end())
+		pools.erase(it);
+}
+
+void ResourcePoolBase::EndFrameAll()
+{
+	std::vector<ResourcePoolBase*>& pools = getPools();
+	for (size_t i = 0; i < pools.size(); ++i)
+		pools[i]->trim();
+	s_frame++;
+}
+
+void ResourcePoolBase::renderInMenu()
+{
+	ImGui::Text("RAM: %.1f MBs VRAM: %.1f MBs Evicted: %d", cpu_bytes / (1024.0f * 1024.0f), gpu_bytes / (1024.0f * 1024.0f), (int)num_evicted);
+	int cpu_mbs = int(cpu_budget / (1024 * 1024));
+	int gpu_mbs = int(gpu_budget / (1024 * 1024));
+	if (ImGui::DragInt("RAM budget (MBs)", &cpu_mbs, 1, 0, 16384))
+		cpu_budget = size_t(cpu_mbs) * 1024 * 1024;
+	if (ImGui::DragInt("VRAM budget (MBs)", &gpu_mbs, 1, 0, 16384))
+		gpu_budget = size_t(gpu_mbs) * 1024 * 1024;
+}
@@ -0,0 +1,200 @@
+/*  Common layer of the resources that are loaded by name (meshes, textures, shaders, animations, HDREs).
+	Every type keeps its resources in a ResourcePool that knows how many bytes they use in RAM and VRAM.
+	When a pool goes over its budget it deletes the least recently used resources that nobody references,
+	the next Get with the same name just loads them again.
+	Eviction is opt-in: parts of the engine (characters, skyboxes) keep raw pointers to what they load, so a
+	resource is only evicted if it was requested with Get(name, true) by callers that keep it in a ResourceHandle
+	(SceneNode::mesh, AnimationPlayer::clip, sCrowdAgent::anim). A Get without the flag pins it again.
+	The pools are not thread-safe, add, update, remove and trim must be called from the main (GL) thread.
+*/
+
+#ifndef RESOURCE_H
+#define RESOURCE_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cassert>
+
+class ResourcePoolBase;
+
+//base of the classes managed by a pool
+class Resource
+{
+public:
+	ResourcePoolBase* pool; //NULL if it is not registered
+	std::string resource_name; //key in the pool
+	int ref_count; //handles pointing to it, referenced resources are never evicted (only changed from the main thread)
+	bool evictable; //opt-in, false by default: set it only if Get can load it again and every holder uses a ResourceHandle
+	unsigned long last_used_frame;
+	size_t cpu_bytes; //as counted by the pool the last time it was updated
+	size_t gpu_bytes;
+
+	Resource();
+	Resource(const Resource& other); //copies are not registered
+	Resource& operator = (const Resource& other) { return *this; }
+	~Resource(); //removes it from its pool
+
+	void addRef() { ref_count++; }
+	void removeRef() { assert(ref_count > 0); ref_count--; }
+	void touch(); //marks it as used this frame
+};
+
+class ResourcePoolBase
+{
+public:
+	static std::vector<ResourcePoolBase*>& getPools(); //all the pools (not a static member to avoid depending on the initialization order)
+	static unsigned long s_frame;
+	static void EndFrameAll(); //call it once per frame, advances the frame counter and trims the pools over budget
+
+	std::string name;
+	size_t cpu_budget; //bytes of RAM, 0 means no limit (512 MBs by default)
+	size_t gpu_budget; //bytes of VRAM, 0 means no limit (1 GB by default)
+	unsigned int min_idle_frames; //resources used in the last frames are kept even over budget
+	size_t cpu_bytes; //of all the registered resources
+	size_t gpu_bytes;
+	long num_evicted;
+
+	ResourcePoolBase(const char* name);
+	virtual ~ResourcePoolBase();
+
+	bool isOverBudget() const { return (cpu_budget && cpu_bytes > cpu_budget) || (gpu_budget && gpu_bytes > gpu_budget); }
+	virtual int trim() = 0; //evicts until it is under budget, returns how many were evicted
+	virtual void remove(Resource* resource) = 0;
+	virtual void renderInMenu();
+};
+
+//T must inherit from Resource and have getMemoryUsage(size_t& cpu, size_t& gpu)
+template<typename T> class ResourcePool : public ResourcePoolBase
+{
+public:
+	typedef typename std::map<std::string, T*>::iterator iterator;
+	std::map<std::string, T*> resources;
+
+	ResourcePool(const char* name) : ResourcePoolBase(name) {}
+	~ResourcePool()
+	{
+		//resources still alive at exit are not deleted (the GL context could be gone)
+		for (iterator it = resources.begin(); it != resources.end(); ++it)
+			it->second->pool = NULL;
+	}
+
+	iterator begin() { return resources.begin(); }
+	iterator end() { return resources.end(); }
+	size_t size() const { return resources.size(); }
+
+	T* find(const std::string& name)
+	{
+		iterator it = resources.find(name);
+		if (it == resources.end())
+			return NULL;
+		it->second->touch();
+		return it->second;
+	}
+
+	//registers it under name (replacing the previous one with the same name, that one is not deleted)
+	void add(const std::string& name, T* resource, bool evictable = false)
+	{
+		assert(resource);
+		if (resource->pool && (resource->pool != this || resource->resource_name != name))
+			resource->pool->remove(resource);
+		iterator it = resources.find(name);
+		if (it != resources.end() && it->second != resource)
+			remove(it->second);
+		resources[name] = resource;
+		resource->pool = this;
+		resource->resource_name = name;
+		resource->evictable = evictable;
+		resource->cpu_bytes = resource->gpu_bytes = 0;
+		resource->touch();
+		update(resource);
+	}
+
+	//call it when the resource changes its memory usage (uploaded to VRAM, etc), getMemoryUsage must not call GL
+	void update(T* resource)
+	{
+		if (resource->pool != this)
+			return;
+		size_t cpu = 0, gpu = 0;
+		resource->getMemoryUsage(cpu, gpu);
+		cpu_bytes += cpu - resource->cpu_bytes;
+		gpu_bytes += gpu - resource->gpu_bytes;
+		resource->cpu_bytes = cpu;
+		resource->gpu_bytes = gpu;
+	}
+
+	void remove(Resource* resource)
+	{
+		if (resource->pool != this)
+			return;
+		iterator it = resources.find(resource->resource_name);
+		if (it != resources.end() && it->second == resource)
+			resources.erase(it);
+		cpu_bytes -= resource->cpu_bytes;
+		gpu_bytes -= resource->gpu_bytes;
+		resource->cpu_bytes = resource->gpu_bytes = 0;
+		resource->pool = NULL;
+	}
+
+	int trim()
+	{
+		if (!cpu_budget && !gpu_budget)
+			return 0;
+
+		//some resources grow from other threads (collision models), their usage is read here in the main thread
+		for (iterator it = resources.begin(); it != resources.end(); ++it)
+			update(it->second);
+		if (!isOverBudget())
+			return 0;
+
+		std::vector<T*> candidates;
+		for (iterator it = resources.begin(); it != resources.end(); ++it)
+		{
+			T* resource = it->second;
+			if (resource->evictable && resource->ref_count == 0 && s_frame - resource->last_used_frame >= min_idle_frames)
+				candidates.push_back(resource);
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const T* a, const T* b) { return a->last_used_frame < b->last_used_frame; });
+
+		int num = 0;
+		for (size_t i = 0; i < candidates.size() && isOverBudget(); ++i)
+		{
+			remove(candidates[i]);
+			delete candidates[i];
+			num++;
+		}
+		num_evicted += num;
+		return num;
+	}
+};
+
+//keeps a reference to a resource so it is never evicted, it can be used like a raw pointer
+template<typename T> class ResourceHandle
+{
+public:
+	ResourceHandle(T* resource = NULL) : ptr(resource) { if (ptr) ptr->addRef(); }
+	ResourceHandle(const ResourceHandle& other) : ptr(other.ptr) { if (ptr) ptr->addRef(); }
+	~ResourceHandle() { if (ptr) ptr->removeRef(); }
+
+	ResourceHandle& operator = (T* resource)
+	{
+		if (resource)
+			resource->addRef();
+		if (ptr)
+			ptr->removeRef();
+		ptr = resource;
+		return *this;
+	}
+	ResourceHandle& operator = (const ResourceHandle& other) { return *this = other.ptr; }
+
+	T* get() const { return ptr; }
+	operator T*() const { return ptr; }
+	T* operator -> () const { assert(ptr); return ptr; }
+	T& operator * () const { assert(ptr); return *ptr; }
+
+private:
+	T* ptr;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "ringbuffer.h"
+
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+
+std::vector<RingBuffer*> RingBuffer::s_buffers;
+
+bool RingBuffer::isSupported()
+{
+	return glFenceSync != 0 && glMapBufferRange != 0;
+}
+
+void RingBuffer::EndFrameAll()
+{
+	for (size_t i = 0; i < s_buffers.size(); ++i)
+		s_buffers[i]->endFrame();
+}
+
+RingBuffer::RingBuffer(unsigned int frame_size, GLenum target)
+{
+	assert(isSupported());
+	this->frame_size = frame_size;
+	this->target = target;
+	frame = 0;
+	used = 0;
+	num_waits = 0;
+	mapped = false;
+	data = NULL;
+	for (int i = 0; i < RING_BUFFER_FRAMES; ++i)
+		fences[i] = 0;
+
+	unsigned int total_size = frame_size * RING_BUFFER_FRAMES;
+	glGenBuffers(1, &buffer_id);
+	glBindBuffer(target, buffer_id);
+
+	persistent = glBufferStorage != 0;
+	if (persistent)
+	{
+		//coherent so the writes are visible without flushing, the fences avoid overwriting data in use
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total_size, NULL, flags);
+		data = (unsigned char*)glMapBufferRange(target, 0, total_size, flags);
+		if (!data)
+		{
+			std::cout << "[WARN] persistent mapping failed, ring buffer will map every allocation" << std::endl;
+			glDeleteBuffers(1, &buffer_id);
+			glGenBuffers(1, &buffer_id);
+			glBindBuffer(target, buffer_id);
+			persistent = false;
+		}
+	}
+	if (!persistent)
+		glBufferData(target, total_size, NULL, GL_STREAM_DRAW);
+
+	glBindBuffer(target, 0);
+	assert(glGetError() == GL_NO_ERROR);
+
+	s_buffers.push_back(this);
+}
+
+RingBuffer::~RingBuffer()
+{
+	for (int i = 0; i < RING_BUFFER_FRAMES; ++i)
+		if (fences[i])
+			glDeleteSync(fences[i]);
+
+	if (persistent)
+	{
+		glBindBuffer(target, buffer_id);
+		glUnmapBuffer(target);
+		glBindBuffer(target, 0);
+	}
+	glDeleteBuffers(1, &buffer_id);
+
+	std::vector<RingBuffer*>::iterator it = std::find(s_buffers.begin(), s_buffers.end(), this);
+	if (it != s_buffers.end())
+		s_buffers.erase(it);
+}
+
+void* RingBuffer::allocate(unsigned int size, unsigned int alignment, unsigned int& offset)
+{
+	assert(!mapped && "commit the previous allocation first");
+	if (alignment < 1)
+		alignment = 1;
+
+	unsigned int region_start = frame * frame_size;
+	unsigned int start = region_start + used;
+	start = ((start + alignment - 1) / alignment) * alignment; //region_start is not aligned either
+	if (start + size > region_start + frame_size)
+		return NULL; //full until next frame
+
+	void* ptr = NULL;
+	if (persistent)
+		ptr = data + start;
+	else
+	{
+		//unsynchronized is safe, the fence of this region was waited when the frame started
+		glBindBuffer(target, buffer_id);
+		ptr = glMapBufferRange(target, start, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(target, 0);
+		if (!ptr)
+			return NULL; //the space is not taken, nothing was written
+		mapped = true;
+	}
+
+	used = start + size - region_start;
+	offset = start;
+	return ptr;
+}
+
+void RingBuffer::commit()
+{
+	if (!mapped)
+		return;
+	glBindBuffer(target, buffer_id);
+	glUnmapBuffer(target);
+	glBindBuffer(target, 0);
+	mapped = false;
+}
+
+void RingBuffer::endFrame()
+{
+	commit();
+
+	if (used)
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame = (frame + 1) % RING_BUFFER_FRAMES;
+	used = 0;
+
+	//the GPU could still be reading this region from RING_BUFFER_FRAMES frames ago
+	GLsync fence = fences[frame];
+	if (!fence)
+		return;
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		num_waits++;
+		do
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+		while (result == GL_TIMEOUT_EXPIRED);
+	}
+	if (result == GL_WAIT_FAILED)
+		std::cout << "[ERROR] waiting for a ring buffer fence" << std::endl;
+	glDeleteSync(fence);
+	fences[frame] = 0;
+}
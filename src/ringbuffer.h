@@ -0,0 +1,46 @@
+/*  Buffer in VRAM that the CPU fills every frame (instance data, etc) without stalling the driver.
+	It is split in one region per frame in flight, every frame sub-allocates from its own region
+	and a fence tells when the GPU is done with it, so it is only waited if the GPU falls behind.
+	It keeps the buffer persistently mapped when the driver supports it (GL 4.4 or ARB_buffer_storage).
+*/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "includes.h"
+#include <vector>
+
+#define RING_BUFFER_FRAMES 3 //triple buffered
+
+class RingBuffer
+{
+public:
+	static std::vector<RingBuffer*> s_buffers; //all the ring buffers created
+	static bool isSupported(); //needs fences and glMapBufferRange
+	static void EndFrameAll(); //call it once per frame after rendering
+
+	GLuint buffer_id;
+	GLenum target;
+	unsigned int frame_size; //bytes available every frame
+	bool persistent; //mapped once, allocate returns memory that the GPU reads directly
+	long num_waits; //times the CPU had to wait for the GPU to release a region
+
+	RingBuffer(unsigned int frame_size, GLenum target = GL_ARRAY_BUFFER);
+	~RingBuffer();
+
+	//reserves size bytes in the region of this frame, offset is a multiple of alignment (it doesnt need to be a power of two)
+	//returns where to write the data or NULL if the region is full, call commit before drawing with it
+	void* allocate(unsigned int size, unsigned int alignment, unsigned int& offset);
+	void commit(); //makes the last allocation visible to the GPU (nothing to do when persistent)
+
+	void endFrame(); //fences the region used this frame and moves to the next one
+
+private:
+	unsigned char* data; //persistent mapping
+	GLsync fences[RING_BUFFER_FRAMES];
+	int frame; //current region
+	unsigned int used; //bytes used in the current region
+	bool mapped; //an allocation is mapped and waiting for commit (not persistent)
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "utils.h"
 
 unsigned int SceneNode::lastNameId = 0;
+Mesh* SceneNode::loading_proxy = NULL;
 
 SceneNode::SceneNode()
 {
@@ -21,14 +22,43 @@ SceneNode::~SceneNode()
 
 }
 
+BoundingBox SceneNode::getWorldBoundingBox() const
+{
+	assert(mesh);
+	return transformBoundingBox(model, mesh->box);
+}
+
+bool SceneNode::isInFrustum(Camera* camera) const
+{
+	if (!mesh || !mesh->isReady() || mesh->radius <= 0.0f)
+		return true; //some meshes have no bounds (quads, .mesh files)
+	BoundingBox box = getWorldBoundingBox();
+	return camera->testBoxInFrustum(box.center, box.halfsize) != CLIP_OUTSIDE;
+}
+
 void SceneNode::render(Camera* camera)
 {
-	if (material)
-		material->render(mesh, model, camera);
+	if (!material)
+		return;
+
+	//meshes loaded with Mesh::GetAsync may not be ready yet
+	if (mesh && !mesh->isReady())
+	{
+		if (loading_proxy)
+			material->render(loading_proxy, model, camera);
+		return;
+	}
+
+	if (!isInFrustum(camera))
+		return;
+	material->render(mesh, model, camera);
 }
 
 void SceneNode::renderWireframe(Camera* camera)
 {
+	if (mesh && !mesh->isReady())
+		return;
+
 	WireframeMaterial mat = WireframeMaterial();
 	mat.render(mesh, model, camera);
 }
@@ -11,6 +11,7 @@ class SceneNode {
 public:
 
 	static unsigned int lastNameId;
+	static Mesh* loading_proxy; //rendered instead of the meshes that are still loading, if NULL they are skipped
 
 	SceneNode();
 	SceneNode(const char* name);
@@ -19,9 +20,12 @@ public:
 	Material * material = NULL;
 	std::string name;
 
-	Mesh* mesh = NULL;
+	ResourceHandle<Mesh> mesh; //keeps it from being evicted, load it with Mesh::Get(name, true) so it can be once the node is gone
 	Matrix44 model;
 
+	BoundingBox getWorldBoundingBox() const; //box of the mesh with the model applied
+	bool isInFrustum(Camera* camera) const; //true if there is no mesh yet or it has no bounds
+
 	virtual void render(Camera* camera);
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
@@ -53,9 +53,11 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 
 #endif
 
-std::map<std::string,Shader*> Shader::s_Shaders;
+ResourcePool<Shader> Shader::s_Shaders("Shaders");
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+unsigned int Shader::s_last_uid = 0;
+std::set<unsigned int> Shader::s_live_uids;
 
 Shader::Shader()
 {
@@ -63,13 +65,25 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	uid = 0;
+	program_bytes = 0;
 }
 
 Shader::~Shader()
 {
+	if (current == this)
+		current = NULL;
 	release();
 }
 
+void Shader::getMemoryUsage(size_t& cpu, size_t& gpu) const
+{
+	cpu = info_log.capacity() + vs_filename.capacity() + ps_filename.capacity() + macros.capacity() +
+		(locations.size() + attrib_locations.size()) * 64; //rough cost of every cached location
+
+	gpu = program_bytes; //queried when it was compiled, this can be called without a GL context
+}
+
 void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 {
 	vs_filename = vsf;
@@ -117,17 +131,17 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 		name = std::string(vsf) + "," + std::string(psf ? psf : "") + (macros ? macros : "");
 	else
 		name = vsf;
-	std::map<std::string,Shader*>::iterator it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
+	Shader* sh = s_Shaders.find(name);
+	if (sh)
+		return sh;
 
 	if (!psf)
 		return NULL;
 
-	Shader* sh = new Shader();
+	sh = new Shader();
 	if (!sh->load( vsf,psf, macros ))
 		return NULL;
-	s_Shaders[name] = sh;
+	s_Shaders.add(name, sh);
 	return sh;
 }
 
@@ -241,15 +255,12 @@ bool Shader::LoadAtlas(const char* filename)
 		vs_code = macros + "\n" + vs_code;
 		fs_code = macros + "\n" + fs_code;
 
-		Shader* shader = NULL;
-		auto it = s_Shaders.find( name );
-		if(it == s_Shaders.end())
+		Shader* shader = s_Shaders.find( name );
+		if(!shader)
 		{
 			shader = new Shader();
-			s_Shaders[ name ] = shader;
+			s_Shaders.add( name, shader );
 		}
-		else
-			shader = it->second;
 	
 		if (!shader->compileFromMemory(vs_code,fs_code))
 		{
@@ -335,7 +346,15 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
+	//the driver tells the size of the binary only if it supports them
+	GLint length = 0;
+	if (glGetProgramBinary)
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	program_bytes = length;
+
 	compiled = true;
+	uid = ++s_last_uid; //anything cached with the previous uid is no longer valid
+	s_live_uids.insert(uid);
 
 	return true;
 }
@@ -409,6 +428,9 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 
 void Shader::release()
 {
+	s_live_uids.erase(uid);
+	program_bytes = 0;
+
 	if (vs)
 	{
 		glDeleteShader(vs);
@@ -431,6 +453,7 @@ void Shader::release()
 	}
 
 	locations.clear();
+	attrib_locations.clear();
 
 	compiled = false;
 }
@@ -438,6 +461,7 @@ void Shader::release()
 
 void Shader::enable()
 {
+	touch();
 	if (current == this)
 		return;
 
@@ -538,13 +562,13 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 
 int Shader::getAttribLocation(const char* varname)
 {
+	attribtable::iterator cur = attrib_locations.find(varname);
+	if (cur != attrib_locations.end())
+		return (*cur).second;
+
 	int loc = glGetAttribLocation(program, varname);
-	if (loc == -1)
-	{
-		return loc;
-	}
 	assert(glGetError() == GL_NO_ERROR);
-
+	attrib_locations.insert(attribtable::value_type(varname, loc));
 	return loc;
 }
 
@@ -568,6 +592,7 @@ void Shader::setTexture(const char* varname, Texture* tex, int slot)
 	}
 
 	glActiveTexture(GL_TEXTURE0 + slot);
+	tex->touch();
 	glBindTexture(tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
 	glActiveTexture(GL_TEXTURE0 + slot);
@@ -781,9 +806,9 @@ void Shader::init()
 
 Shader* Shader::getDefaultShader(std::string name)
 {
-	auto it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
+	Shader* sh = s_Shaders.find(name);
+	if (sh)
+		return sh;
 
 	std::string vs = "";
 	std::string fs = "";
@@ -892,7 +917,7 @@ Shader* Shader::getDefaultShader(std::string name)
 	}
 
 
-	Shader* sh = new Shader();
+	sh = new Shader();
 	if (!sh->compileFromMemory(vs, fs))
 	{
 		assert(0 && "error in default shader");
@@ -903,6 +928,6 @@ Shader* Shader::getDefaultShader(std::string name)
 	sh->setUniform4("u_color", Vector4(1, 1, 1, 1));
 	sh->disable();
 
-	s_Shaders[name] = sh;
+	s_Shaders.add(name, sh);
 	return sh;
 }
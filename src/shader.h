@@ -8,7 +8,9 @@
 #include "includes.h"
 #include <string>
 #include <map>
+#include <set>
 #include "framework.h"
+#include "resource.h"
 #include <cassert>
 
 #ifdef _DEBUG
@@ -20,7 +22,7 @@
 
 class Texture;
 
-class Shader
+class Shader : public Resource
 {
 	int last_slot;
 
@@ -28,6 +30,9 @@ class Shader
 
 public:
 	static Shader* current;
+	static unsigned int s_last_uid;
+	static std::set<unsigned int> s_live_uids; //uids of the programs that still exist
+	static bool isLiveUID(unsigned int uid) { return s_live_uids.count(uid) != 0; } //false once the program is released or recompiled
 
 	Shader();
 	virtual ~Shader();
@@ -97,12 +102,14 @@ public:
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 	bool compiled;
+	unsigned int uid; //changes every time the program is compiled, used as key to cache things that depend on it (VAOs)
 
 	void setMacros(const char * macros);
 
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
 	static void ReloadAll();
-	static std::map<std::string,Shader*> s_Shaders;
+	static ResourcePool<Shader> s_Shaders;
+	void getMemoryUsage(size_t& cpu, size_t& gpu) const; //gpu is the size of the program binary when the driver tells it
 
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
@@ -131,6 +138,7 @@ protected:
 	GLuint vs;
 	GLuint fs;
 	GLuint program;
+	size_t program_bytes; //binary size reported by the driver after linking, used by getMemoryUsage
 	std::string log;
 
 //this is a hack to speed up shader usage (save info locally)
@@ -144,10 +152,12 @@ private:
 		}
 	};	
 	typedef std::map<const char*, int, ltstr> loctable;
+	typedef std::map<std::string, int> attribtable; //the names are copied, the callers can pass temporary strings
 
 public:
 	GLint getLocation( const char* varname, loctable* table );
 	loctable locations;	
+	attribtable attrib_locations; //missing attributes are stored too (as -1)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "skeletonpose.h"
+#include "animation.h"
+
+#include <cassert>
+#include <cstring>
+
+bool sortBoneHierarchy(const int8* parents, int num_bones, uint8* order)
+{
+	if (num_bones < 0 || num_bones > SKELETON_MAX_BONES)
+		return false;
+
+	//in their own order if the hierarchy is not valid, so the callers never index out of the bones
+	for (int i = 0; i < num_bones; ++i)
+		order[i] = (uint8)i;
+
+	//depth of every bone, then a stable counting sort by depth
+	int depth[SKELETON_MAX_BONES];
+	int count[SKELETON_MAX_BONES + 1];
+	memset(count, 0, sizeof(count));
+	for (int i = 0; i < num_bones; ++i)
+	{
+		int d = 0;
+		for (int p = parents[i]; p != -1; p = parents[p])
+			if (p < 0 || p >= num_bones || ++d >= num_bones)
+				return false; //parent out of the skeleton or a cycle (no chain has more than num_bones - 1 parents)
+		depth[i] = d;
+		count[d + 1]++;
+	}
+	for (int d = 1; d <= num_bones; ++d)
+		count[d] += count[d - 1];
+	for (int i = 0; i < num_bones; ++i)
+		order[count[depth[i]]++] = (uint8)i;
+	return true;
+}
+
+void computeGlobalMatrices(const Matrix44* locals, size_t local_stride, const int8* parents, const uint8* order, int num_bones, Matrix44* globals)
+{
+	const char* base = (const char*)locals;
+	for (int n = 0; n < num_bones; ++n)
+	{
+		int i = order[n];
+		const Matrix44& local = *(const Matrix44*)(base + local_stride * i);
+		int parent = parents[i];
+		if (parent < 0 || parent >= num_bones || parent == i)
+		{
+			globals[i] = local;
+			continue;
+		}
+		multiplyMatrices(local, globals[parent], globals[i]);
+	}
+}
+
+void multiplyMatricesIndexed(const Matrix44* a, const Matrix44* b, const int* indices, int num, Matrix44* out)
+{
+	for (int i = 0; i < num; ++i)
+	{
+		if (indices[i] == -1)
+		{
+			out[i] = a[i];
+			continue;
+		}
+		multiplyMatrices(a[i], b[indices[i]], out[i]);
+	}
+}
+
+
+SkeletonPose::SkeletonPose()
+{
+	num_bones = 0;
+}
+
+void SkeletonPose::setup(const Skeleton& skeleton)
+{
+	num_bones = skeleton.num_bones;
+	for (int i = 0; i < num_bones; ++i)
+	{
+		parents[i] = skeleton.bones[i].parent;
+		locals[i] = skeleton.bones[i].model;
+	}
+	sortBoneHierarchy(parents, num_bones, order);
+}
+
+void SkeletonPose::updateGlobalMatrices()
+{
+	computeGlobalMatrices(locals, sizeof(Matrix44), parents, order, num_bones, globals);
+}
+
+void SkeletonPose::copyTo(Skeleton& skeleton) const
+{
+	assert(skeleton.num_bones == num_bones);
+	for (int i = 0; i < num_bones; ++i)
+		skeleton.bones[i].model = locals[i];
+	memcpy(skeleton.global_bone_matrices, globals, sizeof(Matrix44) * num_bones);
+}
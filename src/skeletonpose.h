@@ -0,0 +1,42 @@
+/*  Runtime pose of a skeleton in SoA, for code that updates many poses per frame.
+	The hierarchy is stored as dense arrays (parent of every bone and an order where every parent comes
+	before its children) and the local and global matrices are contiguous, so the global pose is a single
+	pass of SIMD matrix multiplies. Skeleton uses the same update through its bones (see Skeleton::sortHierarchy).
+*/
+
+#ifndef SKELETONPOSE_H
+#define SKELETONPOSE_H
+
+#include "framework.h"
+
+class Skeleton;
+
+#define SKELETON_MAX_BONES 128
+
+//fills order with the bones sorted so every parent comes before its children (-1 is a root).
+//Returns false, with the bones left in their own order, if a parent is out of the skeleton or there is a cycle
+bool sortBoneHierarchy(const int8* parents, int num_bones, uint8* order);
+
+//globals[i] = locals[i] * globals[parents[i]] following order, locals are local_stride bytes apart (to read them from other structs)
+void computeGlobalMatrices(const Matrix44* locals, size_t local_stride, const int8* parents, const uint8* order, int num_bones, Matrix44* globals);
+
+//out[i] = a[i] * b[indices[i]] (or a[i] if the index is -1), used to build skinning palettes
+void multiplyMatricesIndexed(const Matrix44* a, const Matrix44* b, const int* indices, int num, Matrix44* out);
+
+class SkeletonPose
+{
+public:
+	int num_bones;
+	int8 parents[SKELETON_MAX_BONES];
+	uint8 order[SKELETON_MAX_BONES];
+	Matrix44 locals[SKELETON_MAX_BONES];
+	Matrix44 globals[SKELETON_MAX_BONES];
+
+	SkeletonPose();
+
+	void setup(const Skeleton& skeleton); //takes the hierarchy and the current local pose of the skeleton
+	void updateGlobalMatrices();
+	void copyTo(Skeleton& skeleton) const; //writes the local and global matrices back to the skeleton
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "skinning.h"
+#include "mesh.h"
+#include "threadpool.h"
+
+#include <cassert>
+
+#ifdef FRAMEWORK_USE_SSE
+	#define SKINNING_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+#define SKINNING_VERTICES_PER_TASK 4096
+
+void skinVertices(const Mesh* mesh, const Matrix44* palette, int num_bones, sSkinnedVertex* out)
+{
+	int num_vertices = (int)(mesh->interleaved.size() ? mesh->interleaved.size() : mesh->vertices.size());
+	ThreadPool::Get()->parallelFor(num_vertices, SKINNING_VERTICES_PER_TASK, [&](int start, int end) {
+		skinVertices(mesh, palette, num_bones, out, start, end);
+	});
+}
+
+void skinVertices(const Mesh* mesh, const Matrix44* palette, int num_bones, sSkinnedVertex* out, int start, int end)
+{
+	assert(mesh && palette && num_bones > 0 && out);
+	assert(mesh->bones.size() && mesh->weights.size() && "the mesh has no skinning data");
+
+	//positions and normals can be interleaved or in their own streams
+	const char* positions;
+	const char* normals = NULL;
+	size_t stride = sizeof(Vector3);
+	if (mesh->interleaved.size())
+	{
+		positions = (const char*)&mesh->interleaved[0].vertex;
+		normals = (const char*)&mesh->interleaved[0].normal;
+		stride = sizeof(Mesh::tInterleaved);
+	}
+	else
+	{
+		positions = (const char*)&mesh->vertices[0];
+		if (mesh->normals.size())
+			normals = (const char*)&mesh->normals[0];
+	}
+	const Vector4ub* bones = &mesh->bones[0];
+	const Vector4* weights = &mesh->weights[0];
+	int last_bone = num_bones - 1;
+
+	for (int i = start; i < end; ++i)
+	{
+		const float* p = (const float*)(positions + stride * i);
+		const float* n = normals ? (const float*)(normals + stride * i) : NULL;
+		const unsigned char* b = &bones[i].x;
+		const float* w = &weights[i].x;
+
+#ifdef SKINNING_USE_SSE
+		//weighted sum of the rows of the matrices of the bones
+		__m128 r0 = _mm_setzero_ps(), r1 = _mm_setzero_ps(), r2 = _mm_setzero_ps(), r3 = _mm_setzero_ps();
+		for (int k = 0; k < 4; ++k)
+		{
+			if (w[k] == 0.0f)
+				continue;
+			const float* m = palette[b[k] < last_bone ? b[k] : last_bone].m;
+			__m128 weight = _mm_set1_ps(w[k]);
+			r0 = _mm_add_ps(r0, _mm_mul_ps(_mm_loadu_ps(m), weight));
+			r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(m + 4), weight));
+			r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_loadu_ps(m + 8), weight));
+			r3 = _mm_add_ps(r3, _mm_mul_ps(_mm_loadu_ps(m + 12), weight));
+		}
+
+		//row vectors: v * M
+		__m128 position = combineRows(r0, r1, r2, r3, p[0], p[1], p[2]);
+		__m128 normal = n ? combineRows(r0, r1, r2, _mm_setzero_ps(), n[0], n[1], n[2]) : _mm_setzero_ps();
+
+		float* dst = &out[i].position.x;
+		if (i + 1 < end)
+		{
+			//each store writes one float too many that the next store overwrites
+			_mm_storeu_ps(dst, position);
+			_mm_storeu_ps(dst + 3, normal);
+		}
+		else
+		{
+			//the last one of the range could belong to another thread
+			float values[8];
+			_mm_storeu_ps(values, position);
+			_mm_storeu_ps(values + 4, normal);
+			out[i].position.set(values[0], values[1], values[2]);
+			out[i].normal.set(values[4], values[5], values[6]);
+		}
+#else
+		Matrix44 m;
+		memset(m.m, 0, sizeof(m.m));
+		for (int k = 0; k < 4; ++k)
+		{
+			if (w[k] == 0.0f)
+				continue;
+			const Matrix44& bone = palette[b[k] < last_bone ? b[k] : last_bone];
+			for (int j = 0; j < 16; ++j)
+				m.m[j] += bone.m[j] * w[k];
+		}
+		out[i].position = m * Vector3(p[0], p[1], p[2]);
+		out[i].normal = n ? m.rotateVector(Vector3(n[0], n[1], n[2])) : Vector3();
+#endif
+	}
+}
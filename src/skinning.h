@@ -0,0 +1,26 @@
+/*  Linear blend skinning in the CPU.
+	It deforms the vertices of a mesh with its bones and weights and a palette (like the one built by
+	Skeleton::computeFinalBoneMatrices), in parallel and using SIMD. The result can be streamed to the GPU
+	(see Mesh::use_cpu_skinning) or used by anything that needs the deformed pose (rays, collisions, shadows).
+*/
+
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include "framework.h"
+
+class Mesh;
+
+//position and normal of a deformed vertex, the normal is not normalized
+struct sSkinnedVertex {
+	Vector3 position;
+	Vector3 normal;
+};
+
+//out must have room for mesh->getNumVertices(), bone indices out of the palette use its last bone
+void skinVertices(const Mesh* mesh, const Matrix44* palette, int num_bones, sSkinnedVertex* out);
+
+//the same for a range of vertices in the calling thread
+void skinVertices(const Mesh* mesh, const Matrix44* palette, int num_bones, sSkinnedVertex* out, int start, int end);
+
+#endif
@@ -0,0 +1,407 @@
+#include "terrain.h"
+#include "texture.h"
+#include "shader.h"
+#include "material.h"
+#include "threadpool.h"
+#include "extra/imgui/imgui.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#ifdef FRAMEWORK_USE_SSE
+	#define TERRAIN_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+#define HEIGHTMAP_ROWS_PER_TASK 16
+#define TERRAIN_FAR 1e30f
+
+// HEIGHTMAP *********************************
+
+bool HeightMap::load(const char* filename, float altitude)
+{
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of(".") + 1);
+
+	Image image;
+	bool found = false;
+	if (ext == "tga" || ext == "TGA")
+		found = image.loadTGA(filename);
+	else if (ext == "png" || ext == "PNG")
+		found = image.loadPNG(filename, true);
+	if (!found)
+	{
+		std::cout << "[ERROR] heightmap not found or unsupported format: " << filename << std::endl;
+		return false;
+	}
+
+	fromImage(&image, altitude);
+	return true;
+}
+
+void HeightMap::fromImage(Image* image, float altitude)
+{
+	assert(image && image->data && "image without data");
+	resize(image->width, image->height);
+
+	//converted once, sampling floats is much cheaper than going through Color every time
+	float factor = altitude / 255.0f;
+	unsigned int bpp = image->bytes_per_pixel;
+	const Uint8* pixels = image->data;
+	ThreadPool::Get()->parallelFor(height, HEIGHTMAP_ROWS_PER_TASK, [&](int start, int end) {
+		for (int y = start; y < end; ++y)
+		{
+			const Uint8* src = pixels + y * width * bpp;
+			float* dst = &data[y * width];
+			for (unsigned int x = 0; x < width; ++x)
+				dst[x] = src[x * bpp] * factor;
+		}
+	});
+}
+
+float HeightMap::getInterpolated(float x, float y) const
+{
+	x = clamp(x, 0.0f, (float)(width - 1));
+	y = clamp(y, 0.0f, (float)(height - 1));
+	int ix = (int)x;
+	int iy = (int)y;
+	float fx = x - ix;
+	float fy = y - iy;
+	float top = getValue(ix, iy) * (1.0f - fx) + getValue(ix + 1, iy) * fx;
+	float bottom = getValue(ix, iy + 1) * (1.0f - fx) + getValue(ix + 1, iy + 1) * fx;
+	return top * (1.0f - fy) + bottom * fy;
+}
+
+Vector3 HeightMap::getNormal(float x, float y, float cell_x, float cell_z) const
+{
+	//central differences
+	float dx = (getInterpolated(x + 1.0f, y) - getInterpolated(x - 1.0f, y)) / (2.0f * cell_x);
+	float dz = (getInterpolated(x, y + 1.0f) - getInterpolated(x, y - 1.0f)) / (2.0f * cell_z);
+	Vector3 normal(-dx, 1.0f, -dz);
+	return normal * (1.0f / normal.length());
+}
+
+static inline Vector4ub packNormal(float x, float y, float z)
+{
+	float inv = 1.0f / sqrt(x * x + y * y + z * z);
+	return Vector4ub((unsigned char)(x * inv * 127.5f + 127.5f), (unsigned char)(y * inv * 127.5f + 127.5f), (unsigned char)(z * inv * 127.5f + 127.5f), 255);
+}
+
+void HeightMap::computeNormals(float cell_x, float cell_z, std::vector<Vector4ub>& normals) const
+{
+	normals.resize(width * height);
+	float ix = 1.0f / (2.0f * cell_x);
+	float iz = 1.0f / (2.0f * cell_z);
+
+	ThreadPool::Get()->parallelFor(height, HEIGHTMAP_ROWS_PER_TASK, [&](int start, int end) {
+		for (int y = start; y < end; ++y)
+		{
+			const float* row = &data[y * width];
+			const float* up = &data[(y > 0 ? y - 1 : y) * width];
+			const float* down = &data[(y < (int)height - 1 ? y + 1 : y) * width];
+			Vector4ub* dst = &normals[y * width];
+			unsigned int x = 0;
+
+			//the borders use the clamped neighbours
+			if (width > 1)
+			{
+				dst[0] = packNormal((row[0] - row[1]) * ix, 1.0f, (up[0] - down[0]) * iz);
+				x = 1;
+			}
+
+#ifdef TERRAIN_USE_SSE
+			//four samples at once, the result is packed in four bytes per normal with shifts
+			__m128 vix = _mm_set1_ps(ix);
+			__m128 viz = _mm_set1_ps(iz);
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 half = _mm_set1_ps(0.5f);
+			__m128 three_halfs = _mm_set1_ps(1.5f);
+			__m128 scale = _mm_set1_ps(127.5f);
+			__m128i alpha = _mm_set1_epi32((int)0xFF000000);
+			for (; x + 4 < width; x += 4)
+			{
+				__m128 nx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1)), vix);
+				__m128 nz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x)), viz);
+				__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(nz, nz)), one);
+
+				//rsqrt plus one newton step is precise enough for 8 bits
+				__m128 inv = _mm_rsqrt_ps(len2);
+				inv = _mm_mul_ps(inv, _mm_sub_ps(three_halfs, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(inv, inv))));
+
+				__m128 scaled = _mm_mul_ps(inv, scale);
+				__m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(nx, scaled), scale));
+				__m128i g = _mm_cvttps_epi32(_mm_add_ps(scaled, scale));
+				__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(nz, scaled), scale));
+				__m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), alpha));
+				_mm_storeu_si128((__m128i*)(dst + x), packed);
+			}
+#endif
+			for (; x < width; ++x)
+			{
+				float left = x > 0 ? row[x - 1] : row[x];
+				float right = x + 1 < width ? row[x + 1] : row[x];
+				dst[x] = packNormal((left - right) * ix, 1.0f, (up[x] - down[x]) * iz);
+			}
+		}
+	});
+}
+
+// TERRAIN *********************************
+
+InstanceLayout Terrain::chunk_layout = InstanceLayout().add("a_chunk", 4).add("a_morph", 2);
+
+Terrain::Terrain()
+{
+	name = "Terrain";
+	size = 0.0f;
+	patch_resolution = 32;
+	num_lods = 0;
+	lod_distance = 0.0f;
+	morph_ratio = 0.3f;
+	light_direction.set(0.4f, 0.8f, 0.2f);
+	light_direction.normalize();
+	patch = NULL;
+	heights_texture = NULL;
+	normals_texture = NULL;
+
+	default_material = new StandardMaterial();
+	default_material->shader = Shader::Get("data/shaders/terrain.vs", "data/shaders/terrain.fs");
+	material = default_material;
+}
+
+Terrain::~Terrain()
+{
+	delete patch;
+	delete heights_texture;
+	delete normals_texture;
+	if (material == default_material)
+		material = NULL;
+	delete default_material;
+}
+
+bool Terrain::create(const char* heightmap_filename, float size, float altitude, int patch_resolution)
+{
+	if (!heightmap.load(heightmap_filename, altitude))
+		return false;
+	create(size, patch_resolution);
+	return true;
+}
+
+void Terrain::create(float size, int patch_resolution)
+{
+	assert(heightmap.width > 1 && heightmap.height > 1 && "heightmap is empty");
+	assert(isPowerOfTwo(patch_resolution) && "patch resolution must be a power of two");
+	this->size = size;
+	this->patch_resolution = patch_resolution;
+
+	//enough leafs to have at least one vertex per sample in lod 0
+	int samples = std::max(heightmap.width, heightmap.height) - 1;
+	int num_leafs = 1;
+	num_lods = 1;
+	while (num_leafs * patch_resolution < samples && num_lods < TERRAIN_MAX_LODS)
+	{
+		num_leafs *= 2;
+		num_lods++;
+	}
+	float leaf_size = size / num_leafs;
+
+	//the range of a lod must be bigger than its nodes or the lod could jump more than one level between neighbours
+	if (lod_distance < leaf_size * 2.0f)
+		lod_distance = leaf_size * 2.5f;
+
+	//min and max heights of the leafs, then every lod from the four nodes below
+	float cell_x = size / (heightmap.width - 1);
+	float cell_z = size / (heightmap.height - 1);
+	min_max.resize(num_lods);
+	min_max[0].resize(num_leafs * num_leafs * 2);
+	ThreadPool::Get()->parallelFor(num_leafs, 1, [&](int start, int end) {
+		for (int z = start; z < end; ++z)
+			for (int x = 0; x < num_leafs; ++x)
+			{
+				int x0 = (int)floor(x * leaf_size / cell_x), x1 = std::min((int)ceil((x + 1) * leaf_size / cell_x), (int)heightmap.width - 1);
+				int z0 = (int)floor(z * leaf_size / cell_z), z1 = std::min((int)ceil((z + 1) * leaf_size / cell_z), (int)heightmap.height - 1);
+				float min_h = TERRAIN_FAR, max_h = -TERRAIN_FAR;
+				for (int j = z0; j <= z1; ++j)
+					for (int i = x0; i <= x1; ++i)
+					{
+						float h = heightmap.data[j * heightmap.width + i];
+						min_h = h < min_h ? h : min_h;
+						max_h = h > max_h ? h : max_h;
+					}
+				min_max[0][(z * num_leafs + x) * 2] = min_h;
+				min_max[0][(z * num_leafs + x) * 2 + 1] = max_h;
+			}
+	});
+	for (int lod = 1; lod < num_lods; ++lod)
+	{
+		int num_nodes = num_leafs >> lod;
+		const std::vector<float>& below = min_max[lod - 1];
+		std::vector<float>& current = min_max[lod];
+		current.resize(num_nodes * num_nodes * 2);
+		for (int z = 0; z < num_nodes; ++z)
+			for (int x = 0; x < num_nodes; ++x)
+			{
+				float min_h = TERRAIN_FAR, max_h = -TERRAIN_FAR;
+				for (int i = 0; i < 4; ++i)
+				{
+					const float* child = &below[(((z * 2 + (i >> 1)) * num_nodes * 2) + x * 2 + (i & 1)) * 2];
+					min_h = std::min(min_h, child[0]);
+					max_h = std::max(max_h, child[1]);
+				}
+				current[(z * num_nodes + x) * 2] = min_h;
+				current[(z * num_nodes + x) * 2 + 1] = max_h;
+			}
+	}
+
+	for (int i = 0; i < num_lods; ++i)
+		lod_ranges[i] = i == num_lods - 1 ? TERRAIN_FAR : lod_distance * (1 << i);
+
+	if (Mesh::auto_upload_to_vram)
+		uploadToVRAM();
+}
+
+void Terrain::uploadToVRAM()
+{
+	assert(heightmap.width > 1 && heightmap.height > 1 && "heightmap is empty");
+
+	//heights as floats, normals packed and the shared patch
+	std::vector<Vector4ub> normals;
+	heightmap.computeNormals(size / (heightmap.width - 1), size / (heightmap.height - 1), normals);
+
+	delete heights_texture;
+	heights_texture = new Texture();
+	heights_texture->create(heightmap.width, heightmap.height, GL_RED, GL_FLOAT, false, (Uint8*)&heightmap.data[0], GL_R32F);
+	delete normals_texture;
+	normals_texture = new Texture();
+	normals_texture->create(heightmap.width, heightmap.height, GL_RGBA, GL_UNSIGNED_BYTE, true, (Uint8*)&normals[0]);
+
+	delete patch;
+	patch = new Mesh();
+	patch->createGridPatch(patch_resolution);
+	patch->uploadToVRAM();
+}
+
+float Terrain::getHeight(float x, float z) const
+{
+	if (!heightmap.width || size <= 0.0f)
+		return 0.0f;
+	return heightmap.getInterpolated(x / size * (heightmap.width - 1), z / size * (heightmap.height - 1));
+}
+
+//distance from a point to an AABB, 0 if it is inside
+static inline float distanceToBox(const Vector3& p, const Vector3& bmin, const Vector3& bmax)
+{
+	float dx = std::max(std::max(bmin.x - p.x, 0.0f), p.x - bmax.x);
+	float dy = std::max(std::max(bmin.y - p.y, 0.0f), p.y - bmax.y);
+	float dz = std::max(std::max(bmin.z - p.z, 0.0f), p.z - bmax.z);
+	return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+BoundingBox Terrain::getNodeBox(int x, int z, int lod) const
+{
+	int num_nodes = 1 << (num_lods - 1 - lod);
+	float node_size = size / num_nodes;
+	const float* node_min_max = &min_max[lod][(z * num_nodes + x) * 2];
+	Vector3 bmin(x * node_size, node_min_max[0], z * node_size);
+	Vector3 bmax(bmin.x + node_size, node_min_max[1], bmin.z + node_size);
+	return BoundingBox((bmin + bmax) * 0.5f, (bmax - bmin) * 0.5f);
+}
+
+void Terrain::selectNode(Camera* camera, const Vector3& local_eye, int x, int z, int lod)
+{
+	int num_nodes = 1 << (num_lods - 1 - lod);
+	float node_size = size / num_nodes;
+	const float* node_min_max = &min_max[lod][(z * num_nodes + x) * 2];
+	Vector3 bmin(x * node_size, node_min_max[0], z * node_size);
+	Vector3 bmax(bmin.x + node_size, node_min_max[1], bmin.z + node_size);
+
+	//more detail while the camera is inside the range of the lod below
+	if (lod > 0 && distanceToBox(local_eye, bmin, bmax) < lod_ranges[lod - 1])
+	{
+		//the four children share the model, they are transformed at once and only the visible ones are visited
+		BoundingBox boxes[4];
+		for (int i = 0; i < 4; ++i)
+			boxes[i] = getNodeBox(x * 2 + (i & 1), z * 2 + (i >> 1), lod - 1);
+		transformBoundingBoxes(model, boxes, boxes, 4);
+		for (int i = 0; i < 4; ++i)
+			if (camera->testBoxInFrustum(boxes[i].center, boxes[i].halfsize) != CLIP_OUTSIDE)
+				selectNode(camera, local_eye, x * 2 + (i & 1), z * 2 + (i >> 1), lod - 1);
+		return;
+	}
+
+	sChunk chunk;
+	chunk.x = bmin.x;
+	chunk.z = bmin.z;
+	chunk.size = node_size;
+	chunk.lod = (float)lod;
+	if (lod == num_lods - 1) //there is no lod to morph to
+	{
+		chunk.morph_start = TERRAIN_FAR;
+		chunk.morph_end = TERRAIN_FAR * 2.0f;
+	}
+	else
+	{
+		float range_start = lod > 0 ? lod_ranges[lod - 1] : 0.0f;
+		chunk.morph_end = lod_ranges[lod];
+		chunk.morph_start = range_start + (chunk.morph_end - range_start) * (1.0f - morph_ratio);
+	}
+	chunks.push_back(chunk);
+}
+
+void Terrain::selectChunks(Camera* camera)
+{
+	chunks.clear();
+	if (!num_lods)
+		return;
+	Matrix44 inv_model = model;
+	inv_model.inverseAffine();
+	Vector3 local_eye = inv_model * camera->eye;
+	BoundingBox box = transformBoundingBox(model, getNodeBox(0, 0, num_lods - 1));
+	if (camera->testBoxInFrustum(box.center, box.halfsize) != CLIP_OUTSIDE)
+		selectNode(camera, local_eye, 0, 0, num_lods - 1);
+}
+
+void Terrain::render(Camera* camera)
+{
+	if (!patch || !material || !material->shader)
+		return;
+
+	selectChunks(camera);
+	if (chunks.empty())
+		return;
+
+	Matrix44 inv_model = model;
+	inv_model.inverseAffine();
+
+	Shader* shader = material->shader;
+	shader->enable();
+	material->setUniforms(camera, model);
+	shader->setUniform("u_texture", material->texture ? material->texture.get() : Texture::getWhiteTexture(), 0);
+	shader->setUniform("u_heightmap", heights_texture, 1);
+	shader->setUniform("u_normalmap", normals_texture, 2);
+	shader->setUniform("u_local_camera_position", inv_model * camera->eye);
+	shader->setUniform("u_size", size);
+	shader->setUniform("u_patch_resolution", (float)patch_resolution);
+	shader->setUniform("u_heightmap_size", Vector2((float)heightmap.width, (float)heightmap.height));
+	shader->setUniform("u_light_direction", light_direction);
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	//every chunk is an instance of the same patch
+	patch->renderInstanced(GL_TRIANGLES, &chunks[0], chunks.size(), chunk_layout);
+
+	shader->disable();
+}
+
+void Terrain::renderInMenu()
+{
+	SceneNode::renderInMenu();
+	ImGui::Text("Chunks: %d  Lods: %d", (int)chunks.size(), num_lods);
+	if (ImGui::DragFloat("Lod distance", &lod_distance, 1.0f, 1.0f, size))
+		for (int i = 0; i < num_lods - 1; ++i)
+			lod_ranges[i] = lod_distance * (1 << i);
+	ImGui::SliderFloat("Morph ratio", &morph_ratio, 0.0f, 1.0f);
+}
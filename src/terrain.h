@@ -0,0 +1,90 @@
+/*  Heightfield terrain.
+	The heights are stored as floats and uploaded to a texture, every frame a quadtree over the terrain is traversed
+	to select the chunks to draw with a level of detail that depends on the distance to the camera (CDLOD).
+	All the chunks share the same indexed grid patch and are drawn in one instanced call, the vertex shader
+	displaces the patch and morphs it towards the next level of detail to avoid cracks and popping.
+*/
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <vector>
+#include "framework.h"
+#include "scenenode.h"
+
+class Image;
+class Texture;
+
+#define TERRAIN_MAX_LODS 16
+
+//heights in world units sampled from an image
+class HeightMap
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	std::vector<float> data;
+
+	HeightMap() { width = height = 0; }
+
+	void resize(unsigned int w, unsigned int h) { width = w; height = h; data.assign(w * h, 0.0f); }
+	bool load(const char* filename, float altitude); //TGA or PNG, uses the red channel scaled from 0 to altitude
+	void fromImage(Image* image, float altitude);
+
+	float getValue(int x, int y) const { x = x < 0 ? 0 : (x >= (int)width ? width - 1 : x); y = y < 0 ? 0 : (y >= (int)height ? height - 1 : y); return data[y * width + x]; }
+	float getInterpolated(float x, float y) const; //x and y in samples
+	Vector3 getNormal(float x, float y, float cell_x, float cell_z) const; //cell_x and cell_z are the distance between samples in world units
+
+	//normals of every sample packed like the tangents (xyz from 0..255 to -1..1), in parallel and using SIMD
+	void computeNormals(float cell_x, float cell_z, std::vector<Vector4ub>& normals) const;
+};
+
+class Terrain : public SceneNode
+{
+public:
+	//what every instance of the patch receives, see terrain.vs
+	struct sChunk {
+		float x; //corner in local space
+		float z;
+		float size;
+		float lod;
+		float morph_start; //distance to the camera where it starts to morph to the next lod
+		float morph_end;
+	};
+	static InstanceLayout chunk_layout;
+
+	HeightMap heightmap;
+	float size; //the terrain covers from 0 to size in x and z (local space, model should not scale it)
+	int patch_resolution; //quads per side of the patch, power of two
+	int num_lods;
+	float lod_distance; //distance from the camera covered by lod 0, every lod doubles it
+	float morph_ratio; //part of the range of every lod where it morphs to the next one
+	Vector3 light_direction;
+
+	Mesh* patch;
+	Texture* heights_texture;
+	Texture* normals_texture;
+	StandardMaterial* default_material; //created by the terrain and deleted with it, material points to it unless it is replaced
+
+	std::vector<sChunk> chunks; //selected in the last render
+
+	Terrain();
+	~Terrain();
+
+	bool create(const char* heightmap_filename, float size, float altitude, int patch_resolution = 32);
+	void create(float size, int patch_resolution = 32); //uses the heightmap already filled
+	void uploadToVRAM(); //textures and patch, called by create when Mesh::auto_upload_to_vram
+	float getHeight(float x, float z) const; //local space
+
+	void selectChunks(Camera* camera);
+	void render(Camera* camera);
+	void renderInMenu();
+
+private:
+	std::vector< std::vector<float> > min_max; //per lod, min and max height of every node (lod 0 are the leafs)
+	float lod_ranges[TERRAIN_MAX_LODS];
+	BoundingBox getNodeBox(int x, int z, int lod) const; //in terrain space
+	void selectNode(Camera* camera, const Vector3& local_eye, int x, int z, int lod); //the node must be in the frustum
+};
+
+#endif
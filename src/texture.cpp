@@ -43,7 +43,7 @@ Vector4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
 };
 
 
-std::map<std::string, Texture*> Texture::sTexturesLoaded;
+ResourcePool<Texture> Texture::sTexturesLoaded("Textures");
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
@@ -233,12 +233,12 @@ Texture* Texture::Get(const char* filename, bool mipmaps, unsigned int wrap)
 	assert(filename);
 
 	//check if loaded
-	auto it = sTexturesLoaded.find(filename);
-	if (it != sTexturesLoaded.end())
-		return it->second;
+	Texture* texture = sTexturesLoaded.find(filename);
+	if (texture)
+		return texture;
 
 	//load it
-	Texture* texture = new Texture();
+	texture = new Texture();
 	if (!texture->load(filename, mipmaps, wrap))
 	{
 		delete texture;
@@ -267,12 +267,14 @@ bool Texture::load(const char* filename, bool mipmaps, unsigned int wrap, unsign
 	else
 	{
 		std::cout << "[ERROR]: unsupported format" << std::endl;
+		delete image;
 		return false; //unsupported file type
 	}
 
 	if (!found) //file not found
 	{
 		std::cout << " [ERROR]: Texture not found " << std::endl;
+		delete image;
 		return false;
 	}
 
@@ -290,6 +292,7 @@ bool Texture::load(const char* filename, bool mipmaps, unsigned int wrap, unsign
 		generateMipmaps();
 
 	this->image.clear();
+	delete image; //already in VRAM
 	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	setName(filename);
 	return true;
@@ -443,6 +446,7 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 
 void Texture::bind()
 {
+	touch();
 	//glEnable(this->texture_type); //enable the textures 
 	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
 }
@@ -485,6 +489,37 @@ void Texture::toViewport(Shader* shader)
 	shader->disable();
 }
 
+void Texture::getMemoryUsage(size_t& cpu, size_t& gpu) const
+{
+	cpu = image.data ? image.width * image.height * image.bytes_per_pixel : 0;
+
+	gpu = 0;
+	if (!texture_id)
+		return;
+	unsigned int f = internal_format ? internal_format : format;
+	int components = 4;
+	if (f == GL_RED || f == GL_R8 || f == GL_R16F || f == GL_R32F || f == GL_DEPTH_COMPONENT || f == GL_DEPTH_COMPONENT24 || f == GL_DEPTH_COMPONENT32F)
+		components = 1;
+	else if (f == GL_RG || f == GL_RG8 || f == GL_RG16F || f == GL_RG32F)
+		components = 2;
+	else if (f == GL_RGB || f == GL_RGB8 || f == GL_RGB16F || f == GL_RGB32F)
+		components = 3;
+	int bytes = 1;
+	if (type == GL_FLOAT || type == GL_UNSIGNED_INT || f == GL_R32F || f == GL_RG32F || f == GL_RGB32F || f == GL_RGBA32F)
+		bytes = 4;
+	else if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || f == GL_R16F || f == GL_RG16F || f == GL_RGB16F || f == GL_RGBA16F)
+		bytes = 2;
+
+	size_t texels = size_t(width) * size_t(height);
+	if (texture_type == GL_TEXTURE_CUBE_MAP)
+		texels *= 6;
+	else if (depth > 0)
+		texels *= size_t(depth);
+	gpu = texels * components * bytes;
+	if (mipmaps)
+		gpu += gpu / 3; //the whole chain adds a third
+}
+
 FBO* Texture::getGlobalFBO(Texture* texture)
 {
 	if (!global_fbo)
@@ -503,6 +538,16 @@ Texture* Texture::getBlackTexture()
 	return black;
 }
 
+Texture* Texture::getWhiteTexture()
+{
+	static Texture* white = NULL;
+	if (white)
+		return white;
+	const Uint8 data[3] = { 255,255,255 };
+	white = new Texture(1, 1, GL_RGB, GL_UNSIGNED_BYTE, true, (Uint8*)data);
+	return white;
+}
+
 void Texture::blit(Texture* destination, Shader* shader)
 {
 	FBO* fbo = getGlobalFBO(destination);
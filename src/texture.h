@@ -6,6 +6,7 @@
 
 #include "includes.h"
 #include "framework.h"
+#include "resource.h"
 #include "extra/hdre.h"
 #include <map>
 #include <string>
@@ -59,7 +60,7 @@ public:
 
 
 // TEXTURE CLASS
-class Texture
+class Texture : public Resource
 {
 public:
 	static int default_mag_filter;
@@ -69,7 +70,7 @@ public:
 	//a general struct to store all the information about a TGA file
 
 	//textures manager
-	static std::map<std::string, Texture*> sTexturesLoaded;
+	static ResourcePool<Texture> sTexturesLoaded;
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -126,7 +127,8 @@ public:
 
 	//load using the manager (caching loaded ones to avoid reloading them)
 	static Texture* Get(const char* filename, bool mipmaps = true, unsigned int wrap = GL_REPEAT);
-	void setName(const char* name) { sTexturesLoaded[name] = this; }
+	void setName(const char* name) { sTexturesLoaded.add(name, this); }
+	void getMemoryUsage(size_t& cpu, size_t& gpu) const; //image in RAM and texels in VRAM (estimated from the format)
 
 	void generateMipmaps();
 
@@ -136,6 +138,7 @@ public:
 
 	static FBO* getGlobalFBO(Texture* texture);
 	static Texture* getBlackTexture();
+	static Texture* getWhiteTexture();
 };
 
 bool isPowerOfTwo(int n);
@@ -0,0 +1,204 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <memory>
+#include <cassert>
+
+ThreadPool* ThreadPool::Get()
+{
+	//initialized once even if several threads call it at the same time, never deleted so tasks still running at exit keep a valid pool
+	static ThreadPool* pool = new ThreadPool();
+	return pool;
+}
+
+ThreadPool::ThreadPool(int num_threads, int num_background_threads)
+{
+	stop = false;
+	if (num_threads <= 0)
+	{
+		num_threads = (int)std::thread::hardware_concurrency() - 1;
+		if (num_threads < 1)
+			num_threads = 1;
+	}
+
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this, &queue));
+	if (num_background_threads < 1)
+		num_background_threads = 1;
+	for (int i = 0; i < num_background_threads; ++i)
+		background_threads.push_back(std::thread(&ThreadPool::workerLoop, this, &background_queue));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	queue.condition.notify_all();
+	background_queue.condition.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	for (size_t i = 0; i < background_threads.size(); ++i)
+		background_threads[i].join();
+}
+
+std::future<void> ThreadPool::enqueue(std::function<void()> task)
+{
+	//packaged_task is not copyable and std::function needs it to be, so it goes through a shared_ptr
+	std::shared_ptr< std::packaged_task<void()> > packaged = std::make_shared< std::packaged_task<void()> >(task);
+	std::future<void> result = packaged->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(!stop && "enqueue on a stopped ThreadPool");
+		background_queue.tasks.push_back([packaged]() { (*packaged)(); });
+	}
+	background_queue.condition.notify_one();
+	return result;
+}
+
+void ThreadPool::workerLoop(sQueue* queue)
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queue->condition.wait(lock, [this, queue]() { return stop || !queue->tasks.empty(); });
+			if (stop && queue->tasks.empty())
+				return;
+			task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+		}
+		task();
+	}
+}
+
+//range of chunks [begin, end) packed in 64 bits so it can be changed with a single compare and swap
+static inline unsigned long long packRange(unsigned int begin, unsigned int end) { return ((unsigned long long)begin << 32) | end; }
+static inline unsigned int rangeBegin(unsigned long long range) { return (unsigned int)(range >> 32); }
+static inline unsigned int rangeEnd(unsigned long long range) { return (unsigned int)range; }
+
+//state shared by the caller and the helpers of a parallelFor, helpers can run after the call returned.
+//Every participant starts with its own contiguous range of chunks and takes them from the front, when it runs out
+//it steals the back half of the range of another one, so the chunks stay together unless a worker falls behind.
+//Chunks are never given twice, so a range never takes the same value again and the compare and swap cannot be fooled.
+struct sParallelForJob
+{
+	std::function<void(int, int)> func;
+	int num;
+	int grain;
+	int num_chunks;
+	int num_ranges; //the caller and one per helper
+	std::unique_ptr< std::atomic<unsigned long long>[] > ranges;
+	std::atomic<int> done_chunks;
+	std::mutex mutex;
+	std::condition_variable finished; //notified when the last chunk is done
+
+	void setup(int num_participants)
+	{
+		num_ranges = num_participants;
+		ranges.reset(new std::atomic<unsigned long long>[num_ranges]);
+		for (int i = 0; i < num_ranges; ++i)
+			ranges[i] = packRange(unsigned(num_chunks * i / num_ranges), unsigned(num_chunks * (i + 1) / num_ranges));
+	}
+
+	//takes the first chunk of a range, false if it is empty
+	bool pop(int index, int& chunk)
+	{
+		unsigned long long range = ranges[index].load();
+		while (rangeBegin(range) < rangeEnd(range))
+		{
+			if (ranges[index].compare_exchange_weak(range, packRange(rangeBegin(range) + 1, rangeEnd(range))))
+			{
+				chunk = (int)rangeBegin(range);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//moves the back half of the range of another participant to its own (that must be empty), false if all are empty
+	bool steal(int index)
+	{
+		for (int i = 1; i < num_ranges; ++i)
+		{
+			int victim = (index + i) % num_ranges;
+			unsigned long long range = ranges[victim].load();
+			while (rangeBegin(range) < rangeEnd(range))
+			{
+				unsigned int begin = rangeBegin(range), end = rangeEnd(range);
+				unsigned int middle = end - (end - begin + 1) / 2;
+				if (ranges[victim].compare_exchange_weak(range, packRange(begin, middle)))
+				{
+					ranges[index] = packRange(middle, end);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	//runs chunks until there are no more left in any range
+	void work(int index)
+	{
+		int chunk;
+		do
+		{
+			while (pop(index, chunk))
+			{
+				int start = chunk * grain;
+				int end = start + grain < num ? start + grain : num;
+				func(start, end);
+				if (done_chunks.fetch_add(1) + 1 == num_chunks)
+				{
+					//locked so the caller cannot miss it between checking the count and waiting
+					std::lock_guard<std::mutex> lock(mutex);
+					finished.notify_all();
+				}
+			}
+		} while (steal(index));
+	}
+};
+
+void ThreadPool::parallelFor(int num, int grain, std::function<void(int start, int end)> func)
+{
+	if (num <= 0)
+		return;
+	if (grain < 1)
+		grain = 1;
+
+	int num_chunks = (num + grain - 1) / grain;
+	if (num_chunks == 1 || threads.empty())
+	{
+		func(0, num);
+		return;
+	}
+
+	std::shared_ptr<sParallelForJob> job = std::make_shared<sParallelForJob>();
+	job->func = func;
+	job->num = num;
+	job->grain = grain;
+	job->num_chunks = num_chunks;
+	job->done_chunks = 0;
+
+	//one helper per worker is enough, each one keeps taking chunks
+	int num_helpers = num_chunks - 1 < (int)threads.size() ? num_chunks - 1 : (int)threads.size();
+	job->setup(num_helpers + 1);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = 1; i <= num_helpers; ++i)
+			queue.tasks.push_back([job, i]() { job->work(i); });
+	}
+	if (num_helpers == 1)
+		queue.condition.notify_one();
+	else
+		queue.condition.notify_all();
+
+	//the caller takes chunks too, so when it runs out only the chunks already running in other threads are left.
+	//Those never wait for this thread, so it can block even when nested inside another parallelFor
+	job->work(0);
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&job, num_chunks]() { return job->done_chunks.load() == num_chunks; });
+}
@@ -0,0 +1,52 @@
+/*  Pool of worker threads to run tasks in parallel (loading, collisions, animation, ...).
+	Use ThreadPool::Get() to access the global pool. parallelFor splits a range in chunks, gives every
+	thread a contiguous part of them and the threads that finish first steal from the others. The
+	calling thread also runs chunks, so it can be called from inside other tasks. Tasks sent with
+	enqueue (loading files, building BVHs) run in their own background threads so a long load never
+	delays the chunks of a parallelFor of the frame.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+
+class ThreadPool
+{
+public:
+	static ThreadPool* Get(); //global pool, created the first time it is used (from any thread)
+
+	ThreadPool(int num_threads = 0, int num_background_threads = 2); //0 uses one thread per core minus the main one
+	~ThreadPool();
+
+	//runs the task in a background thread, the future can be used to wait for it
+	std::future<void> enqueue(std::function<void()> task);
+
+	//calls func(start, end) for chunks of at most grain elements until num is covered, returns when all are done
+	void parallelFor(int num, int grain, std::function<void(int start, int end)> func);
+
+	int getNumThreads() const { return (int)threads.size(); }
+
+private:
+	struct sQueue {
+		std::deque< std::function<void()> > tasks;
+		std::condition_variable condition;
+	};
+
+	std::vector<std::thread> threads; //run the chunks of parallelFor
+	std::vector<std::thread> background_threads; //run the tasks of enqueue
+	sQueue queue;
+	sQueue background_queue;
+	std::mutex mutex; //for both queues
+	bool stop;
+
+	void workerLoop(sQueue* queue);
+};
+
+#endif
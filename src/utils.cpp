@@ -7,11 +7,14 @@
 #endif
 
 #include "includes.h"
+#include <cstring>
+#include <algorithm>
 
 #include "application.h"
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "threadpool.h"
 
 #include "extra/stb_easy_font.h"
 
@@ -97,6 +100,7 @@ void* getGLProcAddress(const char* name)
 	#define GetCurrentDir _getcwd
 #else
 	#include <unistd.h>
+	#include <dirent.h>
 	#define GetCurrentDir getcwd
 #endif
 
@@ -155,6 +159,38 @@ bool readFile(const std::string& filename, std::string& content)
 	return true;
 }
 
+std::vector<std::string> listFiles(const std::string& folder, const char* extension)
+{
+	std::vector<std::string> files;
+	std::string ext = std::string(".") + extension;
+#ifdef WIN32
+	WIN32_FIND_DATAA find_data;
+	HANDLE handle = FindFirstFileA((folder + "/*" + ext).c_str(), &find_data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return files;
+	do
+	{
+		if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(folder + "/" + find_data.cFileName);
+	} while (FindNextFileA(handle, &find_data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(folder.c_str());
+	if (!dir)
+		return files;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+			files.push_back(folder + "/" + name);
+	}
+	closedir(dir);
+#endif
+	//same order in every system so the files built from them do not change
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
 bool checkGLErrors()
 {
 	#ifdef _DEBUG
@@ -308,8 +344,9 @@ std::string getGPUStats()
 		nCurAvailMemoryInKB = 0;
 	}
 
-	std::string str = "FPS: " + std::to_string(Application::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
+	std::string str = "FPS: " + std::to_string(Application::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered) + " (" + std::to_string(Mesh::num_buffer_setups) + " w/o VAO) Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
 	Mesh::num_meshes_rendered = 0;
+	Mesh::num_buffer_setups = 0;
 	Mesh::num_triangles_rendered = 0;
 	return str;
 }
@@ -353,130 +390,266 @@ char* fetchWord(char* data, char* word)
 	return data;
 }
 
-char* fetchFloat(char* data, float& v)
+//powers of ten that are exact in a double
+static const double s_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+const char* parseFloat(const char* data, float& v)
 {
-	char w[255];
-	data = fetchWord(data,w);
-	v = atof(w);
+	const char* start = data;
+	while (*data == ' ' || *data == '\t')
+		data++;
+	bool negative = *data == '-';
+	if (*data == '-' || *data == '+')
+		data++;
+
+	//up to 19 significant digits fit in the mantissa, the rest only move the exponent
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	const char* digits_start = data;
+	for (; *data >= '0' && *data <= '9'; ++data)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*data - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+			exponent++;
+	}
+	if (*data == '.')
+	{
+		data++;
+		for (; *data >= '0' && *data <= '9'; ++data)
+		{
+			if (digits >= 19)
+				continue;
+			mantissa = mantissa * 10 + (*data - '0');
+			if (mantissa)
+				digits++;
+			exponent--;
+		}
+	}
+	if (data == digits_start || (data == digits_start + 1 && *digits_start == '.'))
+	{
+		v = 0.0f; //not a number
+		return start;
+	}
+	if (*data == 'e' || *data == 'E')
+	{
+		const char* e = data + 1;
+		bool negative_exponent = *e == '-';
+		if (*e == '-' || *e == '+')
+			e++;
+		if (*e >= '0' && *e <= '9')
+		{
+			int value = 0;
+			for (; *e >= '0' && *e <= '9'; ++e)
+				if (value < 10000)
+					value = value * 10 + (*e - '0');
+			exponent += negative_exponent ? -value : value;
+			data = e;
+		}
+	}
+
+	//the mantissa and the power are exact so a single operation rounds it, far enough for a float
+	double result = (double)mantissa;
+	if (mantissa)
+	{
+		while (exponent > 22) { result *= 1e22; exponent -= 22; }
+		while (exponent < -22) { result /= 1e22; exponent += 22; }
+		result = exponent < 0 ? result / s_pow10[-exponent] : result * s_pow10[exponent];
+	}
+	v = (float)(negative ? -result : result);
 	return data;
 }
 
-char* fetchMatrix44(char* data, Matrix44& m)
+const char* parseUInt(const char* data, unsigned int& v)
 {
-	char word[255];
-	for (int i = 0; i < 16; ++i)
+	const char* start = data;
+	while (*data == ' ' || *data == '\t')
+		data++;
+	unsigned int value = 0;
+	const char* digits_start = data;
+	for (; *data >= '0' && *data <= '9'; ++data)
+		value = value * 10 + (*data - '0');
+	if (data == digits_start || *data == '.' || *data == 'e' || *data == 'E')
 	{
-		data = fetchWord(data, word);
-		m.m[i] = atof(word);
+		//written as a float or signed, let the float parser deal with it
+		float f;
+		const char* end = parseFloat(start, f);
+		v = f > 0.0f ? (unsigned int)f : 0;
+		return end;
 	}
+	v = value;
 	return data;
 }
 
-char* fetchEndLine(char* data)
+//skips what is left of the field (like atof ignored it) and its ',' or '\n', returns true if it was the end of the line
+static inline bool skipSeparator(const char*& data)
 {
-	while (*data && *data != '\n') { data++; }
-	if (*data == '\n')
+	while (*data && *data != ',' && *data != '\n')
 		data++;
-	return data;
+	if (*data == 0)
+		return true;
+	return *data++ == '\n';
 }
 
-char* fetchBufferFloat(char* data, std::vector<float>& vector, int num )
+static inline const char* parseNumber(const char* data, float& v) { return parseFloat(data, v); }
+static inline const char* parseNumber(const char* data, unsigned int& v) { return parseUInt(data, v); }
+static inline const char* parseNumber(const char* data, unsigned char& v) { unsigned int i; data = parseUInt(data, i); v = (unsigned char)i; return data; }
+
+//parses comma separated numbers straight into dest until num are read or the line ends (empty fields are skipped)
+//stops at end if it is not NULL, returns the amount parsed
+template<typename T> static int parseNumbers(const char*& data, const char* end, T* dest, int num)
 {
-	int pos = 0;
-	char word[255];
-	if (num)
-		vector.resize(num);
-	else //read size with the first number
+	int index = 0;
+	while (index < num && *data && data != end)
 	{
-		data = fetchWord(data, word);
-		float v = atof(word);
-		assert(v);
-		vector.resize(v);
+		if (*data == ',') { data++; continue; }
+		if (*data == '\n') { data++; break; }
+		const char* next = parseNumber(data, dest[index]);
+		if (next != data)
+			index++;
+		data = next;
+		if (skipSeparator(data))
+			break;
 	}
+	return index;
+}
 
-	int index = 0;
-	while (*data != 0) {
-		if (*data == ',' || *data == '\n')
-		{
-			if (pos == 0)
-			{
-				data++;
-				continue;
-			}
-			word[pos] = 0;
-			float v = atof(word);
-			vector[index++] = v;
-			if (*data == '\n' || *data == 0)
-			{
-				if (*data == '\n')
-					data++;
-				return data;
-			}
-			data++;
-			if (index >= vector.size())
-				return data;
-			pos = 0;
-		}
-		else
+#define PARALLEL_PARSE_MIN_BYTES (1 << 20) //smaller lines are parsed in the calling thread
+#define PARALLEL_PARSE_CHUNK_BYTES (256 << 10)
+
+//parses the rest of the line into dest, big lines are split in chunks at commas and parsed in parallel
+template<typename T> static char* fetchNumbers(char* data, T* dest, int num)
+{
+	const char* line_end = strchr(data, '\n');
+	size_t length = line_end ? line_end - data : strlen(data);
+	ThreadPool* pool = length >= PARALLEL_PARSE_MIN_BYTES ? ThreadPool::Get() : NULL;
+	if (!pool || pool->getNumThreads() == 0)
+	{
+		const char* pos = data;
+		parseNumbers(pos, NULL, dest, num);
+		if (num && line_end && pos <= line_end)
+			pos = line_end + 1; //ignore the numbers that do not fit
+		return (char*)pos;
+	}
+
+	//every chunk starts after a comma, so no number is split between two chunks
+	std::vector<const char*> starts;
+	starts.push_back(data);
+	for (size_t offset = PARALLEL_PARSE_CHUNK_BYTES; offset < length; offset += PARALLEL_PARSE_CHUNK_BYTES)
+	{
+		const char* comma = (const char*)memchr(data + offset, ',', length - offset);
+		if (!comma)
+			break;
+		if (comma + 1 > starts.back())
+			starts.push_back(comma + 1);
+		offset = comma + 1 - data;
+	}
+	starts.push_back(data + length);
+
+	//the amount of numbers in every chunk is not known until parsed, so they go to a temporary vector first
+	int num_chunks = (int)starts.size() - 1;
+	std::vector< std::vector<T> > parsed(num_chunks);
+	pool->parallelFor(num_chunks, 1, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
 		{
-			word[pos++] = *data;
-			data++;
+			const char* pos = starts[i];
+			std::vector<T>& chunk = parsed[i];
+			chunk.resize((starts[i + 1] - pos) / 2 + 1); //a number and its comma take at least two characters
+			chunk.resize(parseNumbers(pos, starts[i + 1], &chunk[0], (int)chunk.size()));
 		}
+	});
+
+	int index = 0;
+	for (int i = 0; i < num_chunks && index < num; ++i)
+	{
+		int count = std::min((int)parsed[i].size(), num - index);
+		if (count)
+			memcpy(dest + index, &parsed[i][0], sizeof(T) * count);
+		index += count;
 	}
+	return line_end ? (char*)line_end + 1 : data + length;
+}
+
+char* fetchFloat(char* data, float& v)
+{
+	const char* pos = parseFloat(data, v);
+	skipSeparator(pos);
+	return (char*)pos;
+}
 
+char* fetchMatrix44(char* data, Matrix44& m)
+{
+	const char* pos = data;
+	for (int i = 0; i < 16; ++i)
+	{
+		pos = parseFloat(pos, m.m[i]);
+		skipSeparator(pos);
+	}
+	return (char*)pos;
+}
+
+char* fetchEndLine(char* data)
+{
+	while (*data && *data != '\n') { data++; }
+	if (*data == '\n')
+		data++;
 	return data;
 }
 
+//the first number of the line is how many numbers follow, they are parsed straight into the vector
+template<typename V, typename T> static char* fetchBuffer(char* data, std::vector<V>& vector)
+{
+	const int components = sizeof(V) / sizeof(T);
+	unsigned int num = 0;
+	const char* pos = parseUInt(data, num);
+	assert(num);
+	if (skipSeparator(pos))
+	{
+		vector.clear();
+		return (char*)pos;
+	}
+	vector.resize(num / components);
+	if (vector.empty())
+		return fetchEndLine((char*)pos);
+	return fetchNumbers((char*)pos, (T*)&vector[0], (int)vector.size() * components);
+}
+
+char* fetchBufferFloat(char* data, std::vector<float>& vector, int num )
+{
+	if (!num) //read size with the first number
+		return fetchBuffer<float, float>(data, vector);
+	vector.resize(num);
+	return fetchNumbers(data, &vector[0], num);
+}
+
 char* fetchBufferVec3(char* data, std::vector<Vector3>& vector)
 {
-	int pos = 0;
-	std::vector<float> floats;
-	data = fetchBufferFloat(data, floats);
-	vector.resize(floats.size() / 3);
-	memcpy(&vector[0], &floats[0], sizeof(float)*floats.size());
-	return data;
+	return fetchBuffer<Vector3, float>(data, vector);
 }
 
 char* fetchBufferVec2(char* data, std::vector<Vector2>& vector)
 {
-	int pos = 0;
-	std::vector<float> floats;
-	data = fetchBufferFloat(data, floats);
-	vector.resize(floats.size() / 2);
-	memcpy(&vector[0], &floats[0], sizeof(float)*floats.size());
-	return data;
+	return fetchBuffer<Vector2, float>(data, vector);
 }
 
 char* fetchBufferVec3u(char* data, std::vector<Vector3u>& vector)
 {
-	int pos = 0;
-	std::vector<float> floats;
-	data = fetchBufferFloat(data, floats);
-	vector.resize(floats.size() / 3);
-	for (int i = 0; i < floats.size(); i += 3)
-		vector[i / 3].set(floats[i], floats[i + 1], floats[i + 2]);
-	return data;
+	return fetchBuffer<Vector3u, unsigned int>(data, vector);
 }
 
 char* fetchBufferVec4ub(char* data, std::vector<Vector4ub>& vector)
 {
-	int pos = 0;
-	std::vector<float> floats;
-	data = fetchBufferFloat(data, floats);
-	vector.resize(floats.size() / 4);
-	for (int i = 0; i < floats.size(); i += 4)
-		vector[i / 4].set(floats[i], floats[i + 1], floats[i + 2], floats[i + 3]);
-	return data;
+	return fetchBuffer<Vector4ub, unsigned char>(data, vector);
 }
 
 char* fetchBufferVec4(char* data, std::vector<Vector4>& vector)
 {
-	int pos = 0;
-	std::vector<float> floats;
-	data = fetchBufferFloat(data, floats);
-	vector.resize(floats.size() / 4);
-	memcpy(&vector[0], &floats[0], sizeof(float)*floats.size());
-	return data;
+	return fetchBuffer<Vector4, float>(data, vector);
 }
 
 bool HoveringImGui() {
@@ -15,6 +15,7 @@
 long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
+std::vector<std::string> listFiles(const std::string& folder, const char* extension); //paths of the files of a folder with that extension (without the dot), sorted
 
 //generic purposes fuctions
 void drawGrid();
@@ -36,6 +37,10 @@ std::string getGPUStats();
 void drawGrid();
 
 //Used in the MESH and ANIM parsers
+//parse a number in place skipping leading blanks, return where it ends (data if there was no number)
+const char* parseFloat(const char* data, float& v);
+const char* parseUInt(const char* data, unsigned int& v);
+
 char* fetchWord(char* data, char* word);
 char* fetchFloat(char* data, float& f);
 char* fetchMatrix44(char* data, Matrix44& m);
@@ -1,4 +1,5 @@
 #include "volume.h"
+#include "random.h"
 #include "extra/pvmparser.h"
 #include "extra/PerlinNoise.hpp"
 
@@ -186,7 +187,7 @@ void Volume::fillNoise(float frequency, int octaves, unsigned int seed, unsigned
 	}
 }
 
-void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
+void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel, unsigned int seed) {
 	if (width != height || width != depth || width % cellsPerSide != 0) {
 		std::cout << "Could not fill volume with Worley noise: All dimensions should be the same and divisible by cellsPerSide.\n";
 		return;
@@ -206,16 +207,11 @@ void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
 
 	float* _distances = new float[side*side*side];
 
-	//Compute a relative point for each cell
-	for (unsigned int i = 0; i < cells; i++) {
-		for (unsigned int j = 0; j < cells; j++) {
-			for (unsigned int k = 0; k < cells; k++) {
-				unsigned int index = i + j * cells + k * cells * cells;
-				points[index].random(0.5);
-				points[index] = points[index] + vec3(0.5, 0.5, 0.5); //Random between 0 and 1
-			}
-		}
-	}
+	//Compute a relative point for each cell, the same seed gives the same points
+	Random generator(seed);
+	generator.fillVector3(points, pointsCount, vec3(0.5, 0.5, 0.5));
+	for (unsigned int i = 0; i < pointsCount; i++)
+		points[i] = points[i] + vec3(0.5, 0.5, 0.5); //Random between 0 and 1
 
 	//Compute min distance to point and store the max on for normalization
 	float maxdist = -1;
@@ -40,7 +40,7 @@ public:
 	//Slow methods
 	void fillSphere();
 	void fillNoise(float frequency, int octaves, unsigned int seed, unsigned int channel = 1); //Channel 1 for R to 4 for A
-	void fillWorleyNoise(unsigned int cellsPerSide = 4, unsigned int channel = 1); //Channel 1 for R to 4 for A
+	void fillWorleyNoise(unsigned int cellsPerSide = 4, unsigned int channel = 1, unsigned int seed = 0); //Channel 1 for R to 4 for A
 };
 
 #endif
\ No newline at end of file